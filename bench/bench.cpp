@@ -0,0 +1,496 @@
+// Microbenchmarks of the forwarding and signaling hot paths. Everything runs
+// in process: subscriber tracks belong to PeerConnections that never connect,
+// and their sends end in a handler that drops them, so no network is needed.
+// Results go to stdout as JSON, one entry per benchmark and parameter set:
+//
+//   sfu_bench [--filter forward] [--min-time-ms 500] > bench.json
+
+#include "auth.hpp"
+#include "client.hpp"
+#include "config.hpp"
+#include "log.hpp"
+#include "loop.hpp"
+#include "participant.hpp"
+#include "room.hpp"
+#include "signaling.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include "external/jwt-cpp/include/jwt-cpp/jwt.h"
+
+#include <nlohmann/json.hpp>
+
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+constexpr size_t Repetitions = 5;
+constexpr uint8_t OpusPayloadType = 111;
+constexpr uint8_t Vp8PayloadType = 120;
+
+struct Options {
+    std::string Filter;
+    std::chrono::milliseconds MinTime{500};
+};
+
+struct Result {
+    std::string Name;
+    json Params;
+    uint64_t Iterations;
+    double NsPerOp;
+    json Extra = json::object();
+};
+
+// Runs the operation in growing batches until a batch takes MinTime, and
+// reports the median time per operation over a few such batches.
+template <typename F>
+Result Measure(const Options& options, std::string name, json params, F&& op) {
+    uint64_t iterations = 1;
+    while (true) {
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        auto elapsed = Clock::now() - start;
+        if (elapsed >= options.MinTime || iterations >= (uint64_t(1) << 32)) {
+            break;
+        }
+        iterations *= elapsed < options.MinTime / 10 ? 10 : 2;
+    }
+
+    std::vector<double> samples;
+    for (size_t r = 0; r < Repetitions; ++r) {
+        auto start = Clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) {
+            op();
+        }
+        std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+        samples.push_back(elapsed.count() / iterations);
+    }
+    std::sort(samples.begin(), samples.end());
+
+    return {std::move(name), std::move(params), iterations, samples[samples.size() / 2]};
+}
+
+// Last handler of a subscriber track: counts what forwarding sends and
+// drops it before it reaches the (never connected) transport.
+class DiscardingSink : public rtc::MediaHandler {
+public:
+    void outgoing(rtc::message_vector& messages, const rtc::message_callback& send) override {
+        Sent.fetch_add(messages.size(), std::memory_order_relaxed);
+        messages.clear();
+    }
+
+    std::atomic<uint64_t> Sent = 0;
+};
+
+rtc::binary MakeRtpPacket(uint8_t payloadType, size_t payloadSize) {
+    rtc::binary packet(sfu::RtpFixedHeaderSize + payloadSize);
+    auto header = reinterpret_cast<rtc::RtpHeader*>(packet.data());
+    header->preparePacket();
+    header->setPayloadType(payloadType);
+    header->setSsrc(1);
+    return packet;
+}
+
+// VP8 packet starting a key frame or a delta frame.
+rtc::binary MakeVp8Packet(bool keyframe, size_t payloadSize) {
+    auto packet = MakeRtpPacket(Vp8PayloadType, payloadSize);
+    auto body = packet.data() + sfu::RtpFixedHeaderSize;
+    body[0] = std::byte{0x10};
+    body[1] = std::byte{static_cast<uint8_t>(keyframe ? 0x00 : 0x01)};
+    return packet;
+}
+
+void AdvanceRtpPacket(rtc::binary& packet, uint32_t timestampStep) {
+    auto header = reinterpret_cast<rtc::RtpHeader*>(packet.data());
+    header->setSeqNumber(header->seqNumber() + 1);
+    header->setTimestamp(header->timestamp() + timestampStep);
+}
+
+// A subscriber that never connects; only its send side is used.
+struct FakeSubscriber {
+    explicit FakeSubscriber(const std::shared_ptr<sfu::Loop>& loop)
+        : PeerConnection(std::make_shared<rtc::PeerConnection>())
+        , Negotiator(std::make_shared<sfu::Negotiator>(PeerConnection, loop, 0))
+        , Bandwidth(std::make_shared<sfu::BandwidthEstimator>())
+    { }
+
+    std::shared_ptr<rtc::PeerConnection> PeerConnection;
+    std::shared_ptr<sfu::Negotiator> Negotiator;
+    std::shared_ptr<sfu::BandwidthEstimator> Bandwidth;
+};
+
+// A relayed publisher forwarding to N subscribers. Injected packets take the
+// same path as the track callbacks installed by Participant::SetTracks.
+class ForwardingFixture {
+public:
+    ForwardingFixture(size_t subscriberCount, const sfu::Config& config)
+        : Loop_(std::make_shared<sfu::Loop>())
+        , Sink_(std::make_shared<DiscardingSink>())
+        , Publisher_(std::make_shared<sfu::Participant>(1, config, sfu::RelaySourceInfo{0, 1, true}, [](sfu::KeyframeArbiter::LayerMask) { }))
+    {
+        for (size_t i = 0; i < subscriberCount; ++i) {
+            auto& subscriber = Subscribers_.emplace_back(Loop_);
+            Publisher_->AddRemoteTracks(100 + i, subscriber.Negotiator->Acquire(), subscriber.Bandwidth);
+        }
+
+        for (const auto& [id, tracks] : Publisher_->GetOutgoingTracks()) {
+            for (const auto& outgoing : tracks) {
+                outgoing->Track->chainMediaHandler(Sink_);
+                outgoing->Open = true;
+            }
+        }
+    }
+
+    void Inject(size_t kind, const rtc::binary& packet) {
+        Publisher_->Inject(kind, 0, sfu::RtpPacket(rtc::binary(packet)));
+    }
+
+    uint64_t GetSent() const {
+        return Sink_->Sent.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::shared_ptr<sfu::Loop> Loop_;
+    std::shared_ptr<DiscardingSink> Sink_;
+    std::vector<FakeSubscriber> Subscribers_;
+    std::shared_ptr<sfu::Participant> Publisher_;
+};
+
+void BenchForwarding(const Options& options, std::vector<Result>& results) {
+    sfu::Config config;
+
+    for (size_t subscribers : {1, 8, 32, 128}) {
+        {
+            ForwardingFixture fixture(subscribers, config);
+            auto packet = MakeRtpPacket(OpusPayloadType, 80);
+            uint64_t ops = 0;
+            auto result = Measure(options, "forward_audio", {{"subscribers", subscribers}}, [&] {
+                AdvanceRtpPacket(packet, 960);
+                fixture.Inject(0, packet);
+                ++ops;
+            });
+            result.Extra["sends_per_op"] = static_cast<double>(fixture.GetSent()) / ops;
+            results.push_back(std::move(result));
+        }
+
+        {
+            ForwardingFixture fixture(subscribers, config);
+            fixture.Inject(1, MakeVp8Packet(true, 1100));
+
+            auto packet = MakeVp8Packet(false, 1100);
+            uint64_t ops = 0;
+            auto result = Measure(options, "forward_video", {{"subscribers", subscribers}}, [&] {
+                AdvanceRtpPacket(packet, 3000);
+                fixture.Inject(1, packet);
+                ++ops;
+            });
+            // The key frame that started the stream went to every subscriber.
+            result.Extra["sends_per_op"] = static_cast<double>(fixture.GetSent() - subscribers) / ops;
+            results.push_back(std::move(result));
+        }
+    }
+
+    // Last-N mode: every subscriber receives the publisher on one audio slot.
+    config.AudioSlots = 3;
+    for (size_t subscribers : {8, 128}) {
+        auto loop = std::make_shared<sfu::Loop>();
+        auto publisher = std::make_shared<sfu::Participant>(1, config, sfu::RelaySourceInfo{0, 1, true}, [](sfu::KeyframeArbiter::LayerMask) { });
+        auto sink = std::make_shared<DiscardingSink>();
+
+        std::vector<std::shared_ptr<sfu::Participant>> participants;
+        for (size_t i = 0; i < subscribers; ++i) {
+            auto& participant = participants.emplace_back(std::make_shared<sfu::Participant>(std::make_shared<rtc::PeerConnection>(), 100 + i, loop, config));
+            auto& slot = participant->GetAudioSlots().front().Target;
+            slot->Track->chainMediaHandler(sink);
+            slot->Open = true;
+            publisher->SetAudioSlot(100 + i, slot);
+        }
+
+        auto packet = MakeRtpPacket(OpusPayloadType, 80);
+        results.push_back(Measure(options, "forward_audio_slots", {{"subscribers", subscribers}}, [&] {
+            AdvanceRtpPacket(packet, 960);
+            publisher->Inject(0, 0, sfu::RtpPacket(rtc::binary(packet)));
+        }));
+    }
+}
+
+void BenchLoop(const Options& options, std::vector<Result>& results) {
+    constexpr uint64_t TasksPerProducer = 200'000;
+
+    for (size_t producers : {1, 2, 4, 8}) {
+        std::vector<double> samples;
+        for (size_t r = 0; r < Repetitions; ++r) {
+            sfu::Loop loop;
+            std::atomic<uint64_t> executed = 0;
+            std::thread consumer([&loop] {
+                loop.Run();
+            });
+
+            auto start = Clock::now();
+            std::vector<std::thread> threads;
+            for (size_t p = 0; p < producers; ++p) {
+                threads.emplace_back([&loop, &executed] {
+                    for (uint64_t i = 0; i < TasksPerProducer; ++i) {
+                        loop.EnqueueTask([&executed] {
+                            executed.fetch_add(1, std::memory_order_relaxed);
+                        });
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            loop.Stop();
+            consumer.join();
+
+            std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+            samples.push_back(elapsed.count() / executed.load());
+        }
+        std::sort(samples.begin(), samples.end());
+
+        results.push_back({"loop_enqueue_run", {{"producers", producers}}, producers * TasksPerProducer, samples[samples.size() / 2]});
+    }
+}
+
+// Throwaway RSA key pair, so tokens can be signed without a key on disk.
+std::pair<std::string, std::string> GenerateKeyPair() {
+    std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)> key(EVP_RSA_gen(2048), EVP_PKEY_free);
+
+    auto toPem = [&key](bool isPrivate) {
+        std::unique_ptr<BIO, decltype(&BIO_free)> bio(BIO_new(BIO_s_mem()), BIO_free);
+        if (isPrivate) {
+            PEM_write_bio_PrivateKey(bio.get(), key.get(), nullptr, nullptr, 0, nullptr, nullptr);
+        } else {
+            PEM_write_bio_PUBKEY(bio.get(), key.get());
+        }
+        char* data = nullptr;
+        auto size = BIO_get_mem_data(bio.get(), &data);
+        return std::string(data, size);
+    };
+
+    return {toPem(true), toPem(false)};
+}
+
+void BenchValidateOffer(const Options& options, std::vector<Result>& results) {
+    auto [privateKey, publicKey] = GenerateKeyPair();
+    auto publicKeyPath = std::filesystem::temp_directory_path() / ("sfu_bench_" + std::to_string(getpid()) + ".pem");
+    std::ofstream(publicKeyPath) << publicKey;
+
+    auto now = std::chrono::system_clock::now();
+    auto token = jwt::create()
+        .set_type("JWT")
+        .set_issued_at(now)
+        .set_expires_at(now + std::chrono::hours(1))
+        .set_payload_claim("room", jwt::claim(picojson::value(int64_t(1))))
+        .set_payload_claim("user_id", jwt::claim(picojson::value(int64_t(1))))
+        .sign(jwt::algorithm::rs256("", privateKey, "", ""));
+
+    json offer = {{"type", "offer"}, {"token", token}, {"sdp", std::string(2000, 'x')}};
+    auto client = std::make_shared<sfu::Client>();
+
+    for (size_t cacheSize : {0, 4096}) {
+        sfu::TokenVerifier verifier(publicKeyPath.string(), cacheSize);
+        verifier.Reload();
+        results.push_back(Measure(options, "validate_offer", {{"cached", cacheSize > 0}}, [&] {
+            if (!sfu::ValidateOffer(offer, client, verifier)) {
+                std::abort();
+            }
+        }));
+    }
+
+    sfu::TokenVerifier verifier(publicKeyPath.string(), 0);
+    verifier.Reload();
+    json invalid = {{"type", "offer"}, {"token", token.substr(0, token.size() - 4) + "AAAA"}};
+    results.push_back(Measure(options, "validate_offer_invalid", json::object(), [&] {
+        sfu::ValidateOffer(invalid, client, verifier);
+    }));
+
+    std::filesystem::remove(publicKeyPath);
+}
+
+// The frequent signaling messages, read in place and, for comparison, through
+// a JSON DOM as before.
+void BenchSignaling(const Options& options, std::vector<Result>& results) {
+    const std::vector<std::pair<std::string, std::string>> messages = {
+        {"ping", R"({"type":"ping"})"},
+        {"candidate", R"({"type":"candidate","candidate":"candidate:1 1 UDP 2122252543 192.168.1.20 50000 typ host","sdpMid":"0"})"},
+        {"layer", R"({"type":"layer","ssrc":3094875467,"layer":1})"},
+    };
+
+    for (const auto& [name, text] : messages) {
+        results.push_back(Measure(options, "signaling_scan", {{"message", name}}, [&] {
+            sfu::SignalingMessage message(text);
+            if (!message.IsValid() || !message.GetRawString("type")) {
+                std::abort();
+            }
+            if (auto candidate = message.GetString("candidate"); candidate && candidate->empty()) {
+                std::abort();
+            }
+        }));
+
+        results.push_back(Measure(options, "signaling_dom", {{"message", name}}, [&] {
+            auto message = json::parse(text);
+            if (!message["type"].is_string()) {
+                std::abort();
+            }
+            if (auto it = message.find("candidate"); it != message.end() && it->get<std::string>().empty()) {
+                std::abort();
+            }
+        }));
+    }
+
+    results.push_back(Measure(options, "signaling_reply", {{"message", "candidate"}}, [&] {
+        if (sfu::MakeCandidateMessage("candidate:1 1 UDP 2122252543 192.168.1.20 50000 typ host", "0").empty()) {
+            std::abort();
+        }
+    }));
+}
+
+// A local participant with its own publisher tracks, as after ICE connects.
+struct FakeParticipant {
+    FakeParticipant(sfu::ClientId clientId, const std::shared_ptr<sfu::Loop>& loop, const sfu::Config& config)
+        : PeerConnection(std::make_shared<rtc::PeerConnection>())
+        , Participant(std::make_shared<sfu::Participant>(PeerConnection, clientId, loop, config))
+    {
+        rtc::Description::Audio audio("0", rtc::Description::Direction::RecvOnly);
+        audio.addOpusCodec(OpusPayloadType);
+        rtc::Description::Video video("1", rtc::Description::Direction::RecvOnly);
+        video.addVP8Codec(Vp8PayloadType);
+        Tracks = {PeerConnection->addTrack(audio), PeerConnection->addTrack(video)};
+    }
+
+    std::shared_ptr<rtc::PeerConnection> PeerConnection;
+    std::shared_ptr<sfu::Participant> Participant;
+    std::array<std::shared_ptr<rtc::Track>, 2> Tracks;
+};
+
+void BenchRoom(const Options& options, std::vector<Result>& results) {
+    sfu::Config config;
+
+    for (size_t roomSize : {2, 8, 32, 64}) {
+        auto loop = std::make_shared<sfu::Loop>();
+        sfu::Room room;
+
+        std::vector<FakeParticipant> members;
+        for (size_t i = 0; i + 1 < roomSize; ++i) {
+            auto& member = members.emplace_back(1 + i, loop, config);
+            room.AddParticipant(1 + i, member.Participant);
+            room.HandleTracksForParticipant(1 + i, member.Tracks);
+        }
+
+        // The joiner's setup and the leave afterwards aren't timed; the
+        // PeerConnections are the costly part of them.
+        auto iterations = std::max<size_t>(20, 2000 / roomSize);
+        std::chrono::nanoseconds addTime{0};
+        std::chrono::nanoseconds tracksTime{0};
+        for (size_t i = 0; i < iterations; ++i) {
+            sfu::ClientId id = 10'000 + i;
+            FakeParticipant joiner(id, loop, config);
+
+            auto start = Clock::now();
+            room.AddParticipant(id, joiner.Participant);
+            auto added = Clock::now();
+            room.HandleTracksForParticipant(id, joiner.Tracks);
+            auto handled = Clock::now();
+
+            addTime += added - start;
+            tracksTime += handled - added;
+            room.RemoveParticipant(id);
+        }
+
+        results.push_back({"room_add_participant", {{"room_size", roomSize}}, iterations, static_cast<double>(addTime.count()) / iterations});
+        results.push_back({"room_handle_tracks", {{"room_size", roomSize}}, iterations, static_cast<double>(tracksTime.count()) / iterations});
+    }
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    for (int i = 1; i < argc; i += 2) {
+        std::string_view name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            return 1;
+        }
+        std::string_view value = argv[i + 1];
+
+        if (name == "--filter") {
+            options.Filter = value;
+        } else if (name == "--min-time-ms") {
+            int64_t ms = 0;
+            auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), ms);
+            if (ec != std::errc() || ptr != value.data() + value.size()) {
+                std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+                return 1;
+            }
+            options.MinTime = std::chrono::milliseconds(std::max<int64_t>(ms, 1));
+        } else {
+            std::cerr << "Unknown option " << name << std::endl;
+            return 1;
+        }
+    }
+
+    // Only errors are formatted, and as the logger isn't started they are
+    // dropped instead of mixing with the report.
+    sfu::Logger::Get().SetLevel(sfu::LogLevel::Error);
+    rtc::InitLogger(rtc::LogLevel::Error);
+
+    using Suite = void (*)(const Options&, std::vector<Result>&);
+    std::vector<std::pair<std::string, Suite>> suites = {
+        {"forward", BenchForwarding},
+        {"loop", BenchLoop},
+        {"validate_offer", BenchValidateOffer},
+        {"signaling", BenchSignaling},
+        {"room", BenchRoom},
+    };
+
+    std::vector<Result> results;
+    for (const auto& [name, suite] : suites) {
+        if (options.Filter.empty() || name.find(options.Filter) != std::string::npos) {
+            suite(options, results);
+        }
+    }
+
+    json benchmarks = json::array();
+    for (auto& result : results) {
+        json entry = {
+            {"name", result.Name},
+            {"params", result.Params},
+            {"iterations", result.Iterations},
+            {"ns_per_op", result.NsPerOp},
+            {"ops_per_sec", result.NsPerOp > 0 ? 1e9 / result.NsPerOp : 0.0},
+        };
+        entry.update(result.Extra);
+        benchmarks.push_back(std::move(entry));
+    }
+
+    std::cout << json{
+        {"hardware_concurrency", std::thread::hardware_concurrency()},
+        {"benchmarks", benchmarks},
+    }.dump(2) << std::endl;
+
+    return 0;
+}
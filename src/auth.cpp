@@ -0,0 +1,174 @@
+#include "auth.hpp"
+
+#include "log.hpp"
+#include "utils.hpp"
+
+#include <stdexcept>
+
+namespace sfu {
+
+TokenVerifier::TokenVerifier(std::string publicKeyPath, size_t cacheCapacity)
+    : PublicKeyPath_(std::move(publicKeyPath))
+    , CacheCapacity_(cacheCapacity)
+{ }
+
+bool TokenVerifier::Reload() {
+    std::lock_guard<std::mutex> lock(ReloadMutex_);
+
+    std::error_code ec;
+    auto writeTime = std::filesystem::last_write_time(PublicKeyPath_, ec);
+
+    auto publicKey = ReadPemFile(PublicKeyPath_);
+    if (publicKey.empty()) {
+        LOG_ERROR() << "Public key " << PublicKeyPath_ << " is empty";
+        return false;
+    }
+
+    try {
+        auto previous = Key_.load();
+        auto key = std::make_shared<const Key>(Key{
+            jwt::verify().allow_algorithm(jwt::algorithm::rs256(publicKey, "", "", "")),
+            previous ? previous->Generation + 1 : 1,
+        });
+        Key_.store(std::move(key));
+    } catch (const std::exception& ex) {
+        LOG_ERROR() << "Failed to load public key " << PublicKeyPath_ << ": " << ex.what();
+        return false;
+    }
+
+    if (!ec) {
+        KeyWriteTime_ = writeTime;
+    }
+
+    // Entries verified with the old key are dropped lazily by generation.
+    LOG_INFO() << "Loaded public key " << PublicKeyPath_;
+    return true;
+}
+
+bool TokenVerifier::ReloadIfChanged() {
+    std::error_code ec;
+    auto writeTime = std::filesystem::last_write_time(PublicKeyPath_, ec);
+    if (ec) {
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ReloadMutex_);
+        if (writeTime == KeyWriteTime_) {
+            return false;
+        }
+    }
+
+    return Reload();
+}
+
+TokenClaims TokenVerifier::Verify(const std::string& token) {
+    auto key = Key_.load();
+    if (!key) {
+        throw std::runtime_error("Public key is not loaded");
+    }
+
+    if (auto claims = FindCached(token, key->Generation)) {
+        return *claims;
+    }
+
+    auto decoded = jwt::decode(token);
+    key->Verifier.verify(decoded);
+
+    if (!decoded.has_payload_claim("room")) {
+        throw std::runtime_error("Offer doesn't contain room");
+    }
+
+    if (!decoded.has_payload_claim("user_id")) {
+        throw std::runtime_error("Offer doesn't contain user_id");
+    }
+
+    auto roomId = decoded.get_payload_claim("room").as_integer();
+    auto clientId = decoded.get_payload_claim("user_id").as_integer();
+    if (roomId <= 0 || clientId <= 0) {
+        throw std::runtime_error("Invalid room or user id");
+    }
+
+    bool webinar = decoded.has_payload_claim("webinar") && decoded.get_payload_claim("webinar").as_boolean();
+    auto role = webinar ? ParticipantRole::Audience : ParticipantRole::Speaker;
+    if (decoded.has_payload_claim("role")) {
+        auto name = decoded.get_payload_claim("role").as_string();
+        if (name == "speaker") {
+            role = ParticipantRole::Speaker;
+        } else if (name == "audience") {
+            role = ParticipantRole::Audience;
+        } else {
+            throw std::runtime_error("Invalid role " + name);
+        }
+    }
+
+    TokenClaims claims{static_cast<ClientId>(clientId), static_cast<RoomId>(roomId), role};
+    auto expiresAt = decoded.has_expires_at()
+        ? decoded.get_expires_at()
+        : std::chrono::system_clock::time_point::max();
+
+    AddCached(token, claims, expiresAt, key->Generation);
+    return claims;
+}
+
+std::optional<TokenClaims> TokenVerifier::FindCached(const std::string& token, uint64_t generation) {
+    std::lock_guard<std::mutex> lock(CacheMutex_);
+
+    auto it = CacheIndex_.find(token);
+    if (it == CacheIndex_.end()) {
+        return {};
+    }
+
+    auto entry = it->second;
+    if (entry->Generation != generation || entry->ExpiresAt <= std::chrono::system_clock::now()) {
+        // Expired or signed for a rotated key: verify again from scratch.
+        CacheIndex_.erase(it);
+        Cache_.erase(entry);
+        return {};
+    }
+
+    Cache_.splice(Cache_.begin(), Cache_, entry);
+    return entry->Claims;
+}
+
+void TokenVerifier::AddCached(const std::string& token, const TokenClaims& claims, std::chrono::system_clock::time_point expiresAt, uint64_t generation) {
+    if (CacheCapacity_ == 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(CacheMutex_);
+
+    if (auto it = CacheIndex_.find(token); it != CacheIndex_.end()) {
+        auto entry = it->second;
+        CacheIndex_.erase(it);
+        Cache_.erase(entry);
+    }
+
+    while (Cache_.size() >= CacheCapacity_) {
+        CacheIndex_.erase(Cache_.back().Token);
+        Cache_.pop_back();
+    }
+
+    Cache_.push_front(CacheEntry{token, claims, expiresAt, generation});
+    CacheIndex_.emplace(Cache_.front().Token, Cache_.begin());
+}
+
+std::optional<TokenClaims> ValidateOffer(const nlohmann::json& offer, std::shared_ptr<Client> client, TokenVerifier& verifier) {
+    auto tokenIt = offer.find("token");
+    if (tokenIt == offer.end() || !tokenIt->is_string()) {
+        client->ErrorMessage = "Offer doesn't contain token";
+        return {};
+    }
+
+    try {
+        return verifier.Verify(tokenIt->get_ref<const std::string&>());
+    } catch (const jwt::error::token_verification_exception& ex) {
+        client->ErrorMessage = (std::string("Verification failed: ") + ex.what());
+    } catch (const std::exception& ex) {
+        client->ErrorMessage = ex.what();
+    }
+
+    return {};
+}
+
+} // namespace sfu
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "client.hpp"
+
+#include "external/jwt-cpp/include/jwt-cpp/jwt.h"
+
+#include <nlohmann/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace sfu {
+
+// The optional "role" claim is "speaker" or "audience". Without it the
+// client is a speaker, unless the "webinar" claim marks the room as one.
+struct TokenClaims {
+    ClientId clientId;
+    RoomId roomId;
+    ParticipantRole Role = ParticipantRole::Speaker;
+};
+
+// Verifies signaling tokens against the RS256 public key. The key is parsed
+// once and swapped atomically on rotation; tokens that passed verification
+// are remembered until they expire so renegotiations skip the RSA check.
+// Safe to use from every shard at once.
+class TokenVerifier {
+public:
+    TokenVerifier(std::string publicKeyPath, size_t cacheCapacity);
+
+    // Re-reads the key file. On failure the previous key stays in use.
+    bool Reload();
+    bool ReloadIfChanged();
+
+    // Throws on an invalid token or missing claims.
+    TokenClaims Verify(const std::string& token);
+
+private:
+    using JwtVerifier = decltype(jwt::verify());
+
+    struct Key {
+        JwtVerifier Verifier;
+        uint64_t Generation;
+    };
+
+    struct CacheEntry {
+        std::string Token;
+        TokenClaims Claims;
+        std::chrono::system_clock::time_point ExpiresAt;
+        uint64_t Generation;
+    };
+
+    std::optional<TokenClaims> FindCached(const std::string& token, uint64_t generation);
+    void AddCached(const std::string& token, const TokenClaims& claims, std::chrono::system_clock::time_point expiresAt, uint64_t generation);
+
+    const std::string PublicKeyPath_;
+    const size_t CacheCapacity_;
+
+    std::atomic<std::shared_ptr<const Key>> Key_;
+    std::filesystem::file_time_type KeyWriteTime_;
+    std::mutex ReloadMutex_;
+
+    // Most recently used entries first.
+    std::mutex CacheMutex_;
+    std::list<CacheEntry> Cache_;
+    std::unordered_map<std::string_view, std::list<CacheEntry>::iterator> CacheIndex_;
+};
+
+// Checks the token of a client's offer or role change. On failure the
+// reason is left in the client's ErrorMessage.
+std::optional<TokenClaims> ValidateOffer(const nlohmann::json& offer, std::shared_ptr<Client> client, TokenVerifier& verifier);
+
+} // namespace sfu
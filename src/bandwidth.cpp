@@ -0,0 +1,161 @@
+#include "bandwidth.hpp"
+
+#include "nack.hpp"
+
+#include <algorithm>
+
+namespace sfu {
+
+namespace {
+
+// Burst the bucket may accumulate, as time at the estimated rate.
+constexpr int64_t BurstMicroseconds = 100'000;
+
+// Loss thresholds of the loss-based controller (out of 256).
+constexpr uint8_t HighLoss = 26;
+constexpr uint8_t LowLoss = 5;
+
+uint32_t ReadUint32(const std::byte* data) {
+    return std::to_integer<uint32_t>(data[0]) << 24 | std::to_integer<uint32_t>(data[1]) << 16
+        | std::to_integer<uint32_t>(data[2]) << 8 | std::to_integer<uint32_t>(data[3]);
+}
+
+int64_t ToMicroseconds(BandwidthEstimator::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+} // namespace
+
+void BandwidthEstimator::OnRemb(uint32_t bitrate) {
+    Remb_.store(bitrate, std::memory_order_relaxed);
+    uint32_t expected = 0;
+    LossBased_.compare_exchange_strong(expected, bitrate, std::memory_order_relaxed);
+    UpdateEstimate();
+}
+
+void BandwidthEstimator::OnReceiverReport(uint8_t fractionLost) {
+    auto current = LossBased_.load(std::memory_order_relaxed);
+    if (current == 0) {
+        return;
+    }
+
+    // Back off in proportion to heavy loss, probe back up slowly when the
+    // link is clean; REMB stays the upper bound.
+    if (fractionLost > HighLoss) {
+        current = static_cast<uint32_t>(current * (1.0 - 0.5 * fractionLost / 256.0));
+    } else if (fractionLost < LowLoss) {
+        current = static_cast<uint32_t>(current * 1.05);
+    }
+    LossBased_.store(current, std::memory_order_relaxed);
+    UpdateEstimate();
+}
+
+void BandwidthEstimator::UpdateEstimate() {
+    auto remb = Remb_.load(std::memory_order_relaxed);
+    auto lossBased = LossBased_.load(std::memory_order_relaxed);
+    Estimate_.store(remb ? std::min(remb, lossBased) : lossBased, std::memory_order_relaxed);
+}
+
+uint32_t BandwidthEstimator::GetStreamShare() const {
+    auto estimate = GetEstimate();
+    if (estimate == 0) {
+        return 0;
+    }
+    return estimate / std::max<uint32_t>(1, Streams_.load(std::memory_order_relaxed));
+}
+
+void BandwidthEstimator::Refill(Clock::time_point now) {
+    auto estimate = GetEstimate();
+    auto nowUs = ToMicroseconds(now);
+    auto last = LastRefill_.load(std::memory_order_relaxed);
+    if (nowUs <= last || !LastRefill_.compare_exchange_strong(last, nowUs, std::memory_order_relaxed)) {
+        return;
+    }
+
+    auto burst = static_cast<int64_t>(estimate) * BurstMicroseconds / 8'000'000;
+    auto added = last == 0 ? burst : static_cast<int64_t>(estimate) * (nowUs - last) / 8'000'000;
+    auto tokens = Tokens_.fetch_add(added, std::memory_order_relaxed) + added;
+    if (tokens > burst) {
+        Tokens_.fetch_sub(tokens - burst, std::memory_order_relaxed);
+    }
+}
+
+void BandwidthEstimator::Consume(size_t bytes, Clock::time_point now) {
+    if (GetEstimate() == 0) {
+        return;
+    }
+    Refill(now);
+    Tokens_.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+bool BandwidthEstimator::TryConsume(size_t bytes, Clock::time_point now) {
+    if (GetEstimate() == 0) {
+        return true;
+    }
+    Refill(now);
+
+    auto size = static_cast<int64_t>(bytes);
+    if (Tokens_.fetch_sub(size, std::memory_order_relaxed) < size) {
+        Tokens_.fetch_add(size, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+SubscriberSession::SubscriberSession(std::shared_ptr<BandwidthEstimator> bandwidth, KeyframeRequestCallback onKeyframeRequest, NackCallback onNack)
+    : Bandwidth_(std::move(bandwidth))
+    , OnKeyframeRequest_(std::move(onKeyframeRequest))
+    , OnNack_(std::move(onNack))
+{ }
+
+void SubscriberSession::incoming(rtc::message_vector& messages, const rtc::message_callback&) {
+    for (const auto& message : messages) {
+        if (message->type == rtc::Message::Control) {
+            HandleRtcp(*message);
+        }
+    }
+}
+
+void SubscriberSession::HandleRtcp(const rtc::Message& message) {
+    size_t offset = 0;
+    while (offset + 4 <= message.size()) {
+        auto header = reinterpret_cast<const rtc::RtcpHeader*>(message.data() + offset);
+        size_t length = header->lengthInBytes();
+        if (length < 4 || offset + length > message.size()) {
+            break;
+        }
+
+        auto packet = message.data() + offset;
+        auto payloadType = header->payloadType();
+
+        if (payloadType == 200 || payloadType == 201) {
+            // Sender or receiver report: report blocks follow the sender info.
+            size_t blocks = offset + (payloadType == 200 ? 28 : 8);
+            for (size_t i = 0; i < header->reportCount() && blocks + 24 * (i + 1) <= offset + length; ++i) {
+                auto fractionLost = std::to_integer<uint8_t>(message[blocks + 24 * i + 4]);
+                Bandwidth_->OnReceiverReport(fractionLost);
+            }
+        } else if (payloadType == 205 && header->reportCount() == 1) {
+            // Generic NACK: answered from the stream's retransmission history.
+            if (OnNack_) {
+                OnNack_(ParseNack({packet, length}));
+            }
+        } else if (payloadType == 206 && header->reportCount() == 15 && length >= 20) {
+            // REMB: "REMB", SSRC count, 6-bit exponent and 18-bit mantissa.
+            if (std::equal(packet + 12, packet + 16, reinterpret_cast<const std::byte*>("REMB"))) {
+                auto value = ReadUint32(packet + 16);
+                uint64_t bitrate = uint64_t(value & 0x3FFFF) << ((value >> 18) & 0x3F);
+                Bandwidth_->OnRemb(static_cast<uint32_t>(std::min<uint64_t>(bitrate, UINT32_MAX)));
+            }
+        } else if (payloadType == 206 && (header->reportCount() == 1 || header->reportCount() == 4)) {
+            // PLI (FMT 1) or FIR (FMT 4) from the subscriber's decoder.
+            if (OnKeyframeRequest_) {
+                OnKeyframeRequest_(header->reportCount() == 1 ? KeyframeArbiter::Source::Pli : KeyframeArbiter::Source::Fir);
+            }
+        }
+
+        offset += length;
+    }
+}
+
+} // namespace sfu
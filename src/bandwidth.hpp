@@ -0,0 +1,83 @@
+#pragma once
+
+#include "keyframe.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace sfu {
+
+// Downlink estimate of one subscriber PeerConnection, built from the RTCP
+// feedback its browser sends (REMB, receiver report loss), and a token
+// bucket that spends it. Shared by every track forwarded to the subscriber
+// and updated from several publishers' media threads, so all state is atomic.
+class BandwidthEstimator {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    void OnRemb(uint32_t bitrate);
+    void OnReceiverReport(uint8_t fractionLost);
+
+    // Bits per second, 0 while no feedback has arrived.
+    uint32_t GetEstimate() const {
+        return Estimate_.load(std::memory_order_relaxed);
+    }
+
+    // Number of video streams sharing the estimate.
+    void AddStream() {
+        Streams_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void RemoveStream() {
+        Streams_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Share of the estimate a single video stream may use, 0 if unlimited.
+    uint32_t GetStreamShare() const;
+
+    // Charges a packet that must be sent regardless of the budget (audio).
+    void Consume(size_t bytes, Clock::time_point now);
+
+    // Charges a packet that may be dropped; false if over budget.
+    bool TryConsume(size_t bytes, Clock::time_point now);
+
+private:
+    void Refill(Clock::time_point now);
+    void UpdateEstimate();
+
+    std::atomic<uint32_t> Remb_ = 0;
+    std::atomic<uint32_t> LossBased_ = 0;
+    std::atomic<uint32_t> Estimate_ = 0;
+    std::atomic<uint32_t> Streams_ = 0;
+
+    std::atomic<int64_t> Tokens_ = 0;
+    std::atomic<int64_t> LastRefill_ = 0;
+};
+
+// Reads the RTCP a subscriber sends back on one of its forwarded tracks and
+// feeds its BandwidthEstimator. PLI and FIR are handed to onKeyframeRequest,
+// and NACKs to onNack, if set, instead of reaching the publisher directly.
+class SubscriberSession : public rtc::MediaHandler {
+public:
+    using KeyframeRequestCallback = std::function<void(KeyframeArbiter::Source)>;
+    using NackCallback = std::function<void(const std::vector<uint16_t>&)>;
+
+    explicit SubscriberSession(std::shared_ptr<BandwidthEstimator> bandwidth, KeyframeRequestCallback onKeyframeRequest = {}, NackCallback onNack = {});
+
+    void incoming(rtc::message_vector& messages, const rtc::message_callback& send) override;
+
+private:
+    void HandleRtcp(const rtc::Message& message);
+
+    std::shared_ptr<BandwidthEstimator> Bandwidth_;
+    KeyframeRequestCallback OnKeyframeRequest_;
+    NackCallback OnNack_;
+};
+
+} // namespace sfu
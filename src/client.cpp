@@ -0,0 +1,104 @@
+#include "client.hpp"
+
+#include <openssl/rand.h>
+
+#include <charconv>
+#include <stdexcept>
+
+namespace sfu {
+
+std::string MakeResumeToken(RoomId roomId) {
+    std::array<unsigned char, 16> random;
+    if (RAND_bytes(random.data(), random.size()) != 1) {
+        throw std::runtime_error("No randomness for a resume token");
+    }
+
+    static constexpr char Hex[] = "0123456789abcdef";
+    std::string token = std::to_string(roomId) + ".";
+    for (auto byte : random) {
+        token += Hex[byte >> 4];
+        token += Hex[byte & 0xF];
+    }
+    return token;
+}
+
+std::optional<RoomId> ParseResumeRoom(std::string_view token) {
+    RoomId roomId = 0;
+    auto [end, error] = std::from_chars(token.data(), token.data() + token.size(), roomId);
+    if (error != std::errc() || end == token.data() + token.size() || *end != '.') {
+        return {};
+    }
+    return roomId;
+}
+
+void ClientRegistry::Add(const std::shared_ptr<Client>& client) {
+    ByWs_[client->ws.get()] = client;
+    if (client->clientId && client->roomId) {
+        Assign(client, *client->clientId, *client->roomId);
+    }
+}
+
+void ClientRegistry::Remove(const std::shared_ptr<Client>& client) {
+    Unassign(client);
+
+    if (auto it = ByWs_.find(client->ws.get()); it != ByWs_.end() && it->second == client) {
+        ByWs_.erase(it);
+    }
+}
+
+void ClientRegistry::Assign(const std::shared_ptr<Client>& client, ClientId clientId, RoomId roomId) {
+    Unassign(client);
+
+    client->clientId = clientId;
+    client->roomId = roomId;
+
+    ByClientId_.emplace(clientId, client);
+    ByRoom_[roomId][clientId] = client;
+}
+
+void ClientRegistry::Unassign(const std::shared_ptr<Client>& client) {
+    if (!client->clientId || !client->roomId) {
+        return;
+    }
+
+    auto [begin, end] = ByClientId_.equal_range(*client->clientId);
+    for (auto it = begin; it != end; ++it) {
+        if (it->second == client) {
+            ByClientId_.erase(it);
+            break;
+        }
+    }
+
+    if (auto room = ByRoom_.find(*client->roomId); room != ByRoom_.end()) {
+        if (auto it = room->second.find(*client->clientId); it != room->second.end() && it->second == client) {
+            room->second.erase(it);
+        }
+        if (room->second.empty()) {
+            ByRoom_.erase(room);
+        }
+    }
+}
+
+std::shared_ptr<Client> ClientRegistry::Find(const rtc::WebSocket* ws) const {
+    auto it = ByWs_.find(ws);
+    return it != ByWs_.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<Client> ClientRegistry::Find(RoomId roomId, ClientId clientId) const {
+    auto room = ByRoom_.find(roomId);
+    if (room == ByRoom_.end()) {
+        return nullptr;
+    }
+
+    auto it = room->second.find(clientId);
+    return it != room->second.end() ? it->second : nullptr;
+}
+
+const ClientRegistry::RoomClients& ClientRegistry::GetRoomClients(RoomId roomId) const {
+    static const RoomClients empty;
+
+    auto it = ByRoom_.find(roomId);
+    return it != ByRoom_.end() ? it->second : empty;
+}
+
+} // namespace sfu
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "fwd.hpp"
+#include "task.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace sfu {
+
+using ClientId = uint64_t;
+using RoomId = uint64_t;
+
+// Speakers publish and subscribe; the audience only subscribes.
+enum class ParticipantRole {
+    Speaker,
+    Audience,
+};
+
+struct Client {
+    // Index of the shard whose loop owns this client.
+    std::atomic<size_t> Shard = 0;
+    // Shard tasks of this client in the order they were dispatched; the
+    // front one is running or about to.
+    std::mutex TasksMutex;
+    std::deque<Task> Tasks;
+
+    std::optional<ClientId> clientId;
+    std::optional<RoomId> roomId;
+    std::shared_ptr<rtc::WebSocket> ws;
+    std::shared_ptr<rtc::PeerConnection> pc;
+    std::string ErrorMessage;
+    bool IsVideoActive = false;
+    ParticipantRole Role = ParticipantRole::Speaker;
+    // When the first offer arrived, to time the join.
+    std::chrono::steady_clock::time_point JoinStartedAt;
+    // Lets a new WebSocket take this session over once this one drops;
+    // empty while the session can't be resumed.
+    std::string ResumeToken;
+
+    std::array<std::shared_ptr<rtc::Track>, 2> Tracks;
+};
+
+// "<room>.<random hex>": the room tells which shard holds the session.
+std::string MakeResumeToken(RoomId roomId);
+// Room named by a resume token; nothing if it isn't one.
+std::optional<RoomId> ParseResumeRoom(std::string_view token);
+
+// Clients owned by one shard, indexed by connection, by user and by room.
+// Only used from the owning shard's loop thread.
+class ClientRegistry {
+public:
+    using RoomClients = std::unordered_map<ClientId, std::shared_ptr<Client>>;
+
+    void Add(const std::shared_ptr<Client>& client);
+    void Remove(const std::shared_ptr<Client>& client);
+
+    // Sets the client's ids and indexes it under its room.
+    void Assign(const std::shared_ptr<Client>& client, ClientId clientId, RoomId roomId);
+
+    bool Contains(const std::shared_ptr<Client>& client) const {
+        return Find(client->ws.get()) == client;
+    }
+
+    std::shared_ptr<Client> Find(const rtc::WebSocket* ws) const;
+    std::shared_ptr<Client> Find(RoomId roomId, ClientId clientId) const;
+
+    auto FindByClientId(ClientId clientId) const {
+        return ByClientId_.equal_range(clientId);
+    }
+
+    const RoomClients& GetRoomClients(RoomId roomId) const;
+
+    const auto& GetClients() const {
+        return ByWs_;
+    }
+
+private:
+    void Unassign(const std::shared_ptr<Client>& client);
+
+    std::unordered_map<const rtc::WebSocket*, std::shared_ptr<Client>> ByWs_;
+    std::unordered_multimap<ClientId, std::shared_ptr<Client>> ByClientId_;
+    std::unordered_map<RoomId, RoomClients> ByRoom_;
+};
+
+} // namespace sfu
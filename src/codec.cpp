@@ -0,0 +1,52 @@
+#include "codec.hpp"
+
+#include <cstdint>
+
+namespace sfu {
+
+bool IsVp8Keyframe(std::span<const std::byte> body) {
+    if (body.empty()) {
+        return false;
+    }
+
+    // Payload descriptor: the frame header is only present at the start of
+    // partition 0.
+    auto first = std::to_integer<uint8_t>(body[0]);
+    bool extended = first & 0x80;
+    bool start = first & 0x10;
+    auto partition = first & 0x07;
+    if (!start || partition != 0) {
+        return false;
+    }
+
+    size_t offset = 1;
+    if (extended) {
+        if (body.size() <= offset) {
+            return false;
+        }
+
+        auto flags = std::to_integer<uint8_t>(body[offset++]);
+        if (flags & 0x80) {
+            if (body.size() <= offset) {
+                return false;
+            }
+            // 15-bit picture id when the M bit is set.
+            offset += (std::to_integer<uint8_t>(body[offset]) & 0x80) ? 2 : 1;
+        }
+        if (flags & 0x40) {
+            ++offset;
+        }
+        if (flags & 0x30) {
+            ++offset;
+        }
+    }
+
+    if (body.size() <= offset) {
+        return false;
+    }
+
+    // Inverse key frame flag of the VP8 frame header.
+    return (std::to_integer<uint8_t>(body[offset]) & 0x01) == 0;
+}
+
+} // namespace sfu
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+namespace sfu {
+
+// True if the RTP body starts a VP8 key frame (RFC 7741).
+bool IsVp8Keyframe(std::span<const std::byte> body);
+
+} // namespace sfu
@@ -0,0 +1,103 @@
+#include "config.hpp"
+
+#include <charconv>
+#include <iostream>
+#include <string_view>
+#include <thread>
+
+namespace sfu {
+
+namespace {
+
+template <typename T>
+bool ParseNumber(std::string_view value, T& result) {
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    return ec == std::errc() && ptr == value.data() + value.size();
+}
+
+} // namespace
+
+std::optional<Config> ParseConfig(int argc, char** argv) {
+    Config config;
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string_view name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            return {};
+        }
+        std::string_view value = argv[i + 1];
+
+        bool ok = false;
+        if (name == "--port") {
+            ok = ParseNumber(value, config.Port);
+        } else if (name == "--loops") {
+            ok = ParseNumber(value, config.LoopCount);
+        } else if (name == "--resume-grace-ms") {
+            ok = ParseNumber(value, config.ResumeGraceMillis);
+        } else if (name == "--public-key") {
+            config.PublicKeyPath = value;
+            ok = !value.empty();
+        } else if (name == "--token-cache-size") {
+            ok = ParseNumber(value, config.TokenCacheSize);
+        } else if (name == "--spare-tracks") {
+            ok = ParseNumber(value, config.SpareTracks);
+        } else if (name == "--nack-history") {
+            ok = ParseNumber(value, config.NackHistory);
+        } else if (name == "--audio-slots") {
+            ok = ParseNumber(value, config.AudioSlots);
+        } else if (name == "--video-slots") {
+            ok = ParseNumber(value, config.VideoSlots);
+        } else if (name == "--ice-port") {
+            ok = ParseNumber(value, config.IcePortBegin);
+            config.IcePortEnd = config.IcePortBegin;
+            config.IceUdpMux = true;
+        } else if (name == "--ice-port-range") {
+            // "begin-end", one port per PeerConnection.
+            auto dash = value.find('-');
+            ok = dash != std::string_view::npos
+                && ParseNumber(value.substr(0, dash), config.IcePortBegin)
+                && ParseNumber(value.substr(dash + 1), config.IcePortEnd)
+                && config.IcePortBegin <= config.IcePortEnd;
+            config.IceUdpMux = false;
+        } else if (name == "--relay-port") {
+            ok = ParseNumber(value, config.RelayPort);
+        } else if (name == "--relay-peers") {
+            // Comma separated.
+            config.RelayPeers.clear();
+            size_t begin = 0;
+            while (begin <= value.size()) {
+                auto end = std::min(value.find(',', begin), value.size());
+                if (end > begin) {
+                    config.RelayPeers.emplace_back(value.substr(begin, end - begin));
+                }
+                begin = end + 1;
+            }
+            ok = !config.RelayPeers.empty();
+        } else if (name == "--relay-flush-us") {
+            ok = ParseNumber(value, config.RelayFlushMicros);
+        } else if (name == "--metrics-port") {
+            ok = ParseNumber(value, config.MetricsPort);
+        } else if (name == "--log-level") {
+            auto level = ParseLogLevel(value);
+            config.Verbosity = level.value_or(config.Verbosity);
+            ok = level.has_value();
+        } else {
+            std::cerr << "Unknown option " << name << std::endl;
+            return {};
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+            return {};
+        }
+    }
+
+    if (config.LoopCount == 0) {
+        config.LoopCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return config;
+}
+
+} // namespace sfu
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "log.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace sfu {
+
+struct Config {
+    uint16_t Port = 8000;
+
+    // Number of signaling loops; rooms are pinned to one of them by id.
+    size_t LoopCount = 0;
+
+    // How long a participant whose WebSocket dropped stays in its room,
+    // waiting for the client to resume the session on a new WebSocket. 0
+    // leaves the room as soon as the WebSocket closes.
+    uint32_t ResumeGraceMillis = 0;
+
+    // RS256 key for signaling tokens; reloaded when the file changes.
+    std::string PublicKeyPath = "data/public.pem";
+    size_t TokenCacheSize = 4096;
+
+    // Negotiated but unused track pairs kept per subscriber, so joins
+    // don't have to renegotiate.
+    size_t SpareTracks = 4;
+
+    // Forwarded video packets kept per subscriber stream to answer its NACKs;
+    // publishers are NACKed for their own losses too. 0 leaves loss recovery
+    // to the endpoints.
+    size_t NackHistory = 512;
+
+    // Audio tracks per subscriber carrying only the loudest speakers; 0
+    // forwards every participant's audio.
+    size_t AudioSlots = 0;
+
+    // Video tracks per subscriber, each fed by the publisher the subscriber
+    // picks with a "subscribe" message; 0 gives every publisher its own track.
+    size_t VideoSlots = 0;
+
+    // Media ports. With the UDP mux every PeerConnection shares IcePortBegin
+    // and ICE tells them apart by ufrag; without it each PeerConnection binds
+    // its own port from the range.
+    bool IceUdpMux = true;
+    uint16_t IcePortBegin = 50000;
+    uint16_t IcePortEnd = 50000;
+
+    // UDP port of the relay trunk to other nodes, 0 to run standalone.
+    uint16_t RelayPort = 0;
+    // "host:port" of the other nodes' relay trunks.
+    std::vector<std::string> RelayPeers;
+    // Longest a media packet waits to leave in a batch, at least 50; 0 to
+    // send each packet on its own.
+    uint32_t RelayFlushMicros = 500;
+
+    // HTTP port serving Prometheus metrics at /metrics, 0 to disable.
+    uint16_t MetricsPort = 0;
+
+    // Least severe level logged at startup; SIGUSR1 and SIGUSR2 change it
+    // while running.
+    LogLevel Verbosity = LogLevel::Info;
+};
+
+// Parses "--name value" pairs from the command line. Returns nothing and
+// prints the problem on malformed input.
+std::optional<Config> ParseConfig(int argc, char** argv);
+
+} // namespace sfu
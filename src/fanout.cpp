@@ -0,0 +1,143 @@
+#include "fanout.hpp"
+
+#include <cstring>
+#include <optional>
+#include <utility>
+
+namespace sfu {
+
+namespace {
+
+uint16_t ReadUint16(std::span<const std::byte> data, size_t offset) {
+    return static_cast<uint16_t>(std::to_integer<uint16_t>(data[offset]) << 8 | std::to_integer<uint16_t>(data[offset + 1]));
+}
+
+// Offset of the header extension block and its end, if present.
+std::optional<std::pair<size_t, size_t>> ExtensionBounds(std::span<const std::byte> data) {
+    auto first = std::to_integer<uint8_t>(data[0]);
+    if (!(first & 0x10)) {
+        return {};
+    }
+
+    size_t offset = RtpFixedHeaderSize + 4 * (first & 0x0F);
+    if (data.size() < offset + 4) {
+        return {};
+    }
+
+    size_t end = offset + 4 + 4 * size_t(ReadUint16(data, offset + 2));
+    if (data.size() < end) {
+        return {};
+    }
+
+    return std::make_pair(offset, end);
+}
+
+} // namespace
+
+RtpPacket::RtpPacket(rtc::binary&& data)
+    : Data_(std::make_shared<const rtc::binary>(std::move(data)))
+{ }
+
+std::span<const std::byte> RtpPacket::Body() const {
+    std::span<const std::byte> data(*Data_);
+
+    auto first = std::to_integer<uint8_t>(data[0]);
+    size_t begin = RtpFixedHeaderSize + 4 * (first & 0x0F);
+    if (auto extension = ExtensionBounds(data)) {
+        begin = extension->second;
+    } else if (first & 0x10) {
+        return {};
+    }
+
+    size_t end = data.size();
+    if (first & 0x20) {
+        auto padding = std::to_integer<size_t>(data.back());
+        end = padding <= end ? end - padding : 0;
+    }
+
+    if (begin > end) {
+        return {};
+    }
+    return data.subspan(begin, end - begin);
+}
+
+std::span<const std::byte> RtpPacket::FindExtension(int id) const {
+    std::span<const std::byte> data(*Data_);
+
+    auto bounds = ExtensionBounds(data);
+    if (!bounds || id <= 0) {
+        return {};
+    }
+
+    auto [offset, end] = *bounds;
+    auto profile = ReadUint16(data, offset);
+    size_t i = offset + 4;
+
+    if (profile == 0xBEDE) {
+        while (i < end) {
+            auto byte = std::to_integer<uint8_t>(data[i]);
+            if (byte == 0) {
+                ++i;
+                continue;
+            }
+
+            int elementId = byte >> 4;
+            size_t length = (byte & 0x0F) + 1;
+            if (elementId == 15 || i + 1 + length > end) {
+                break;
+            }
+            if (elementId == id) {
+                return data.subspan(i + 1, length);
+            }
+            i += 1 + length;
+        }
+    } else if ((profile & 0xFFF0) == 0x1000) {
+        while (i + 1 < end) {
+            int elementId = std::to_integer<uint8_t>(data[i]);
+            if (elementId == 0) {
+                ++i;
+                continue;
+            }
+
+            size_t length = std::to_integer<uint8_t>(data[i + 1]);
+            if (i + 2 + length > end) {
+                break;
+            }
+            if (elementId == id) {
+                return data.subspan(i + 2, length);
+            }
+            i += 2 + length;
+        }
+    }
+
+    return {};
+}
+
+rtc::binary FanOut::Build(rtc::SSRC ssrc) const {
+    // The buffer is moved into the outgoing message, so this is the only
+    // allocation and copy per target.
+    rtc::binary out(Packet_.Size());
+
+    auto header = Packet_.FixedHeader();
+    std::memcpy(out.data(), header.data(), header.size());
+    reinterpret_cast<rtc::RtpHeader*>(out.data())->setSsrc(ssrc);
+
+    auto payload = Packet_.Payload();
+    std::memcpy(out.data() + header.size(), payload.data(), payload.size());
+
+    return out;
+}
+
+bool FanOut::SendTo(rtc::Track& track, rtc::SSRC ssrc) const {
+    return track.send(Build(ssrc));
+}
+
+bool FanOut::SendTo(rtc::Track& track, rtc::SSRC ssrc, uint16_t seqNumber, uint32_t timestamp) const {
+    auto out = Build(ssrc);
+    auto header = reinterpret_cast<rtc::RtpHeader*>(out.data());
+    header->setSeqNumber(seqNumber);
+    header->setTimestamp(timestamp);
+    return track.send(std::move(out));
+}
+
+} // namespace sfu
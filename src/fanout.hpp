@@ -0,0 +1,78 @@
+#pragma once
+
+#include "fwd.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <cstddef>
+#include <memory>
+#include <span>
+
+namespace sfu {
+
+constexpr size_t RtpFixedHeaderSize = 12;
+
+// Incoming RTP packet shared by every subscriber it is forwarded to.
+// The received buffer is taken over once and never modified afterwards,
+// so it can be kept alive by any number of readers without copying.
+class RtpPacket {
+public:
+    explicit RtpPacket(rtc::binary&& data);
+
+    bool IsValid() const {
+        return Data_->size() >= RtpFixedHeaderSize;
+    }
+
+    size_t Size() const {
+        return Data_->size();
+    }
+
+    // The whole packet as received.
+    std::span<const std::byte> Data() const {
+        return *Data_;
+    }
+
+    const rtc::RtpHeader* Header() const {
+        return reinterpret_cast<const rtc::RtpHeader*>(Data_->data());
+    }
+
+    std::span<const std::byte> FixedHeader() const {
+        return {Data_->data(), RtpFixedHeaderSize};
+    }
+
+    // Everything after the fixed header: CSRCs, extensions and media payload.
+    std::span<const std::byte> Payload() const {
+        return std::span<const std::byte>(*Data_).subspan(RtpFixedHeaderSize);
+    }
+
+    // Codec payload without CSRCs, header extensions and padding.
+    // Empty if the packet is malformed.
+    std::span<const std::byte> Body() const;
+
+    // Value of a one-byte or two-byte header extension element (RFC 8285),
+    // or an empty span if the packet doesn't carry it.
+    std::span<const std::byte> FindExtension(int id) const;
+
+private:
+    std::shared_ptr<const rtc::binary> Data_;
+};
+
+// Sends one packet to many tracks. Each target gets its own copy of the
+// 12-byte fixed header with the SSRC (and optionally sequence number and
+// timestamp) rewritten, followed by the shared payload.
+class FanOut {
+public:
+    explicit FanOut(const RtpPacket& packet)
+        : Packet_(packet)
+    { }
+
+    bool SendTo(rtc::Track& track, rtc::SSRC ssrc) const;
+    bool SendTo(rtc::Track& track, rtc::SSRC ssrc, uint16_t seqNumber, uint32_t timestamp) const;
+
+private:
+    rtc::binary Build(rtc::SSRC ssrc) const;
+
+    const RtpPacket& Packet_;
+};
+
+} // namespace sfu
@@ -0,0 +1,26 @@
+#include "gop.hpp"
+
+namespace sfu {
+
+void GopCache::Add(const RtpPacket& packet, bool keyframe) {
+    if (keyframe) {
+        Packets_.clear();
+        Bytes_ = 0;
+    } else if (Packets_.empty()) {
+        // Deltas are useless without the key frame they depend on.
+        return;
+    }
+
+    Bytes_ += packet.Size();
+    if (Bytes_ > MaxBytes) {
+        // A GOP this long would take too long to replay; new subscribers
+        // wait for the next key frame instead.
+        Packets_.clear();
+        Bytes_ = 0;
+        return;
+    }
+
+    Packets_.push_back(packet);
+}
+
+} // namespace sfu
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "fanout.hpp"
+
+#include <vector>
+
+namespace sfu {
+
+// The current group of pictures of one published video layer: the last key
+// frame and every packet since. Packets share their buffers with the
+// forwarding path, so caching costs no copies. Used from the publisher's
+// media thread only.
+class GopCache {
+public:
+    static constexpr size_t MaxBytes = 4 * 1024 * 1024;
+
+    void Add(const RtpPacket& packet, bool keyframe);
+
+    void Clear() {
+        Packets_.clear();
+        Bytes_ = 0;
+    }
+
+    bool IsEmpty() const {
+        return Packets_.empty();
+    }
+
+    const std::vector<RtpPacket>& GetPackets() const {
+        return Packets_;
+    }
+
+private:
+    std::vector<RtpPacket> Packets_;
+    size_t Bytes_ = 0;
+};
+
+} // namespace sfu
@@ -0,0 +1,60 @@
+#include "keyframe.hpp"
+
+namespace sfu {
+
+KeyframeArbiter::KeyframeArbiter(std::function<void(LayerMask)> forward)
+    : Forward_(std::move(forward))
+{ }
+
+int64_t KeyframeArbiter::ToMicroseconds(Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+void KeyframeArbiter::Request(std::optional<size_t> layer, Source source, Clock::time_point now) {
+    Requested_.fetch_add(1, std::memory_order_relaxed);
+    if (source == Source::Pli) {
+        Pli_.fetch_add(1, std::memory_order_relaxed);
+    } else if (source == Source::Fir) {
+        Fir_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    Pending_.fetch_or(layer ? LayerMask(1) << *layer : AllLayers, std::memory_order_relaxed);
+    Poll(now);
+}
+
+void KeyframeArbiter::Poll(Clock::time_point now) {
+    if (Pending_.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+
+    auto nowUs = ToMicroseconds(now);
+    auto last = LastForward_.load(std::memory_order_relaxed);
+    auto interval = std::chrono::duration_cast<std::chrono::microseconds>(MinInterval).count();
+    if (last != 0 && nowUs - last < interval) {
+        return;
+    }
+
+    // Only the thread that wins the window sends.
+    if (!LastForward_.compare_exchange_strong(last, nowUs, std::memory_order_relaxed)) {
+        return;
+    }
+
+    auto mask = Pending_.exchange(0, std::memory_order_relaxed);
+    if (mask == 0) {
+        return;
+    }
+
+    Forwarded_.fetch_add(1, std::memory_order_relaxed);
+    Forward_(mask);
+}
+
+KeyframeArbiter::Stats KeyframeArbiter::GetStats() const {
+    return {
+        Requested_.load(std::memory_order_relaxed),
+        Forwarded_.load(std::memory_order_relaxed),
+        Pli_.load(std::memory_order_relaxed),
+        Fir_.load(std::memory_order_relaxed),
+    };
+}
+
+} // namespace sfu
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <optional>
+
+namespace sfu {
+
+// Merges every key frame request for one publisher's video: joins, layer
+// switches, bandwidth recovery and PLI/FIR from subscribers. At most one
+// request per MinInterval goes upstream; requests inside the window are
+// coalesced and sent when it ends. Safe to call from any thread.
+class KeyframeArbiter {
+public:
+    using Clock = std::chrono::steady_clock;
+    using LayerMask = uint32_t;
+
+    static constexpr auto MinInterval = std::chrono::milliseconds(500);
+    static constexpr LayerMask AllLayers = ~LayerMask(0);
+
+    enum class Source {
+        Internal,
+        Pli,
+        Fir,
+    };
+
+    struct Stats {
+        uint64_t Requested = 0;
+        uint64_t Forwarded = 0;
+        uint64_t Pli = 0;
+        uint64_t Fir = 0;
+    };
+
+    // Sends one upstream request for the layers in the mask.
+    explicit KeyframeArbiter(std::function<void(LayerMask)> forward);
+
+    void Request(std::optional<size_t> layer, Source source, Clock::time_point now = Clock::now());
+
+    // Flushes requests coalesced during a window that has ended. Called for
+    // every incoming video packet, so the delay is at most one frame.
+    void Poll(Clock::time_point now);
+
+    Stats GetStats() const;
+
+private:
+    static int64_t ToMicroseconds(Clock::time_point time);
+
+    const std::function<void(LayerMask)> Forward_;
+
+    std::atomic<LayerMask> Pending_ = 0;
+    std::atomic<int64_t> LastForward_ = 0;
+
+    std::atomic<uint64_t> Requested_ = 0;
+    std::atomic<uint64_t> Forwarded_ = 0;
+    std::atomic<uint64_t> Pli_ = 0;
+    std::atomic<uint64_t> Fir_ = 0;
+};
+
+} // namespace sfu
@@ -0,0 +1,236 @@
+#include "log.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <algorithm>
+#include <csignal>
+#include <cstdio>
+#include <ctime>
+
+namespace sfu {
+
+namespace {
+
+constexpr auto IdleInterval = std::chrono::milliseconds(10);
+
+// Level steps requested by SIGUSR1 (-1, more verbose) and SIGUSR2 (+1),
+// applied by the writer thread.
+volatile std::sig_atomic_t PendingLevelChange = 0;
+
+void OnLevelSignal(int signal) {
+    PendingLevelChange = PendingLevelChange + (signal == SIGUSR1 ? -1 : 1);
+}
+
+rtc::LogLevel ToLibraryLevel(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return rtc::LogLevel::Debug;
+        case LogLevel::Info: return rtc::LogLevel::Info;
+        case LogLevel::Warning: return rtc::LogLevel::Warning;
+        case LogLevel::Error: return rtc::LogLevel::Error;
+    }
+    return rtc::LogLevel::Info;
+}
+
+LogLevel FromLibraryLevel(rtc::LogLevel level) {
+    switch (level) {
+        case rtc::LogLevel::Fatal:
+        case rtc::LogLevel::Error:
+            return LogLevel::Error;
+        case rtc::LogLevel::Warning:
+            return LogLevel::Warning;
+        case rtc::LogLevel::Info:
+            return LogLevel::Info;
+        default:
+            return LogLevel::Debug;
+    }
+}
+
+// logfmt: time=... level=... client=... room=... msg="..."
+void Format(const LogRecord& record, std::string& out) {
+    auto time = std::chrono::system_clock::to_time_t(record.Time);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(record.Time.time_since_epoch()).count() % 1000;
+    std::tm utc;
+    gmtime_r(&time, &utc);
+
+    char timestamp[32];
+    auto length = std::strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &utc);
+    std::snprintf(timestamp + length, sizeof(timestamp) - length, ".%03dZ", static_cast<int>(millis));
+
+    out += "time=";
+    out += timestamp;
+    out += " level=";
+    out += LogLevelName(record.Level);
+    if (record.Context.Client) {
+        out += " client=" + std::to_string(*record.Context.Client);
+    }
+    if (record.Context.Room) {
+        out += " room=" + std::to_string(*record.Context.Room);
+    }
+    out += " msg=\"";
+    for (char c : record.Message) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (c == '\n') {
+            out += "\\n";
+        } else {
+            out += c;
+        }
+    }
+    out += "\"\n";
+}
+
+} // namespace
+
+std::optional<LogLevel> ParseLogLevel(std::string_view name) {
+    if (name == "debug") {
+        return LogLevel::Debug;
+    } else if (name == "info") {
+        return LogLevel::Info;
+    } else if (name == "warning") {
+        return LogLevel::Warning;
+    } else if (name == "error") {
+        return LogLevel::Error;
+    }
+    return {};
+}
+
+std::string_view LogLevelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info: return "info";
+        case LogLevel::Warning: return "warning";
+        case LogLevel::Error: return "error";
+    }
+    return "unknown";
+}
+
+Logger& Logger::Get() {
+    static Logger logger;
+    return logger;
+}
+
+Logger::Logger()
+    : Cells_(std::make_unique<Cell[]>(Capacity))
+{
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+    for (size_t i = 0; i < Capacity; ++i) {
+        Cells_[i].Sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+Logger::~Logger() {
+    Stop();
+}
+
+void Logger::Write(LogRecord&& record) {
+    if (!TryPush(std::move(record))) {
+        Dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+bool Logger::TryPush(LogRecord&& record) {
+    auto position = Tail_.load(std::memory_order_relaxed);
+    while (true) {
+        auto& cell = Cells_[position & (Capacity - 1)];
+        auto sequence = cell.Sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+        if (diff == 0) {
+            if (Tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                cell.Record = std::move(record);
+                cell.Sequence.store(position + 1, std::memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The consumer hasn't freed this cell yet: full.
+            return false;
+        } else {
+            position = Tail_.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Logger::TryPop(LogRecord& record) {
+    auto& cell = Cells_[Head_ & (Capacity - 1)];
+    if (cell.Sequence.load(std::memory_order_acquire) != Head_ + 1) {
+        return false;
+    }
+
+    record = std::move(cell.Record);
+    cell.Sequence.store(Head_ + Capacity, std::memory_order_release);
+    ++Head_;
+    return true;
+}
+
+void Logger::Start() {
+    if (Running_.exchange(true)) {
+        return;
+    }
+
+    std::signal(SIGUSR1, OnLevelSignal);
+    std::signal(SIGUSR2, OnLevelSignal);
+    ApplyLibraryLevel();
+
+    Thread_ = std::thread([this] {
+        while (Running_.load(std::memory_order_relaxed)) {
+            Drain();
+            std::this_thread::sleep_for(IdleInterval);
+        }
+        Drain();
+    });
+}
+
+void Logger::Stop() {
+    if (!Running_.exchange(false)) {
+        return;
+    }
+
+    if (Thread_.joinable()) {
+        Thread_.join();
+    }
+}
+
+void Logger::Drain() {
+    if (int change = PendingLevelChange; change != 0) {
+        PendingLevelChange = PendingLevelChange - change;
+        auto level = std::clamp(static_cast<int>(GetLevel()) + change, static_cast<int>(LogLevel::Debug), static_cast<int>(LogLevel::Error));
+        SetLevel(static_cast<LogLevel>(level));
+        Write({LogLevel::Warning, std::chrono::system_clock::now(), {}, "Log level set to " + std::string(LogLevelName(GetLevel()))});
+    }
+    if (LibraryLevel_ != GetLevel()) {
+        ApplyLibraryLevel();
+    }
+
+    std::string out;
+    LogRecord record;
+    while (TryPop(record)) {
+        Format(record, out);
+    }
+
+    if (auto dropped = GetDropped(); dropped != ReportedDropped_) {
+        Format({LogLevel::Warning, std::chrono::system_clock::now(), {}, "Dropped " + std::to_string(dropped - ReportedDropped_) + " log lines"}, out);
+        ReportedDropped_ = dropped;
+    }
+
+    if (!out.empty()) {
+        std::fwrite(out.data(), 1, out.size(), stdout);
+        std::fflush(stdout);
+    }
+}
+
+void Logger::ApplyLibraryLevel() {
+    LibraryLevel_ = GetLevel();
+    rtc::InitLogger(ToLibraryLevel(*LibraryLevel_), [](rtc::LogLevel level, std::string message) {
+        auto ours = FromLibraryLevel(level);
+        if (Logger::Get().IsEnabled(ours)) {
+            Logger::Get().Write({ours, std::chrono::system_clock::now(), {}, "rtc: " + message});
+        }
+    });
+}
+
+LogLine::~LogLine() {
+    Logger::Get().Write({Level_, std::chrono::system_clock::now(), std::move(Context_), Stream_.str()});
+}
+
+} // namespace sfu
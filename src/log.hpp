@@ -0,0 +1,140 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+namespace sfu {
+
+using ClientId = uint64_t;
+using RoomId = uint64_t;
+
+enum class LogLevel : int {
+    Debug = 0,
+    Info = 1,
+    Warning = 2,
+    Error = 3,
+};
+
+std::optional<LogLevel> ParseLogLevel(std::string_view name);
+std::string_view LogLevelName(LogLevel level);
+
+// Fields attached to a log line besides the message.
+struct LogContext {
+    std::optional<ClientId> Client = std::nullopt;
+    std::optional<RoomId> Room = std::nullopt;
+};
+
+struct LogRecord {
+    LogLevel Level = LogLevel::Info;
+    std::chrono::system_clock::time_point Time;
+    LogContext Context;
+    std::string Message;
+};
+
+// Process-wide leveled logger. Threads logging only format the message and
+// push it into a bounded lock-free ring; a background thread writes the
+// lines out. When the ring is full the line is dropped and counted rather
+// than blocking the caller. libdatachannel's own log goes through it too.
+class Logger {
+public:
+    static constexpr size_t Capacity = 8192;
+
+    static Logger& Get();
+
+    ~Logger();
+
+    void SetLevel(LogLevel level) {
+        Level_.store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    LogLevel GetLevel() const {
+        return static_cast<LogLevel>(Level_.load(std::memory_order_relaxed));
+    }
+
+    bool IsEnabled(LogLevel level) const {
+        return static_cast<int>(level) >= Level_.load(std::memory_order_relaxed);
+    }
+
+    void Write(LogRecord&& record);
+
+    uint64_t GetDropped() const {
+        return Dropped_.load(std::memory_order_relaxed);
+    }
+
+    // Starts the writer thread and routes libdatachannel's log through the
+    // logger. SIGUSR1 and SIGUSR2 make the level one step more or less
+    // verbose while running.
+    void Start();
+    // Writes out what is queued and stops the writer thread.
+    void Stop();
+
+private:
+    // Bounded multi-producer queue (Vyukov); each cell's sequence number
+    // tells whether it is free for the producer at that position or holds
+    // a record for the consumer.
+    struct Cell {
+        std::atomic<size_t> Sequence;
+        LogRecord Record;
+    };
+
+    Logger();
+
+    bool TryPush(LogRecord&& record);
+    bool TryPop(LogRecord& record);
+    void Drain();
+    void ApplyLibraryLevel();
+
+    std::unique_ptr<Cell[]> Cells_;
+    alignas(64) std::atomic<size_t> Tail_ = 0;
+    alignas(64) size_t Head_ = 0;
+
+    alignas(64) std::atomic<int> Level_ = static_cast<int>(LogLevel::Info);
+    std::atomic<uint64_t> Dropped_ = 0;
+    uint64_t ReportedDropped_ = 0;
+    std::optional<LogLevel> LibraryLevel_;
+
+    std::atomic<bool> Running_ = false;
+    std::thread Thread_;
+};
+
+// Collects one line with operator<< and queues it when destroyed.
+class LogLine {
+public:
+    LogLine(LogLevel level, LogContext context)
+        : Level_(level)
+        , Context_(std::move(context))
+    { }
+
+    ~LogLine();
+
+    template <typename T>
+    LogLine& operator<<(const T& value) {
+        Stream_ << value;
+        return *this;
+    }
+
+private:
+    LogLevel Level_;
+    LogContext Context_;
+    std::ostringstream Stream_;
+};
+
+} // namespace sfu
+
+// LOG_INFO(.Client = clientId, .Room = roomId) << "Joined";
+// The message isn't formatted at all when the level is disabled.
+#define SFU_LOG(level, ...) \
+    if (!::sfu::Logger::Get().IsEnabled(level)) { } else ::sfu::LogLine(level, ::sfu::LogContext{__VA_ARGS__})
+
+#define LOG_DEBUG(...) SFU_LOG(::sfu::LogLevel::Debug, __VA_ARGS__)
+#define LOG_INFO(...) SFU_LOG(::sfu::LogLevel::Info, __VA_ARGS__)
+#define LOG_WARNING(...) SFU_LOG(::sfu::LogLevel::Warning, __VA_ARGS__)
+#define LOG_ERROR(...) SFU_LOG(::sfu::LogLevel::Error, __VA_ARGS__)
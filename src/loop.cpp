@@ -1,31 +1,194 @@
 #include "loop.hpp"
 
+#include <algorithm>
+#include <memory>
+
 namespace sfu {
 
+namespace {
+
+uint64_t ToTicks(Loop::Clock::duration duration) {
+    auto ticks = (duration + Loop::TimerTick - Loop::Clock::duration(1)) / Loop::TimerTick;
+    return std::max<int64_t>(1, ticks);
+}
+
+} // namespace
+
+Loop::Loop()
+    : Start_(Clock::now())
+    , Wheel_(TimerWheelSize)
+{ }
+
+Loop::~Loop() {
+    auto node = Head_.exchange(nullptr);
+    while (node) {
+        std::unique_ptr<Node> current(node);
+        node = node->Next;
+    }
+}
+
 void Loop::Run() {
     while (true)
     {
-        Task task;
-
-        {
-            std::unique_lock<std::mutex> lock(Mutex_);
-            Cv_.wait(lock, [this]{
-                return !TaskQueue_.empty();
-            });
-            task = std::move(TaskQueue_.front());
-            TaskQueue_.pop();
+        RunPending();
+        if (Stopped_) {
+            return;
         }
-        task();
+        RunTimers();
+        WaitForTasks();
     }
 }
 
 void Loop::EnqueueTask(Task&& task) {
-    {
+    auto node = new Node{std::move(task), Clock::now()};
+    Enqueued_.fetch_add(1, std::memory_order_relaxed);
+
+    auto head = Head_.load(std::memory_order_relaxed);
+    do {
+        node->Next = head;
+    } while (!Head_.compare_exchange_weak(head, node, std::memory_order_seq_cst, std::memory_order_relaxed));
+
+    if (Sleeping_.load(std::memory_order_seq_cst)) {
         std::lock_guard<std::mutex> lock(Mutex_);
-        TaskQueue_.push(std::move(task));
+        Cv_.notify_one();
+    }
+}
+
+void Loop::Stop() {
+    EnqueueTask([this] {
+        Stopped_ = true;
+    });
+}
+
+TimerId Loop::RunAfter(Clock::duration delay, Task&& task) {
+    return AddTimer(delay, Clock::duration::zero(), std::move(task));
+}
+
+TimerId Loop::RunEvery(Clock::duration interval, Task&& task) {
+    return AddTimer(interval, interval, std::move(task));
+}
+
+void Loop::CancelTimer(TimerId id) {
+    EnqueueTask([this, id] {
+        Timers_.erase(id);
+    });
+}
+
+TimerId Loop::AddTimer(Clock::duration delay, Clock::duration interval, Task&& task) {
+    auto id = TimerIdGenerator_++;
+
+    EnqueueTask([this, id, delay, interval, task = std::move(task)]() mutable {
+        Timer timer{
+            std::move(task),
+            std::max(CurrentTick_, TicksSince(Start_)) + ToTicks(delay),
+            interval == Clock::duration::zero() ? 0 : ToTicks(interval),
+        };
+        ScheduleTimer(id, std::move(timer));
+    });
+
+    return id;
+}
+
+void Loop::ScheduleTimer(TimerId id, Timer&& timer) {
+    Wheel_[timer.Deadline % TimerWheelSize].push_back(id);
+    Timers_.emplace(id, std::move(timer));
+}
+
+uint64_t Loop::TicksSince(Clock::time_point start) const {
+    return (Clock::now() - start) / TimerTick;
+}
+
+void Loop::RunPending() {
+    auto node = Head_.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack holds the newest task first; restore submission order.
+    Node* pending = nullptr;
+    while (node) {
+        auto next = node->Next;
+        node->Next = pending;
+        pending = node;
+        node = next;
+    }
+
+    auto start = Clock::now();
+    uint64_t executed = 0;
+    while (pending) {
+        std::unique_ptr<Node> current(pending);
+        pending = pending->Next;
+        current->Callback();
+
+        auto end = Clock::now();
+        TaskWait_.Observe(start - current->EnqueuedAt);
+        TaskRun_.Observe(end - start);
+        start = end;
+        ++executed;
+    }
+    Executed_.store(Executed_.load(std::memory_order_relaxed) + executed, std::memory_order_relaxed);
+}
+
+void Loop::RunTimers() {
+    auto now = TicksSince(Start_);
+
+    while (CurrentTick_ < now) {
+        ++CurrentTick_;
+
+        auto& slot = Wheel_[CurrentTick_ % TimerWheelSize];
+        if (slot.empty()) {
+            continue;
+        }
+
+        auto due = std::move(slot);
+        slot.clear();
+
+        for (auto id : due) {
+            auto it = Timers_.find(id);
+            if (it == Timers_.end()) {
+                continue;
+            }
+
+            auto& timer = it->second;
+            if (timer.Deadline > CurrentTick_) {
+                Wheel_[CurrentTick_ % TimerWheelSize].push_back(id);
+                continue;
+            }
+
+            if (timer.Interval == 0) {
+                auto callback = std::move(timer.Callback);
+                Timers_.erase(it);
+                callback();
+                continue;
+            }
+
+            timer.Deadline += timer.Interval;
+            Wheel_[timer.Deadline % TimerWheelSize].push_back(id);
+            timer.Callback();
+        }
+    }
+}
+
+void Loop::WaitForTasks() {
+    auto hasTasks = [this] {
+        return Head_.load(std::memory_order_seq_cst) != nullptr;
+    };
+
+    std::unique_lock<std::mutex> lock(Mutex_);
+    Sleeping_.store(true, std::memory_order_seq_cst);
+
+    if (Timers_.empty()) {
+        Cv_.wait(lock, hasTasks);
+    } else {
+        // Sleep until the next occupied slot, or one full turn of the wheel.
+        uint64_t wakeTick = CurrentTick_ + TimerWheelSize;
+        for (uint64_t tick = CurrentTick_ + 1; tick < CurrentTick_ + TimerWheelSize; ++tick) {
+            if (!Wheel_[tick % TimerWheelSize].empty()) {
+                wakeTick = tick;
+                break;
+            }
+        }
+        Cv_.wait_until(lock, Start_ + wakeTick * TimerTick, hasTasks);
     }
 
-    Cv_.notify_one();
+    Sleeping_.store(false, std::memory_order_relaxed);
 }
 
-} //namespace sfu
+} // namespace sfu
@@ -1,23 +1,101 @@
 #pragma once
 
+#include "metrics.hpp"
+#include "task.hpp"
+
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <mutex>
-#include <functional>
-#include <queue>
+#include <unordered_map>
+#include <vector>
 
 namespace sfu {
 
-using Task = std::function<void()>;
+using TimerId = uint64_t;
 
+// Single-consumer event loop. Any thread may post tasks or schedule timers;
+// everything runs on the thread calling Run().
 class Loop {
 public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr std::chrono::milliseconds TimerTick{5};
+    static constexpr size_t TimerWheelSize = 512;
+
+    Loop();
+    ~Loop();
+
     void EnqueueTask(Task&& task);
+    // Runs tasks and timers until Stop() is called.
     void Run();
+    // Makes Run() return once the tasks posted before it have run.
+    void Stop();
+
+    TimerId RunAfter(Clock::duration delay, Task&& task);
+    TimerId RunEvery(Clock::duration interval, Task&& task);
+    void CancelTimer(TimerId id);
+
+    // Tasks posted but not yet run.
+    uint64_t GetQueueDepth() const {
+        auto executed = Executed_.load(std::memory_order_relaxed);
+        auto enqueued = Enqueued_.load(std::memory_order_relaxed);
+        return enqueued > executed ? enqueued - executed : 0;
+    }
+
+    // Time tasks spend queued before they run, and running.
+    const Histogram& GetTaskWait() const {
+        return TaskWait_;
+    }
+
+    const Histogram& GetTaskRun() const {
+        return TaskRun_;
+    }
 
 private:
+    // Intrusive node of the lock-free task stack. Producers push with a CAS,
+    // the consumer takes the whole stack with one exchange.
+    struct Node {
+        Task Callback;
+        Clock::time_point EnqueuedAt;
+        Node* Next = nullptr;
+    };
+
+    struct Timer {
+        Task Callback;
+        uint64_t Deadline;
+        uint64_t Interval;
+    };
+
+    TimerId AddTimer(Clock::duration delay, Clock::duration interval, Task&& task);
+    void ScheduleTimer(TimerId id, Timer&& timer);
+    void RunTimers();
+    uint64_t TicksSince(Clock::time_point start) const;
+
+    void RunPending();
+    void WaitForTasks();
+
+    std::atomic<Node*> Head_ = nullptr;
+    bool Stopped_ = false;
+
+    std::atomic<uint64_t> Enqueued_ = 0;
+    // Written by the loop thread only.
+    std::atomic<uint64_t> Executed_ = 0;
+    Histogram TaskWait_{TaskLatencyBuckets};
+    Histogram TaskRun_{TaskLatencyBuckets};
+
+    // Producers only touch the mutex when the consumer is about to sleep.
+    std::atomic<bool> Sleeping_ = false;
     std::mutex Mutex_;
     std::condition_variable Cv_;
-    std::queue<Task> TaskQueue_;
+
+    // Hashed timer wheel, owned by the loop thread.
+    const Clock::time_point Start_;
+    std::atomic<TimerId> TimerIdGenerator_ = 1;
+    uint64_t CurrentTick_ = 0;
+    std::vector<std::vector<TimerId>> Wheel_;
+    std::unordered_map<TimerId, Timer> Timers_;
 };
 
 } // namespace sfu
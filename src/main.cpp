@@ -1,10 +1,18 @@
+#include "config.hpp"
+#include "log.hpp"
 #include "router.hpp"
 
-#include <rtc/rtc.hpp>
+int main(int argc, char** argv) {
+    auto config = sfu::ParseConfig(argc, argv);
+    if (!config) {
+        return 1;
+    }
 
-int main() {
-    rtc::InitLogger(rtc::LogLevel::Debug);
-    sfu::Router router;
+    auto& logger = sfu::Logger::Get();
+    logger.SetLevel(config->Verbosity);
+    logger.Start();
+
+    sfu::Router router(*config);
     router.Run();
 
     return 0;
@@ -0,0 +1,235 @@
+#include "metrics.hpp"
+
+#include "log.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+#include <stdexcept>
+
+namespace sfu {
+
+namespace {
+
+constexpr size_t MaxRequestSize = 4096;
+constexpr auto ConnectionTimeout = std::chrono::seconds(2);
+
+std::string FormatValue(double value) {
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+
+    std::ostringstream stream;
+    stream.precision(12);
+    stream << value;
+    return stream.str();
+}
+
+std::string EscapeLabel(const std::string& value) {
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            escaped += '\\';
+            escaped += c;
+        } else if (c == '\n') {
+            escaped += "\\n";
+        } else {
+            escaped += c;
+        }
+    }
+    return escaped;
+}
+
+void SendAll(int connection, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        auto result = send(connection, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (result <= 0) {
+            return;
+        }
+        sent += result;
+    }
+}
+
+} // namespace
+
+Histogram::Snapshot& Histogram::Snapshot::operator+=(const Snapshot& other) {
+    if (Counts.empty()) {
+        Bounds = other.Bounds;
+        Counts.resize(other.Counts.size());
+    }
+    for (size_t i = 0; i < Counts.size() && i < other.Counts.size(); ++i) {
+        Counts[i] += other.Counts[i];
+    }
+    Sum += other.Sum;
+    return *this;
+}
+
+Histogram::Histogram(std::span<const double> bounds)
+    : Bounds_(bounds)
+    , Counts_(bounds.size() + 1)
+{ }
+
+void Histogram::Observe(Clock::duration duration) {
+    auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+    auto seconds = nanoseconds / 1e9;
+
+    auto bucket = std::lower_bound(Bounds_.begin(), Bounds_.end(), seconds) - Bounds_.begin();
+    Counts_[bucket].fetch_add(1, std::memory_order_relaxed);
+    SumNanoseconds_.fetch_add(std::max<int64_t>(nanoseconds, 0), std::memory_order_relaxed);
+}
+
+Histogram::Snapshot Histogram::GetSnapshot() const {
+    Snapshot snapshot;
+    snapshot.Bounds = Bounds_;
+    snapshot.Counts.reserve(Counts_.size());
+    for (const auto& count : Counts_) {
+        snapshot.Counts.push_back(count.load(std::memory_order_relaxed));
+    }
+    snapshot.Sum = SumNanoseconds_.load(std::memory_order_relaxed) / 1e9;
+    return snapshot;
+}
+
+void MetricsWriter::AddFamily(const std::string& name, const std::string& type, const std::string& help) {
+    Text_ += "# HELP " + name + " " + help + "\n";
+    Text_ += "# TYPE " + name + " " + type + "\n";
+}
+
+void MetricsWriter::AddSample(const std::string& name, const Labels& labels, double value) {
+    AddLine(name, labels, FormatValue(value));
+}
+
+void MetricsWriter::AddHistogram(const std::string& name, const Labels& labels, const Histogram::Snapshot& snapshot) {
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < snapshot.Counts.size(); ++i) {
+        cumulative += snapshot.Counts[i];
+
+        auto bucketLabels = labels;
+        bucketLabels["le"] = FormatValue(i < snapshot.Bounds.size() ? snapshot.Bounds[i] : INFINITY);
+        AddLine(name + "_bucket", bucketLabels, std::to_string(cumulative));
+    }
+    AddLine(name + "_sum", labels, FormatValue(snapshot.Sum));
+    AddLine(name + "_count", labels, std::to_string(cumulative));
+}
+
+void MetricsWriter::AddLine(const std::string& name, const Labels& labels, const std::string& value) {
+    Text_ += name;
+    if (!labels.empty()) {
+        Text_ += '{';
+        bool first = true;
+        for (const auto& [key, label] : labels) {
+            if (!first) {
+                Text_ += ',';
+            }
+            first = false;
+            Text_ += key + "=\"" + EscapeLabel(label) + '"';
+        }
+        Text_ += '}';
+    }
+    Text_ += ' ';
+    Text_ += value;
+    Text_ += '\n';
+}
+
+MetricsServer::MetricsServer(uint16_t port, Renderer render)
+    : Render_(std::move(render))
+{
+    Socket_ = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (Socket_ < 0) {
+        throw std::runtime_error("Can't create metrics socket");
+    }
+
+    int reuse = 1;
+    setsockopt(Socket_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(Socket_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 || listen(Socket_, 16) != 0) {
+        close(Socket_);
+        throw std::runtime_error("Can't listen for metrics on port " + std::to_string(port));
+    }
+}
+
+MetricsServer::~MetricsServer() {
+    shutdown(Socket_, SHUT_RDWR);
+    if (Thread_.joinable()) {
+        Thread_.join();
+    }
+    close(Socket_);
+}
+
+void MetricsServer::Start() {
+    Thread_ = std::thread(&MetricsServer::Serve, this);
+}
+
+void MetricsServer::Serve() {
+    while (true) {
+        int connection = accept4(Socket_, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // The listening socket was shut down.
+            return;
+        }
+
+        HandleConnection(connection);
+        close(connection);
+    }
+}
+
+void MetricsServer::HandleConnection(int connection) {
+    // Scrapers are served one at a time; a stalled one must not block the rest for long.
+    timeval timeout{ConnectionTimeout.count(), 0};
+    setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MaxRequestSize) {
+        auto received = recv(connection, buffer, sizeof(buffer), 0);
+        if (received <= 0) {
+            return;
+        }
+        request.append(buffer, received);
+    }
+
+    auto lineEnd = request.find("\r\n");
+    std::istringstream requestLine(request.substr(0, lineEnd));
+    std::string method;
+    std::string target;
+    requestLine >> method >> target;
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET") {
+        status = "405 Method Not Allowed";
+    } else if (target != "/metrics" && !target.starts_with("/metrics?")) {
+        status = "404 Not Found";
+    } else {
+        try {
+            body = Render_();
+        } catch (const std::exception& ex) {
+            LOG_ERROR() << "Failed to render metrics: " << ex.what();
+            status = "500 Internal Server Error";
+        }
+    }
+
+    SendAll(connection,
+        "HTTP/1.1 " + status + "\r\n"
+        "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        "Connection: close\r\n"
+        "\r\n" + body);
+}
+
+} // namespace sfu
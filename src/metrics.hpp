@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sfu {
+
+// Bucket bounds in seconds, for loop tasks and for signaling round trips.
+constexpr std::array<double, 12> TaskLatencyBuckets = {
+    0.00001, 0.00005, 0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.05, 0.1, 1,
+};
+constexpr std::array<double, 12> SignalingLatencyBuckets = {
+    0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60,
+};
+
+// Prometheus style histogram of durations. Each instance is meant to be
+// written by one thread, e.g. a shard loop, so the relaxed adds never
+// contend; any thread may read it.
+class Histogram {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Snapshot {
+        std::span<const double> Bounds;
+        // Per bucket, not cumulative; the last one is +Inf.
+        std::vector<uint64_t> Counts;
+        double Sum = 0;
+
+        Snapshot& operator+=(const Snapshot& other);
+    };
+
+    explicit Histogram(std::span<const double> bounds);
+
+    void Observe(Clock::duration duration);
+    Snapshot GetSnapshot() const;
+
+private:
+    std::span<const double> Bounds_;
+    std::vector<std::atomic<uint64_t>> Counts_;
+    std::atomic<uint64_t> SumNanoseconds_ = 0;
+};
+
+// Prometheus text exposition format (version 0.0.4).
+class MetricsWriter {
+public:
+    using Labels = std::map<std::string, std::string>;
+
+    void AddFamily(const std::string& name, const std::string& type, const std::string& help);
+    void AddSample(const std::string& name, const Labels& labels, double value);
+    void AddHistogram(const std::string& name, const Labels& labels, const Histogram::Snapshot& snapshot);
+
+    const std::string& GetText() const {
+        return Text_;
+    }
+
+private:
+    void AddLine(const std::string& name, const Labels& labels, const std::string& value);
+
+    std::string Text_;
+};
+
+// Serves GET /metrics over plain HTTP from its own thread. The page is
+// rendered on every scrape.
+class MetricsServer {
+public:
+    using Renderer = std::function<std::string()>;
+
+    // Throws if the port can't be bound.
+    MetricsServer(uint16_t port, Renderer render);
+    ~MetricsServer();
+
+    void Start();
+
+private:
+    void Serve();
+    void HandleConnection(int connection);
+
+    int Socket_ = -1;
+    Renderer Render_;
+    std::thread Thread_;
+};
+
+} // namespace sfu
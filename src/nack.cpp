@@ -0,0 +1,195 @@
+#include "nack.hpp"
+
+#include <algorithm>
+#include <sstream>
+
+namespace sfu {
+
+namespace {
+
+constexpr uint8_t RtpFeedbackPayloadType = 205;
+constexpr uint8_t GenericNackFormat = 1;
+constexpr size_t FeedbackHeaderSize = 12;
+
+uint16_t ReadUint16(const std::byte* data) {
+    return static_cast<uint16_t>(std::to_integer<uint16_t>(data[0]) << 8 | std::to_integer<uint16_t>(data[1]));
+}
+
+void WriteUint16(std::byte* out, uint16_t value) {
+    out[0] = static_cast<std::byte>(value >> 8);
+    out[1] = static_cast<std::byte>(value & 0xFF);
+}
+
+// Payload type of an "a=<attribute>:<pt> ..." line, if it is one.
+std::optional<std::string> FormatOf(const std::string& line, std::string_view attribute) {
+    if (!line.starts_with(attribute)) {
+        return {};
+    }
+    auto end = line.find(' ', attribute.size());
+    return line.substr(attribute.size(), end == std::string::npos ? std::string::npos : end - attribute.size());
+}
+
+} // namespace
+
+RetransmissionHistory::RetransmissionHistory(size_t capacity)
+    : Entries_(std::max<size_t>(capacity, 1))
+{ }
+
+void RetransmissionHistory::Add(uint16_t seqNumber, uint32_t timestamp, const RtpPacket& packet) {
+    std::lock_guard<std::mutex> lock(Mutex_);
+    Entries_[seqNumber % Entries_.size()].emplace(Entry{seqNumber, timestamp, packet});
+}
+
+std::optional<RetransmissionHistory::Entry> RetransmissionHistory::Find(uint16_t seqNumber) const {
+    std::lock_guard<std::mutex> lock(Mutex_);
+    const auto& entry = Entries_[seqNumber % Entries_.size()];
+    if (!entry || entry->SeqNumber != seqNumber) {
+        return {};
+    }
+    return entry;
+}
+
+void LossDetector::OnPacket(uint16_t seqNumber, Clock::time_point now, std::vector<uint16_t>& nacks) {
+    if (!Started_) {
+        Started_ = true;
+        Highest_ = seqNumber;
+        return;
+    }
+
+    auto advance = static_cast<int16_t>(seqNumber - Highest_);
+    if (advance > 0) {
+        if (static_cast<size_t>(advance) > MaxMissing) {
+            // Too far ahead to be loss: the stream restarted.
+            Missing_.clear();
+        } else {
+            for (uint16_t seq = Highest_ + 1; seq != seqNumber; ++seq) {
+                Missing_.push_back({seq, now, 1});
+                nacks.push_back(seq);
+            }
+        }
+        Highest_ = seqNumber;
+    } else {
+        // Late or retransmitted.
+        std::erase_if(Missing_, [seqNumber](const Missing& missing) {
+            return missing.SeqNumber == seqNumber;
+        });
+    }
+
+    for (auto& missing : Missing_) {
+        if (missing.Requests < MaxRetries && now - missing.LastRequested >= RetryInterval) {
+            ++missing.Requests;
+            missing.LastRequested = now;
+            nacks.push_back(missing.SeqNumber);
+        }
+    }
+
+    std::erase_if(Missing_, [this, now](const Missing& missing) {
+        bool givenUp = missing.Requests >= MaxRetries && now - missing.LastRequested >= RetryInterval;
+        return givenUp || static_cast<uint16_t>(Highest_ - missing.SeqNumber) > MaxMissing;
+    });
+}
+
+std::vector<uint16_t> ParseNack(std::span<const std::byte> packet) {
+    std::vector<uint16_t> seqNumbers;
+    if (packet.size() < FeedbackHeaderSize) {
+        return seqNumbers;
+    }
+
+    for (size_t offset = FeedbackHeaderSize; offset + 4 <= packet.size(); offset += 4) {
+        auto pid = ReadUint16(packet.data() + offset);
+        auto blp = ReadUint16(packet.data() + offset + 2);
+        seqNumbers.push_back(pid);
+        for (int i = 0; i < 16; ++i) {
+            if (blp & (1 << i)) {
+                seqNumbers.push_back(static_cast<uint16_t>(pid + i + 1));
+            }
+        }
+    }
+    return seqNumbers;
+}
+
+rtc::binary BuildNack(rtc::SSRC mediaSsrc, std::span<const uint16_t> seqNumbers) {
+    // Each entry covers a sequence number and a bitmask of the 16 after it.
+    std::vector<std::pair<uint16_t, uint16_t>> entries;
+    for (auto seq : seqNumbers) {
+        if (!entries.empty()) {
+            auto distance = static_cast<uint16_t>(seq - entries.back().first);
+            if (distance >= 1 && distance <= 16) {
+                entries.back().second |= static_cast<uint16_t>(1 << (distance - 1));
+                continue;
+            }
+        }
+        entries.emplace_back(seq, 0);
+    }
+
+    rtc::binary nack(FeedbackHeaderSize + 4 * entries.size());
+    auto header = reinterpret_cast<rtc::RtcpFbHeader*>(nack.data());
+    header->header.prepareHeader(RtpFeedbackPayloadType, GenericNackFormat, static_cast<uint16_t>(nack.size() / 4 - 1));
+    header->setPacketSenderSSRC(1);
+    header->setMediaSourceSSRC(mediaSsrc);
+
+    auto out = nack.data() + FeedbackHeaderSize;
+    for (auto [pid, blp] : entries) {
+        WriteUint16(out, pid);
+        WriteUint16(out + 2, blp);
+        out += 4;
+    }
+    return nack;
+}
+
+std::string RemoveRtx(const std::string& answer) {
+    std::vector<std::vector<std::string>> sections(1);
+    std::istringstream stream(answer);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        if (line.starts_with("m=")) {
+            sections.emplace_back();
+        }
+        sections.back().push_back(std::move(line));
+    }
+
+    std::string result;
+    for (auto& section : sections) {
+        std::vector<std::string> rtx;
+        for (const auto& line : section) {
+            if (auto format = FormatOf(line, "a=rtpmap:"); format && line.find(" rtx/") != std::string::npos) {
+                rtx.push_back(*format);
+            }
+        }
+
+        for (const auto& line : section) {
+            auto isRtx = [&rtx](const std::optional<std::string>& format) {
+                return format && std::find(rtx.begin(), rtx.end(), *format) != rtx.end();
+            };
+            if (isRtx(FormatOf(line, "a=rtpmap:")) || isRtx(FormatOf(line, "a=fmtp:")) || isRtx(FormatOf(line, "a=rtcp-fb:"))) {
+                continue;
+            }
+
+            if (!rtx.empty() && line.starts_with("m=")) {
+                // "m=<media> <port> <proto> <formats...>"
+                std::istringstream fields(line);
+                std::string field;
+                std::string rewritten;
+                for (int i = 0; fields >> field; ++i) {
+                    if (i >= 3 && std::find(rtx.begin(), rtx.end(), field) != rtx.end()) {
+                        continue;
+                    }
+                    rewritten += (rewritten.empty() ? "" : " ") + field;
+                }
+                result += rewritten;
+            } else {
+                result += line;
+            }
+            result += "\r\n";
+        }
+    }
+    return result;
+}
+
+} // namespace sfu
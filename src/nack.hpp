@@ -0,0 +1,78 @@
+#pragma once
+
+#include "fanout.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace sfu {
+
+// Video packets recently sent on one outgoing stream, by the sequence number
+// they were sent with, so the subscriber's NACKs can be answered without
+// going back to the publisher. Packets share their buffers with the
+// forwarding path. Written by the publisher's media thread and read by the
+// subscriber's RTCP thread.
+class RetransmissionHistory {
+public:
+    struct Entry {
+        uint16_t SeqNumber;
+        uint32_t Timestamp;
+        RtpPacket Packet;
+    };
+
+    explicit RetransmissionHistory(size_t capacity);
+
+    void Add(uint16_t seqNumber, uint32_t timestamp, const RtpPacket& packet);
+
+    // The packet sent with this sequence number, unless it was overwritten.
+    std::optional<Entry> Find(uint16_t seqNumber) const;
+
+private:
+    mutable std::mutex Mutex_;
+    std::vector<std::optional<Entry>> Entries_;
+};
+
+// Finds gaps in the sequence numbers of one incoming stream and tells which
+// missing packets to NACK: right away, then every RetryInterval until they
+// arrive or MaxRetries requests went unanswered.
+class LossDetector {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr size_t MaxMissing = 256;
+    static constexpr size_t MaxRetries = 3;
+    static constexpr auto RetryInterval = std::chrono::milliseconds(40);
+
+    // Appends the sequence numbers to NACK now.
+    void OnPacket(uint16_t seqNumber, Clock::time_point now, std::vector<uint16_t>& nacks);
+
+private:
+    struct Missing {
+        uint16_t SeqNumber;
+        Clock::time_point LastRequested;
+        size_t Requests;
+    };
+
+    bool Started_ = false;
+    uint16_t Highest_ = 0;
+    std::vector<Missing> Missing_;
+};
+
+// Sequence numbers of a generic NACK (RTPFB, FMT 1) feedback packet.
+std::vector<uint16_t> ParseNack(std::span<const std::byte> packet);
+
+// Generic NACK asking the sender of mediaSsrc for the given packets.
+rtc::binary BuildNack(rtc::SSRC mediaSsrc, std::span<const uint16_t> seqNumbers);
+
+// Drops RTX from our answer, so publishers retransmit what we NACK on the
+// media SSRC, where the forwarding path picks it up like any other packet.
+std::string RemoveRtx(const std::string& answer);
+
+} // namespace sfu
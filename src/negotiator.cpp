@@ -0,0 +1,182 @@
+#include "negotiator.hpp"
+
+#include <rtc/description.hpp>
+
+#include <algorithm>
+
+namespace sfu {
+
+Negotiator::Negotiator(std::shared_ptr<rtc::PeerConnection> peerConnection, std::shared_ptr<sfu::Loop> loop, size_t spareCount, bool audio, bool video)
+    : PeerConnection_(std::move(peerConnection))
+    , Loop_(std::move(loop))
+    , SpareCount_(spareCount)
+    , Audio_(audio)
+    , Video_(video)
+{ }
+
+void Negotiator::Reserve() {
+    if (!Audio_ && !Video_) {
+        return;
+    }
+
+    while (Spares_.size() < SpareCount_) {
+        Spares_.push_back(AddTracks());
+    }
+}
+
+Negotiator::TrackPair Negotiator::Acquire() {
+    if (!Audio_ && !Video_) {
+        return {};
+    }
+
+    if (!Spares_.empty()) {
+        auto tracks = std::move(Spares_.back());
+        Spares_.pop_back();
+        return tracks;
+    }
+
+    // Already renegotiating, so refill the pool in the same offer.
+    auto tracks = AddTracks();
+    Reserve();
+    return tracks;
+}
+
+void Negotiator::Release(TrackPair tracks) {
+    if (!Audio_ && !Video_) {
+        return;
+    }
+
+    bool open = std::none_of(tracks.begin(), tracks.end(), [](const auto& track) {
+        return track && track->isClosed();
+    });
+    if (Spares_.size() < SpareCount_ && open) {
+        Spares_.push_back(std::move(tracks));
+        return;
+    }
+
+    for (auto& track : tracks) {
+        if (track) {
+            track->close();
+        }
+    }
+    Schedule();
+}
+
+std::vector<rtc::SSRC> Negotiator::GetSpareVideoSsrcs() const {
+    std::vector<rtc::SSRC> ssrcs;
+    for (const auto& tracks : Spares_) {
+        if (tracks[1]) {
+            ssrcs.push_back(tracks[1]->description().getSSRCs()[0]);
+        }
+    }
+    return ssrcs;
+}
+
+std::optional<std::chrono::steady_clock::duration> Negotiator::OnAnswer() {
+    if (!InFlight_) {
+        return {};
+    }
+
+    InFlight_ = false;
+    Loop_->CancelTimer(AnswerTimer_);
+    if (Dirty_) {
+        Dirty_ = false;
+        Schedule();
+    }
+    return std::chrono::steady_clock::now() - OfferSentAt_;
+}
+
+void Negotiator::OnRemoteOffer() {
+    if (!InFlight_) {
+        return;
+    }
+
+    // The answer we wait for will never come. The fresh offer runs after
+    // Debounce, well after the answer to the subscriber's offer is set.
+    InFlight_ = false;
+    Dirty_ = false;
+    Loop_->CancelTimer(AnswerTimer_);
+    Schedule();
+}
+
+std::shared_ptr<rtc::Track> Negotiator::AddAudioTrack() {
+    rtc::Description::Audio audioDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
+    audioDescr.addSSRC(GetUniqueId(), "audio", std::to_string(GetUniqueId()) + "audio");
+    audioDescr.addOpusCodec(109);
+    auto audioTrack = PeerConnection_->addTrack(audioDescr);
+
+    Schedule();
+    return audioTrack;
+}
+
+std::shared_ptr<rtc::Track> Negotiator::AddVideoTrack() {
+    rtc::Description::Video videoDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
+    videoDescr.addSSRC(GetUniqueId(), "video", std::to_string(GetUniqueId()) + "video");
+    videoDescr.addVP8Codec(120);
+    videoDescr.setBitrate(3000);
+    auto videoTrack = PeerConnection_->addTrack(videoDescr);
+
+    Schedule();
+    return videoTrack;
+}
+
+Negotiator::TrackPair Negotiator::AddTracks() {
+    TrackPair tracks;
+    if (Audio_) {
+        tracks[0] = AddAudioTrack();
+    }
+    if (Video_) {
+        tracks[1] = AddVideoTrack();
+    }
+    return tracks;
+}
+
+void Negotiator::Schedule() {
+    if (Scheduled_) {
+        return;
+    }
+
+    Scheduled_ = true;
+    Loop_->RunAfter(Debounce, [weak = weak_from_this()] {
+        if (auto self = weak.lock()) {
+            self->Flush();
+        }
+    });
+}
+
+void Negotiator::Flush() {
+    Scheduled_ = false;
+    if (InFlight_) {
+        Dirty_ = true;
+        return;
+    }
+
+    InFlight_ = true;
+    OfferSentAt_ = std::chrono::steady_clock::now();
+    PeerConnection_->setLocalDescription(rtc::Description::Type::Offer);
+    AnswerTimer_ = Loop_->RunAfter(AnswerTimeout, [weak = weak_from_this()] {
+        if (auto self = weak.lock()) {
+            self->ExpireOffer();
+        }
+    });
+}
+
+void Negotiator::ExpireOffer() {
+    if (!InFlight_ || PeerConnection_->state() == rtc::PeerConnection::State::Closed) {
+        return;
+    }
+
+    // The offer or its answer got lost; without a reset no further change
+    // would ever be offered.
+    InFlight_ = false;
+    Dirty_ = false;
+    if (OnAnswerTimeout_) {
+        OnAnswerTimeout_(std::chrono::steady_clock::now() - OfferSentAt_);
+    }
+    if (PeerConnection_->signalingState() == rtc::PeerConnection::SignalingState::HaveLocalOffer) {
+        PeerConnection_->setLocalDescription(rtc::Description::Type::Rollback);
+    }
+    Flush();
+}
+
+} // namespace sfu
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "loop.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <array>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace sfu {
+
+// Send side of one subscriber PeerConnection. Keeps a pool of negotiated
+// but unused track pairs so most joins need no new offer. Changes made
+// within Debounce go out as one offer, and only one offer is in flight at
+// a time; changes made meanwhile are offered once the answer arrives.
+// An offer left unanswered for AnswerTimeout is rolled back and made anew.
+// A pair leaves out the kinds a subscriber receives on fixed slots instead,
+// and is empty, needing no negotiation at all, when both are slotted.
+// Only used from the shard loop.
+class Negotiator : public std::enable_shared_from_this<Negotiator> {
+public:
+    using TrackPair = std::array<std::shared_ptr<rtc::Track>, 2>;
+
+    static constexpr auto Debounce = std::chrono::milliseconds(50);
+    static constexpr auto AnswerTimeout = std::chrono::seconds(10);
+
+    // Called with how long an offer went unanswered before it was replaced.
+    using TimeoutCallback = std::function<void(std::chrono::steady_clock::duration)>;
+
+    Negotiator(std::shared_ptr<rtc::PeerConnection> peerConnection, std::shared_ptr<sfu::Loop> loop, size_t spareCount, bool audio = true, bool video = true);
+
+    // Tops the pool up to the spare count.
+    void Reserve();
+
+    // Audio and video track for a new publisher, from the pool if possible.
+    TrackPair Acquire();
+
+    // Takes back the tracks of a publisher that left. They stay negotiated
+    // for the next one unless the pool is already full.
+    void Release(TrackPair tracks);
+
+    // SSRCs of the pool's video tracks, which show nothing.
+    std::vector<rtc::SSRC> GetSpareVideoSsrcs() const;
+
+    // Adds a track outside the pool, e.g. a fixed slot.
+    std::shared_ptr<rtc::Track> AddAudioTrack();
+    std::shared_ptr<rtc::Track> AddVideoTrack();
+
+    // Called once the subscriber's answer to our offer has been applied.
+    // Returns how long the offer took to be answered.
+    std::optional<std::chrono::steady_clock::duration> OnAnswer();
+
+    // Called before an offer of the subscriber's own is applied, which
+    // rolls back ours if one is in flight; its changes are then offered
+    // again once our answer is set.
+    void OnRemoteOffer();
+
+    void OnAnswerTimeout(TimeoutCallback callback) {
+        OnAnswerTimeout_ = std::move(callback);
+    }
+
+private:
+    TrackPair AddTracks();
+    void Schedule();
+    void Flush();
+    void ExpireOffer();
+
+    uint64_t GetUniqueId() {
+        return UniqueIdGenerator_++;
+    }
+
+    std::shared_ptr<rtc::PeerConnection> PeerConnection_;
+    std::shared_ptr<sfu::Loop> Loop_;
+    const size_t SpareCount_;
+    const bool Audio_;
+    const bool Video_;
+
+    std::vector<TrackPair> Spares_;
+    uint64_t UniqueIdGenerator_ = 150;
+
+    bool Scheduled_ = false;
+    bool InFlight_ = false;
+    bool Dirty_ = false;
+    std::chrono::steady_clock::time_point OfferSentAt_;
+    TimerId AnswerTimer_ = 0;
+    TimeoutCallback OnAnswerTimeout_;
+};
+
+} // namespace sfu
@@ -1,40 +1,607 @@
 #include "participant.hpp"
+#include "codec.hpp"
 #include "router.hpp"
 #include "rtc/frameinfo.hpp"
 
 namespace sfu {
 
-Participant::Participant(const std::shared_ptr<rtc::PeerConnection>& peerConnection, ClientId clientId)
-    : PeerConnection_(peerConnection), ClientId_(clientId)
-{ }
+namespace {
+
+// Cached packets replayed per incoming packet, so a new subscriber's GOP
+// doesn't hold up the media thread for everyone else.
+constexpr size_t PrimeBurst = 32;
+
+// Once unbound, the slot's PLIs no longer reach the publisher that fed it.
+// A slot already handed to someone else is left alone.
+void UnbindSlot(OutgoingTrack& slot, const Participant* publisher) {
+    std::lock_guard<std::mutex> lock(slot.SlotMutex);
+    if (slot.SlotPublisher.lock().get() == publisher) {
+        slot.SlotPublisher.reset();
+    }
+}
+
+Negotiator::TrackPair ReleaseTracks(const std::array<std::shared_ptr<OutgoingTrack>, 2>& tracks) {
+    return {tracks[0] ? tracks[0]->Track : nullptr, tracks[1] ? tracks[1]->Track : nullptr};
+}
+
+} // namespace
+
+OutgoingTrack::~OutgoingTrack() {
+    if (Rewriter.ClockRate() == VideoClockRate) {
+        Bandwidth->RemoveStream();
+    }
+}
+
+std::shared_ptr<OutgoingTrack> OutgoingTrack::Create(std::shared_ptr<rtc::Track> track, uint32_t clockRate, std::shared_ptr<BandwidthEstimator> bandwidth, std::weak_ptr<Participant> publisher, size_t historySize) {
+    auto outgoing = std::make_shared<OutgoingTrack>(clockRate, std::move(bandwidth));
+    std::weak_ptr<OutgoingTrack> weak = outgoing;
+
+    SubscriberSession::KeyframeRequestCallback onKeyframeRequest;
+    if (clockRate == VideoClockRate) {
+        onKeyframeRequest = [weak, publisher = std::move(publisher)](KeyframeArbiter::Source source) {
+            auto self = weak.lock();
+            if (!self) {
+                return;
+            }
+
+            // The subscriber's decoder only needs the layer it is receiving.
+            auto current = self->Layers.GetCurrent();
+            auto layer = current >= 0 ? std::optional<size_t>(current) : std::nullopt;
+
+            // Holding the publisher keeps it alive while the request runs.
+            auto owner = publisher.lock();
+            if (!owner) {
+                std::lock_guard<std::mutex> lock(self->SlotMutex);
+                owner = self->SlotPublisher.lock();
+            }
+            if (owner) {
+                owner->RequestKeyframe(layer, source);
+            }
+        };
+    }
+
+    SubscriberSession::NackCallback onNack;
+    if (historySize > 0) {
+        outgoing->History = std::make_unique<RetransmissionHistory>(historySize);
+        onNack = [weak](const std::vector<uint16_t>& seqNumbers) {
+            if (auto self = weak.lock()) {
+                self->Retransmit(seqNumbers);
+            }
+        };
+    }
+
+    outgoing->Track = std::move(track);
+    outgoing->Ssrc = outgoing->Track->description().getSSRCs()[0];
+    outgoing->Open = outgoing->Track->isOpen();
+    outgoing->Track->setMediaHandler(std::make_shared<SubscriberSession>(outgoing->Bandwidth, std::move(onKeyframeRequest), std::move(onNack)));
+    if (clockRate == VideoClockRate) {
+        outgoing->Bandwidth->AddStream();
+    }
+
+    outgoing->Track->onOpen([weak] {
+        if (auto self = weak.lock()) {
+            self->Open = true;
+        }
+    });
+    outgoing->Track->onClosed([weak] {
+        if (auto self = weak.lock()) {
+            self->Open = false;
+        }
+    });
+
+    return outgoing;
+}
+
+void OutgoingTrack::Retransmit(const std::vector<uint16_t>& seqNumbers) {
+    if (!History || !Open.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Resent as they went out the first time; there is no RTX stream.
+    auto now = BandwidthEstimator::Clock::now();
+    for (auto seqNumber : seqNumbers) {
+        if (auto entry = History->Find(seqNumber)) {
+            Bandwidth->Consume(entry->Packet.Size(), now);
+            FanOut(entry->Packet).SendTo(*Track, Ssrc, entry->SeqNumber, entry->Timestamp);
+        }
+    }
+}
+
+Participant::Participant(const std::shared_ptr<rtc::PeerConnection>& peerConnection, ClientId clientId, const std::shared_ptr<sfu::Loop>& loop, const Config& config)
+    : Keyframes_(std::make_shared<KeyframeArbiter>([this](KeyframeArbiter::LayerMask layers) { SendKeyframeRequest(layers); }))
+    , PeerConnection_(peerConnection)
+    , ClientId_(clientId)
+    , Bandwidth_(std::make_shared<BandwidthEstimator>())
+    , Negotiator_(std::make_shared<Negotiator>(peerConnection, loop, config.SpareTracks, config.AudioSlots == 0, config.VideoSlots == 0))
+    , ForwardingTable_(std::make_shared<const ForwardingTable>())
+    , UseAudioSlots_(config.AudioSlots > 0)
+    , NackHistory_(config.NackHistory)
+{
+    for (size_t i = 0; i < config.AudioSlots; ++i) {
+        AudioSlots_.push_back({OutgoingTrack::Create(Negotiator_->AddAudioTrack(), AudioClockRate, Bandwidth_), {}});
+    }
+    for (size_t i = 0; i < config.VideoSlots; ++i) {
+        VideoSlots_.push_back({OutgoingTrack::Create(Negotiator_->AddVideoTrack(), VideoClockRate, Bandwidth_, {}, NackHistory_), {}});
+    }
+}
+
+Participant::Participant(ClientId clientId, const Config& config, const RelaySourceInfo& source, std::function<void(KeyframeArbiter::LayerMask)> requestKeyframe)
+    : AudioLevelExtensionId_(source.AudioLevelExtensionId)
+    , Simulcast_(std::make_unique<SimulcastReceiver>(SimulcastDescription{0, std::vector<std::string>(source.LayerCount > 1 ? source.LayerCount : 0)}))
+    // Requests go straight to the trunk and never need this participant.
+    , Keyframes_(std::make_shared<KeyframeArbiter>(std::move(requestKeyframe)))
+    , ClientId_(clientId)
+    , Bandwidth_(std::make_shared<BandwidthEstimator>())
+    , ForwardingTable_(std::make_shared<const ForwardingTable>())
+    , UseAudioSlots_(config.AudioSlots > 0)
+    , NackHistory_(config.NackHistory)
+{
+    VideoActive_ = source.VideoActive;
+}
+
+void Participant::AddRemoteTracks(ClientId clientId, const std::array<std::shared_ptr<rtc::Track>, 2>& tracks, const std::shared_ptr<BandwidthEstimator>& bandwidth) {
+    // A kind the subscriber receives on slots has no track of its own.
+    OutgoingTracks_[clientId] = {
+        tracks[0] ? OutgoingTrack::Create(tracks[0], AudioClockRate, bandwidth) : nullptr,
+        tracks[1] ? OutgoingTrack::Create(tracks[1], VideoClockRate, bandwidth, weak_from_this(), NackHistory_) : nullptr,
+    };
+    PublishForwardingTable();
+}
+
+std::optional<Negotiator::TrackPair> Participant::RemoveRemoteTracks(ClientId clientId) {
+    auto it = OutgoingTracks_.find(clientId);
+    if (it == OutgoingTracks_.end()) {
+        return {};
+    }
+
+    auto tracks = ReleaseTracks(it->second);
+    OutgoingTracks_.erase(it);
+    PublishForwardingTable();
+
+    return tracks;
+}
+
+std::map<ClientId, Negotiator::TrackPair> Participant::StopPublishing() {
+    // Once the callbacks are replaced no media callback is running, so the
+    // media-thread state can be reset from here.
+    for (const auto& track : Tracks_) {
+        if (track) {
+            track->onMessage(nullptr, nullptr);
+        }
+    }
+    Tracks_ = {};
+    for (auto& cache : GopCaches_) {
+        cache.Clear();
+    }
+
+    std::map<ClientId, Negotiator::TrackPair> released;
+    for (auto& [id, tracks] : OutgoingTracks_) {
+        released[id] = ReleaseTracks(tracks);
+    }
+    OutgoingTracks_.clear();
+    for (auto& [id, slot] : AudioSlotTargets_) {
+        UnbindSlot(*slot, this);
+    }
+    AudioSlotTargets_.clear();
+    for (auto& [id, slot] : VideoSlotTargets_) {
+        UnbindSlot(*slot, this);
+    }
+    VideoSlotTargets_.clear();
+    PublishForwardingTable();
+
+    return released;
+}
+
+void Participant::SetAudioSlot(ClientId subscriberId, std::shared_ptr<OutgoingTrack> slot) {
+    if (slot) {
+        {
+            std::lock_guard<std::mutex> lock(slot->SlotMutex);
+            slot->SlotPublisher = weak_from_this();
+        }
+        AudioSlotTargets_[subscriberId] = std::move(slot);
+    } else if (auto it = AudioSlotTargets_.find(subscriberId); it != AudioSlotTargets_.end()) {
+        UnbindSlot(*it->second, this);
+        AudioSlotTargets_.erase(it);
+    } else {
+        return;
+    }
+    PublishForwardingTable();
+}
+
+void Participant::SetVideoSlot(ClientId subscriberId, std::shared_ptr<OutgoingTrack> slot) {
+    // A subscriber receives us on one slot at most; moving to another one
+    // leaves the previous slot without a publisher.
+    if (auto it = VideoSlotTargets_.find(subscriberId); it != VideoSlotTargets_.end() && it->second != slot) {
+        UnbindSlot(*it->second, this);
+        VideoSlotTargets_.erase(it);
+        if (!slot) {
+            PublishForwardingTable();
+        }
+    }
+    if (!slot) {
+        return;
+    }
+
+    {
+        // The previous holder may still be sending; from its next packet on
+        // the slot waits for our key frame instead.
+        std::lock_guard<std::mutex> lock(slot->SlotMutex);
+        slot->SlotPublisher = weak_from_this();
+        slot->Layers.SetCurrent(-1);
+        slot->Resync.store(true, std::memory_order_relaxed);
+    }
+    VideoSlotTargets_[subscriberId] = std::move(slot);
+    PublishForwardingTable();
+    RequestKeyframe();
+}
+
+std::shared_ptr<OutgoingTrack> Participant::GetVideoTarget(ClientId subscriberId) const {
+    if (auto it = OutgoingTracks_.find(subscriberId); it != OutgoingTracks_.end() && it->second[1]) {
+        return it->second[1];
+    }
+    if (auto it = VideoSlotTargets_.find(subscriberId); it != VideoSlotTargets_.end()) {
+        return it->second;
+    }
+    return nullptr;
+}
+
+void Participant::SetRelayTargets(RoomId roomId, std::vector<std::shared_ptr<Trunk>> trunks) {
+    RelayRoom_ = roomId;
+    Trunks_ = std::move(trunks);
+    PublishForwardingTable();
+}
+
+std::optional<RelaySourceInfo> Participant::GetRelaySource() const {
+    if (IsRemote() || !Tracks_[1] || !Simulcast_) {
+        return {};
+    }
+
+    return RelaySourceInfo{
+        static_cast<uint8_t>(AudioLevelExtensionId_),
+        static_cast<uint8_t>(Simulcast_->GetLayerCount()),
+        IsVideoActive(),
+    };
+}
+
+void Participant::Inject(size_t kind, int layer, RtpPacket&& packet) {
+    if (kind == 0) {
+        ForwardAudio(packet);
+    } else {
+        ForwardVideo(packet, layer < static_cast<int>(Simulcast_->GetLayerCount()) ? layer : -1);
+    }
+}
+
+void Participant::PublishForwardingTable() {
+    auto table = std::make_shared<ForwardingTable>();
+    table->RelayRoom = RelayRoom_;
+    table->Trunks = Trunks_;
+    table->Owners.reserve(OutgoingTracks_.size() * 2);
+
+    auto add = [&table](size_t index, const std::shared_ptr<OutgoingTrack>& outgoing, bool shared) {
+        table->Entries[index].push_back({outgoing->Track.get(), outgoing->Ssrc, &outgoing->Open, outgoing.get(), shared});
+        table->Owners.push_back(outgoing);
+    };
+
+    for (const auto& [id, tracks] : OutgoingTracks_) {
+        if (tracks[0] && !UseAudioSlots_) {
+            add(0, tracks[0], false);
+        }
+        if (tracks[1] && tracks[1]->Rendered) {
+            add(1, tracks[1], false);
+        }
+    }
+    for (const auto& [id, slot] : AudioSlotTargets_) {
+        add(0, slot, true);
+    }
+    for (const auto& [id, slot] : VideoSlotTargets_) {
+        if (slot->Rendered) {
+            add(1, slot, true);
+        }
+    }
+
+    ForwardingTable_.store(std::move(table), std::memory_order_release);
+}
 
 void Participant::SetTracks(const std::array<std::shared_ptr<rtc::Track>, 2>& tracks) {
     Tracks_ = tracks;
 
+    AudioLevelExtensionId_ = FindExtensionId(Tracks_[0]->description(), AudioLevelUri);
     Tracks_[0]->onMessage([this](rtc::binary message) {
-        std::shared_lock lock(TracksMutex_);
-        
-        for (auto [id, target] : OutgoingTracks_) {
-            if (target[0]->isOpen()) {
-                auto rtp = reinterpret_cast<rtc::RtpHeader *>(message.data());
-                rtp->setSsrc(target[0]->description().getSSRCs()[0]);
-                target[0]->send(message);
-            }
+        ForwardAudio(RtpPacket(std::move(message)));
+    }, nullptr);
+
+    Simulcast_ = std::make_unique<SimulcastReceiver>(ParseSimulcast(Tracks_[1]->description()));
+    VideoSession_ = std::dynamic_pointer_cast<VideoReceivingSession>(Tracks_[1]->getMediaHandler());
+
+    Tracks_[1]->onMessage([this](rtc::binary message) {
+        RtpPacket packet(std::move(message));
+        if (packet.IsValid()) {
+            ForwardVideo(packet, Simulcast_->Classify(packet));
         }
     }, nullptr);
+    RequestKeyframe();
+}
 
-    Tracks_[1]->onMessage([this](rtc::binary videoMessage) {
-        std::shared_lock lock(TracksMutex_);
+void Participant::RequestKeyframe(std::optional<size_t> layer, KeyframeArbiter::Source source) {
+    Keyframes_->Request(layer, source);
+}
+
+void Participant::SendKeyframeRequest(KeyframeArbiter::LayerMask layers) {
+    if (!Tracks_[1]) {
+        return;
+    }
 
-        for (auto [id, target] : OutgoingTracks_) {
-            if (target[1]->isOpen()) {
-                auto rtp = reinterpret_cast<rtc::RtpHeader *>(videoMessage.data());
-                rtp->setSsrc(target[1]->description().getSSRCs()[0]);
-                target[1]->send(videoMessage);
+    if (VideoSession_ && Simulcast_) {
+        std::vector<rtc::SSRC> ssrcs;
+        for (size_t i = 0; i < Simulcast_->GetLayerCount(); ++i) {
+            if (layers & (KeyframeArbiter::LayerMask(1) << i)) {
+                ssrcs.push_back(Simulcast_->GetLayerSsrc(i));
             }
         }
-    }, nullptr);
+        VideoSession_->AddKeyframeRequest(ssrcs);
+    }
+
     Tracks_[1]->requestKeyframe();
 }
 
+bool Participant::SetVideoLayer(ClientId subscriberId, int layer) {
+    auto target = GetVideoTarget(subscriberId);
+    if (!target) {
+        return false;
+    }
+
+    target->Layers.SetTarget(layer);
+    if (layer == LayerSelector::Highest && Simulcast_) {
+        RequestKeyframe(Simulcast_->GetLayerCount() - 1);
+    } else {
+        RequestKeyframe(layer);
+    }
+    return true;
+}
+
+void Participant::SetVideoActive(bool active) {
+    if (VideoActive_.exchange(active, std::memory_order_relaxed) == active) {
+        return;
+    }
+
+    if (active) {
+        RequestKeyframe();
+    }
+}
+
+bool Participant::SetVideoRendered(ClientId subscriberId, bool rendered) {
+    auto target = GetVideoTarget(subscriberId);
+    if (!target) {
+        return false;
+    }
+
+    auto& outgoing = *target;
+    if (outgoing.Rendered == rendered) {
+        return true;
+    }
+
+    outgoing.Rendered = rendered;
+    if (rendered) {
+        outgoing.Resync.store(true, std::memory_order_relaxed);
+        RequestKeyframe(outgoing.Layers.GetCurrent() >= 0 ? std::optional<size_t>(outgoing.Layers.GetCurrent()) : std::nullopt);
+    }
+    PublishForwardingTable();
+    return true;
+}
+
+void Participant::ForwardAudio(const RtpPacket& packet) {
+    if (!packet.IsValid()) {
+        return;
+    }
+
+    auto now = BandwidthEstimator::Clock::now();
+    if (auto level = packet.FindExtension(AudioLevelExtensionId_); !level.empty()) {
+        AudioLevel_.Update(std::to_integer<uint8_t>(level[0]) & 0x7F, now);
+    }
+
+    FanOut fanOut(packet);
+    auto table = ForwardingTable_.load(std::memory_order_acquire);
+    uint64_t forwarded = 0;
+    uint64_t closed = 0;
+
+    for (const auto& entry : table->Entries[0]) {
+        if (!entry.Open->load(std::memory_order_relaxed)) {
+            ++closed;
+            continue;
+        }
+
+        if (!entry.Shared) {
+            // Audio is never dropped, but still counts against the budget.
+            entry.Target->Bandwidth->Consume(packet.Size(), now);
+            ++forwarded;
+            fanOut.SendTo(*entry.Track, entry.Ssrc);
+            continue;
+        }
+
+        // Slots change speakers, so the stream is rewritten to stay continuous.
+        std::lock_guard<std::mutex> lock(entry.Target->SlotMutex);
+        if (entry.Target->SlotPublisher.lock().get() != this) {
+            // Our table is older than the slot's new speaker.
+            continue;
+        }
+        entry.Target->Bandwidth->Consume(packet.Size(), now);
+        ++forwarded;
+        auto [seqNumber, timestamp] = entry.Target->Rewriter.Rewrite(packet.Header(), now);
+        fanOut.SendTo(*entry.Track, entry.Ssrc, seqNumber, timestamp);
+    }
+
+    CountTraffic(0, packet.Size(), forwarded, closed);
+
+    for (const auto& trunk : table->Trunks) {
+        trunk->SendMedia(table->RelayRoom, ClientId_, 0, 0, packet);
+    }
+}
+
+void Participant::ForwardVideo(const RtpPacket& packet, int layer) {
+    if (!packet.IsValid() || layer < 0) {
+        return;
+    }
+
+    if (!VideoActive_.load(std::memory_order_relaxed)) {
+        CountTraffic(1, packet.Size(), 0, 0);
+        VideoPaused_ = true;
+        return;
+    }
+
+    // The cached GOPs are from before the pause and useless now.
+    bool resumed = std::exchange(VideoPaused_, false);
+    if (resumed) {
+        for (auto& cache : GopCaches_) {
+            cache.Clear();
+        }
+    }
+
+    auto layerCount = Simulcast_->GetLayerCount();
+    bool keyframe = IsVp8Keyframe(packet.Body());
+    auto now = RtpRewriter::Clock::now();
+    Simulcast_->Measure(layer, packet.Size(), now);
+    Keyframes_->Poll(now);
+
+    FanOut fanOut(packet);
+    auto table = ForwardingTable_.load(std::memory_order_acquire);
+    uint64_t forwarded = 0;
+    uint64_t closed = 0;
+
+    for (const auto& entry : table->Entries[1]) {
+        if (!entry.Open->load(std::memory_order_relaxed)) {
+            ++closed;
+            continue;
+        }
+
+        auto& target = *entry.Target;
+        std::unique_lock<std::mutex> slotLock;
+        if (entry.Shared) {
+            slotLock = std::unique_lock<std::mutex>(target.SlotMutex);
+            // Our table is older than the slot's new publisher, whose key
+            // frame the slot waits for; leave its state alone.
+            if (target.SlotPublisher.lock().get() != this) {
+                continue;
+            }
+        }
+        if (resumed || (target.Resync.load(std::memory_order_relaxed) && target.Resync.exchange(false, std::memory_order_relaxed))) {
+            // Continue as a fresh source from the cached GOP or the next key frame.
+            target.Rewriter.Reset();
+            target.Primed = false;
+            target.WaitingForKeyframe = true;
+        }
+
+        auto maxLayer = Simulcast_->GetLayerFor(target.Bandwidth->GetStreamShare());
+
+        if (!target.Primed) {
+            target.Primed = true;
+            auto primeLayer = target.Layers.GetEffectiveTarget(layerCount, maxLayer);
+            // A key frame of that layer is starting right now anyway.
+            if (!(keyframe && layer == primeLayer) && !GopCaches_[primeLayer].IsEmpty()) {
+                target.PrimeLayer = primeLayer;
+                target.PrimeNext = 0;
+            }
+        }
+
+        if (target.PrimeLayer >= 0) {
+            if (keyframe && layer == target.PrimeLayer) {
+                // A newer GOP replaces the rest of the cached one.
+                target.PrimeLayer = -1;
+            } else if (!Prime(target, now)) {
+                // Sent later from the cache, in order.
+                continue;
+            }
+        }
+
+        bool accepted = target.Layers.Accept(layer, keyframe, layerCount, maxLayer);
+        if (auto request = target.Layers.TakeKeyframeRequest()) {
+            RequestKeyframe(*request);
+        }
+        if (!accepted) {
+            continue;
+        }
+
+        // Once a packet had to be dropped the rest of the GOP is useless to
+        // the decoder; resume on the next key frame as a fresh source.
+        if (target.WaitingForKeyframe) {
+            if (!keyframe) {
+                continue;
+            }
+            target.WaitingForKeyframe = false;
+        }
+
+        if (!target.Bandwidth->TryConsume(packet.Size(), now)) {
+            target.WaitingForKeyframe = true;
+            target.Rewriter.Reset();
+            RequestKeyframe(layer);
+            continue;
+        }
+
+        auto [seqNumber, timestamp] = target.Rewriter.Rewrite(packet.Header(), now);
+        fanOut.SendTo(*entry.Track, entry.Ssrc, seqNumber, timestamp);
+        if (target.History) {
+            target.History->Add(seqNumber, timestamp, packet);
+        }
+        ++forwarded;
+    }
+
+    CountTraffic(1, packet.Size(), forwarded, closed);
+
+    for (const auto& trunk : table->Trunks) {
+        trunk->SendMedia(table->RelayRoom, ClientId_, 1, layer, packet);
+    }
+
+    GopCaches_[layer].Add(packet, keyframe);
+}
+
+void Participant::CountTraffic(size_t kind, size_t size, uint64_t forwarded, uint64_t closed) {
+    auto& traffic = Traffic_[kind];
+    traffic.PacketsReceived.fetch_add(1, std::memory_order_relaxed);
+    traffic.BytesReceived.fetch_add(size, std::memory_order_relaxed);
+    if (forwarded) {
+        traffic.PacketsForwarded.fetch_add(forwarded, std::memory_order_relaxed);
+        traffic.BytesForwarded.fetch_add(forwarded * size, std::memory_order_relaxed);
+    }
+    if (closed) {
+        traffic.DroppedClosed.fetch_add(closed, std::memory_order_relaxed);
+    }
+}
+
+bool Participant::Prime(OutgoingTrack& target, std::chrono::steady_clock::time_point now) {
+    const auto& packets = GopCaches_[target.PrimeLayer].GetPackets();
+    if (packets.empty() || target.PrimeNext >= packets.size()) {
+        // The cache gave up on the GOP; wait for a fresh key frame instead.
+        RequestKeyframe(static_cast<size_t>(target.PrimeLayer));
+        target.WaitingForKeyframe = true;
+        target.PrimeLayer = -1;
+        return true;
+    }
+
+    auto& traffic = Traffic_[1];
+    auto end = std::min(packets.size(), target.PrimeNext + PrimeBurst);
+    for (; target.PrimeNext < end; ++target.PrimeNext) {
+        const auto& cached = packets[target.PrimeNext];
+        if (!target.Bandwidth->TryConsume(cached.Size(), now)) {
+            return false;
+        }
+
+        auto [seqNumber, timestamp] = target.Rewriter.Rewrite(cached.Header(), now);
+        FanOut(cached).SendTo(*target.Track, target.Ssrc, seqNumber, timestamp);
+        if (target.History) {
+            target.History->Add(seqNumber, timestamp, cached);
+        }
+
+        traffic.PacketsForwarded.fetch_add(1, std::memory_order_relaxed);
+        traffic.BytesForwarded.fetch_add(cached.Size(), std::memory_order_relaxed);
+    }
+
+    if (target.PrimeNext < packets.size()) {
+        return false;
+    }
+
+    target.Layers.SetCurrent(target.PrimeLayer);
+    target.WaitingForKeyframe = false;
+    target.PrimeLayer = -1;
+    return true;
+}
+
 } // namespace sfu
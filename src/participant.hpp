@@ -1,14 +1,29 @@
 #pragma once
 
 #include "fwd.hpp"
+#include "bandwidth.hpp"
+#include "config.hpp"
+#include "fanout.hpp"
+#include "gop.hpp"
+#include "keyframe.hpp"
+#include "nack.hpp"
+#include "negotiator.hpp"
+#include "relay.hpp"
+#include "rewriter.hpp"
+#include "simulcast.hpp"
+#include "speaker.hpp"
 #include "rtc/peerconnection.hpp"
 #include "loop.hpp"
 
 #include <rtc/description.hpp>
 #include <rtc/rtc.hpp>
 
+#include <atomic>
+#include <functional>
+#include <map>
 #include <memory>
-#include <shared_mutex>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 
 namespace sfu {
@@ -17,33 +32,200 @@ class Loop;
 
 using ClientId = uint64_t;
 
-class Participant {
+class Participant;
+
+// Subscriber end of a forwarded track. The SSRC is cached when the track is
+// created and the open state follows the track callbacks, so forwarding
+// never has to query the track itself.
+struct OutgoingTrack {
+    OutgoingTrack(uint32_t clockRate, std::shared_ptr<BandwidthEstimator> bandwidth)
+        : Bandwidth(std::move(bandwidth))
+        , Rewriter(clockRate)
+    { }
+
+    ~OutgoingTrack();
+
+    // PLI and FIR the subscriber sends on a video track go to the publisher,
+    // or for a slot to the publisher currently holding it.
+    // With a history size its NACKs are answered from the history.
+    static std::shared_ptr<OutgoingTrack> Create(std::shared_ptr<rtc::Track> track, uint32_t clockRate, std::shared_ptr<BandwidthEstimator> bandwidth, std::weak_ptr<Participant> publisher = {}, size_t historySize = 0);
+
+    // Sends the requested packets again, as far as the history still has them.
+    void Retransmit(const std::vector<uint16_t>& seqNumbers);
+
+    std::shared_ptr<rtc::Track> Track;
+    rtc::SSRC Ssrc = 0;
+    std::atomic<bool> Open = false;
+
+    // Downlink of the subscriber this track belongs to.
+    std::shared_ptr<BandwidthEstimator> Bandwidth;
+
+    // Recently sent packets, for NACKs; null unless enabled.
+    std::unique_ptr<RetransmissionHistory> History;
+
+    // Media-thread state of the stream sent to this subscriber.
+    RtpRewriter Rewriter;
+    LayerSelector Layers;
+    bool Primed = false;
+    bool WaitingForKeyframe = false;
+    // Layer whose cached GOP is being replayed, from PrimeNext on; -1 once
+    // the stream is live.
+    int PrimeLayer = -1;
+    size_t PrimeNext = 0;
+
+    // Whether the subscriber shows this video; changed from signaling, which
+    // leaves hidden tracks out of the forwarding table.
+    bool Rendered = true;
+    // Set from signaling when the stream resumes; the media thread then
+    // restarts it from the cached GOP or the next key frame.
+    std::atomic<bool> Resync = false;
+    // A slot is fed by whichever publisher holds it and ignores packets
+    // from any other; the lock covers the media-thread state above while the
+    // slot changes hands.
+    std::mutex SlotMutex;
+    std::weak_ptr<Participant> SlotPublisher;
+};
+
+// One of the fixed tracks of a subscriber receiving the loudest speakers'
+// audio (last-N) or the videos it picked on fixed slots.
+struct ReceiveSlot {
+    std::shared_ptr<OutgoingTrack> Target;
+    std::optional<ClientId> Publisher;
+};
+
+struct ForwardingEntry {
+    rtc::Track* Track;
+    rtc::SSRC Ssrc;
+    const std::atomic<bool>* Open;
+    OutgoingTrack* Target;
+    // A slot, whose state is locked as other publishers may feed it too.
+    bool Shared;
+};
+
+// Immutable snapshot of a publisher's subscribers, indexed by track kind.
+// Rebuilt on membership changes and swapped in as a whole.
+struct ForwardingTable {
+    std::array<std::vector<ForwardingEntry>, 2> Entries;
+
+    // Keeps every track referenced by Entries alive while the snapshot is in use.
+    std::vector<std::shared_ptr<OutgoingTrack>> Owners;
+
+    // Other nodes with clients in the room; every packet goes to each once.
+    RoomId RelayRoom = 0;
+    std::vector<std::shared_ptr<Trunk>> Trunks;
+};
+
+// What a publisher sent us and what was forwarded of it, for one track
+// kind. Only the publisher's media callbacks write, so the relaxed adds
+// don't contend with anything.
+struct alignas(64) TrafficCounters {
+    std::atomic<uint64_t> PacketsReceived = 0;
+    std::atomic<uint64_t> BytesReceived = 0;
+    std::atomic<uint64_t> PacketsForwarded = 0;
+    std::atomic<uint64_t> BytesForwarded = 0;
+    // Packets not sent to a subscriber because its track is closed.
+    std::atomic<uint64_t> DroppedClosed = 0;
+};
+
+// TrafficCounters summed over several participants.
+struct TrafficTotals {
+    uint64_t PacketsReceived = 0;
+    uint64_t BytesReceived = 0;
+    uint64_t PacketsForwarded = 0;
+    uint64_t BytesForwarded = 0;
+    uint64_t DroppedClosed = 0;
+
+    void Add(const TrafficCounters& counters) {
+        PacketsReceived += counters.PacketsReceived.load(std::memory_order_relaxed);
+        BytesReceived += counters.BytesReceived.load(std::memory_order_relaxed);
+        PacketsForwarded += counters.PacketsForwarded.load(std::memory_order_relaxed);
+        BytesForwarded += counters.BytesForwarded.load(std::memory_order_relaxed);
+        DroppedClosed += counters.DroppedClosed.load(std::memory_order_relaxed);
+    }
+};
+
+// Owned through shared_ptr: subscriber tracks only hold it weakly.
+class Participant : public std::enable_shared_from_this<Participant> {
 public:
-    Participant(const std::shared_ptr<rtc::PeerConnection>& peerConnection, ClientId clientId);
+    Participant(const std::shared_ptr<rtc::PeerConnection>& peerConnection, ClientId clientId, const std::shared_ptr<sfu::Loop>& loop, const Config& config);
+    // Publisher on another node, fed by the relay. Key frame requests for it
+    // go back over the trunk.
+    Participant(ClientId clientId, const Config& config, const RelaySourceInfo& source, std::function<void(KeyframeArbiter::LayerMask)> requestKeyframe);
 
     void SetTracks(const std::array<std::shared_ptr<rtc::Track>, 2>& tracks);
 
-    void AddRemoteTracks(ClientId clientId, const std::array<std::shared_ptr<rtc::Track>, 2>& tracks) {
-        std::unique_lock guard(TracksMutex_);
-        OutgoingTracks_[clientId] = tracks;
+    void AddRemoteTracks(ClientId clientId, const std::array<std::shared_ptr<rtc::Track>, 2>& tracks, const std::shared_ptr<BandwidthEstimator>& bandwidth);
+    // Stops forwarding to the subscriber and hands back its tracks, still open.
+    std::optional<Negotiator::TrackPair> RemoveRemoteTracks(ClientId clientId);
+
+    // Stops publishing while the PeerConnection stays up: the incoming tracks
+    // are ignored until SetTracks is called again, and every subscriber's
+    // tracks are handed back, still open.
+    std::map<ClientId, Negotiator::TrackPair> StopPublishing();
+
+    // Asks the publisher for a video key frame, on one simulcast layer or on
+    // all of them. Requests are coalesced and rate limited by the arbiter.
+    void RequestKeyframe(std::optional<size_t> layer = {}, KeyframeArbiter::Source source = KeyframeArbiter::Source::Internal);
+
+    // Selects the simulcast layer forwarded to a subscriber; LayerSelector::Highest for the best one.
+    bool SetVideoLayer(ClientId subscriberId, int layer);
+
+    // Simulcast layers the video is published in, 1 without simulcast.
+    size_t GetVideoLayerCount() const {
+        return Simulcast_ ? Simulcast_->GetLayerCount() : 1;
+    }
+
+    // Publisher side pause: while inactive the video isn't forwarded at all.
+    void SetVideoActive(bool active);
+
+    bool IsVideoActive() const {
+        return VideoActive_.load(std::memory_order_relaxed);
+    }
+
+    // Subscriber side pause: stops forwarding the video to a subscriber
+    // that doesn't render it.
+    bool SetVideoRendered(ClientId subscriberId, bool rendered);
+
+    // Sends this participant's media to other nodes of the room as well.
+    void SetRelayTargets(RoomId roomId, std::vector<std::shared_ptr<Trunk>> trunks);
+
+    // Media of a remote publisher received from its node.
+    void Inject(size_t kind, int layer, RtpPacket&& packet);
+
+    // What other nodes need to forward this participant, once it publishes.
+    std::optional<RelaySourceInfo> GetRelaySource() const;
+
+    // Publisher on another node, without a PeerConnection of its own.
+    bool IsRemote() const {
+        return !PeerConnection_;
+    }
+
+    // Forwards this participant's audio to the subscriber's slot, or stops
+    // forwarding it with a null slot. Only used in last-N mode.
+    void SetAudioSlot(ClientId subscriberId, std::shared_ptr<OutgoingTrack> slot);
+
+    // Audio tracks this participant receives the loudest speakers on; empty
+    // unless last-N mode is on.
+    std::vector<ReceiveSlot>& GetAudioSlots() {
+        return AudioSlots_;
     }
 
-    void CloseRemoteTracks() {
-        std::unique_lock guard(TracksMutex_);
-        for (auto& [id, tracks] : OutgoingTracks_) {
-            for (auto& track : tracks) {
-                track->close();
-            }
-        }
-        OutgoingTracks_.clear();
+    // Forwards this participant's video to the subscriber's slot, or stops
+    // with a null slot. The slot continues as one stream from a key frame.
+    void SetVideoSlot(ClientId subscriberId, std::shared_ptr<OutgoingTrack> slot);
+
+    // Video tracks this participant receives the publishers it picked on;
+    // empty unless video slots are on.
+    std::vector<ReceiveSlot>& GetVideoSlots() {
+        return VideoSlots_;
     }
 
-    void RemoveRemoteTracks(ClientId clientId) {
-        std::unique_lock guard(TracksMutex_);
-        for (auto& track : OutgoingTracks_[clientId]) {
-            track->close();
-        }
-        OutgoingTracks_.erase(clientId);
+    // The track the subscriber receives this participant's video on, its
+    // own or a slot; null if it doesn't.
+    std::shared_ptr<OutgoingTrack> GetVideoTarget(ClientId subscriberId) const;
+
+    uint32_t GetLoudness(AudioLevelMeter::Clock::time_point now) const {
+        return AudioLevel_.GetLoudness(now);
     }
 
     const auto& GetTracks() {
@@ -62,17 +244,68 @@ public:
         return PeerConnection_;
     }
 
-    std::map<ClientId, std::array<std::shared_ptr<rtc::Track>, 2>> OutgoingTracks_;
+    KeyframeArbiter::Stats GetKeyframeStats() const {
+        return Keyframes_->GetStats();
+    }
+
+    const TrafficCounters& GetTraffic(size_t kind) const {
+        return Traffic_[kind];
+    }
+
+    // Send side of this participant's PeerConnection.
+    const std::shared_ptr<Negotiator>& GetNegotiator() {
+        return Negotiator_;
+    }
+
+    // Downlink estimate of this participant as a subscriber.
+    const std::shared_ptr<BandwidthEstimator>& GetBandwidth() {
+        return Bandwidth_;
+    }
 
 private:
+    void ForwardAudio(const RtpPacket& packet);
+    void ForwardVideo(const RtpPacket& packet, int layer);
+    // Replays the next PrimeBurst packets of the cached GOP to a subscriber
+    // that hasn't received video yet, as far as its downlink allows. True
+    // once the subscriber has caught up to the live stream.
+    bool Prime(OutgoingTrack& target, std::chrono::steady_clock::time_point now);
+    void PublishForwardingTable();
+    void CountTraffic(size_t kind, size_t size, uint64_t forwarded, uint64_t closed);
+    // Sends one upstream PLI for the layers the arbiter let through.
+    void SendKeyframeRequest(KeyframeArbiter::LayerMask layers);
+
     std::array<std::shared_ptr<rtc::Track>, 2> Tracks_;
-    std::vector<std::byte> CachedKeyFrame_;
+    std::array<TrafficCounters, 2> Traffic_;
+    int AudioLevelExtensionId_ = 0;
+    AudioLevelMeter AudioLevel_;
+    std::unique_ptr<SimulcastReceiver> Simulcast_;
+    std::shared_ptr<VideoReceivingSession> VideoSession_;
+    std::atomic<bool> VideoActive_ = true;
+    // Media-thread view of VideoActive_, to notice the resume.
+    bool VideoPaused_ = false;
+    std::array<GopCache, MaxSimulcastLayers> GopCaches_;
+    std::shared_ptr<KeyframeArbiter> Keyframes_;
 
     std::shared_ptr<rtc::PeerConnection> PeerConnection_;
 
     ClientId ClientId_;
 
-    std::shared_mutex TracksMutex_;
+    std::shared_ptr<BandwidthEstimator> Bandwidth_;
+    std::shared_ptr<Negotiator> Negotiator_;
+    RoomId RelayRoom_ = 0;
+    std::vector<std::shared_ptr<Trunk>> Trunks_;
+    std::vector<ReceiveSlot> AudioSlots_;
+    std::vector<ReceiveSlot> VideoSlots_;
+
+    // Membership is only changed from the signaling loop; the media
+    // callbacks read the published table snapshot instead.
+    std::map<ClientId, std::array<std::shared_ptr<OutgoingTrack>, 2>> OutgoingTracks_;
+    // Subscribers holding this participant in one of their slots.
+    std::map<ClientId, std::shared_ptr<OutgoingTrack>> AudioSlotTargets_;
+    std::map<ClientId, std::shared_ptr<OutgoingTrack>> VideoSlotTargets_;
+    std::atomic<std::shared_ptr<const ForwardingTable>> ForwardingTable_;
+    const bool UseAudioSlots_;
+    const size_t NackHistory_;
 };
 
 } // namespace sfu
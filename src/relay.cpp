@@ -0,0 +1,443 @@
+#include "relay.hpp"
+
+#include "log.hpp"
+#include "participant.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstring>
+#include <stdexcept>
+
+namespace sfu {
+
+namespace {
+
+constexpr size_t HeaderSize = RelayHeaderSize;
+constexpr size_t MaxDatagramSize = 2048;
+// Datagrams taken from the socket per recvmmsg call.
+constexpr size_t ReceiveBatchSize = 32;
+
+template <typename T>
+void Write(std::byte*& out, T value) {
+    for (size_t i = sizeof(T); i-- > 0;) {
+        *out++ = static_cast<std::byte>((value >> (8 * i)) & 0xFF);
+    }
+}
+
+template <typename T>
+T Read(const std::byte*& in) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value = static_cast<T>((value << 8) | std::to_integer<uint8_t>(*in++));
+    }
+    return value;
+}
+
+std::byte* WriteHeader(std::byte* out, RelayMessageType type, RoomId roomId, ClientId publisherId) {
+    std::memset(out, 0, HeaderSize);
+    Write(out, static_cast<uint8_t>(type));
+    Write(out, roomId);
+    Write(out, publisherId);
+    return out;
+}
+
+sockaddr_in ResolvePeer(const std::string& peer) {
+    auto colon = peer.rfind(':');
+    if (colon == std::string::npos) {
+        throw std::runtime_error("Relay peer must be host:port: " + peer);
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(peer.substr(0, colon).c_str(), peer.substr(colon + 1).c_str(), &hints, &result) != 0 || !result) {
+        throw std::runtime_error("Can't resolve relay peer " + peer);
+    }
+
+    sockaddr_in address;
+    std::memcpy(&address, result->ai_addr, sizeof(address));
+    freeaddrinfo(result);
+    return address;
+}
+
+bool SameAddress(const sockaddr_in& lhs, const sockaddr_in& rhs) {
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+
+} // namespace
+
+FlushTimer::FlushTimer()
+    : Thread_(&FlushTimer::Run, this)
+{ }
+
+FlushTimer::~FlushTimer() {
+    {
+        std::lock_guard<std::mutex> lock(Mutex_);
+        Stopped_ = true;
+    }
+    Wake_.notify_one();
+    Thread_.join();
+}
+
+void FlushTimer::Arm(std::weak_ptr<Trunk> trunk, std::chrono::microseconds delay) {
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(Mutex_);
+        idle = Due_.empty();
+        Due_.emplace_back(Clock::now() + delay, std::move(trunk));
+    }
+    // Otherwise the thread is already waiting for an earlier deadline.
+    if (idle) {
+        Wake_.notify_one();
+    }
+}
+
+void FlushTimer::Run() {
+    // The default 50 us slack would be a good part of the flush interval.
+    prctl(PR_SET_TIMERSLACK, 1UL);
+
+    std::unique_lock<std::mutex> lock(Mutex_);
+    while (!Stopped_) {
+        if (Due_.empty()) {
+            Wake_.wait(lock);
+            continue;
+        }
+        if (Wake_.wait_until(lock, Due_.front().first) == std::cv_status::no_timeout && Clock::now() < Due_.front().first) {
+            continue;
+        }
+
+        auto trunk = std::move(Due_.front().second);
+        Due_.pop_front();
+        lock.unlock();
+        if (auto self = trunk.lock()) {
+            self->Flush();
+        }
+        lock.lock();
+    }
+}
+
+Trunk::Trunk(int socket, const sockaddr_in& address, std::chrono::microseconds flushInterval, std::weak_ptr<FlushTimer> flushTimer)
+    : Socket_(socket)
+    , Address_(address)
+    , FlushInterval_(flushInterval)
+    , FlushTimer_(std::move(flushTimer))
+{ }
+
+Trunk::~Trunk() {
+    auto node = Pending_.exchange(nullptr);
+    while (node) {
+        std::unique_ptr<PendingMedia> current(node);
+        node = node->Next;
+    }
+}
+
+void Trunk::SendMedia(RoomId roomId, ClientId publisherId, size_t kind, int layer, const RtpPacket& packet) {
+    std::array<std::byte, HeaderSize> header;
+    auto out = WriteHeader(header.data(), RelayMessageType::Media, roomId, publisherId);
+    Write(out, static_cast<uint8_t>(kind));
+    Write(out, static_cast<uint8_t>(layer));
+
+    if (FlushInterval_.count() == 0) {
+        Send(header, packet.Data());
+        return;
+    }
+
+    // The packet is shared, not copied, until the batch is sent.
+    auto node = new PendingMedia{header, packet};
+    auto head = Pending_.load(std::memory_order_relaxed);
+    do {
+        node->Next = head;
+    } while (!Pending_.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+
+    if (PendingCount_.fetch_add(1, std::memory_order_relaxed) + 1 >= static_cast<int64_t>(SendBatchSize)) {
+        Flush();
+    } else if (!head) {
+        // Busy trunks fill whole batches on their own; this bounds how long
+        // the last packets of a quiet one wait.
+        if (auto timer = FlushTimer_.lock()) {
+            timer->Arm(weak_from_this(), FlushInterval_);
+        } else {
+            Flush();
+        }
+    }
+}
+
+void Trunk::Flush() {
+    auto node = Pending_.exchange(nullptr, std::memory_order_acquire);
+
+    // The stack holds the newest packet first; restore sending order.
+    PendingMedia* pending = nullptr;
+    int64_t count = 0;
+    while (node) {
+        auto next = node->Next;
+        node->Next = pending;
+        pending = node;
+        node = next;
+        ++count;
+    }
+    PendingCount_.fetch_sub(count, std::memory_order_relaxed);
+
+    while (pending) {
+        std::array<std::unique_ptr<PendingMedia>, SendBatchSize> batch;
+        size_t size = 0;
+        while (pending && size < batch.size()) {
+            batch[size++].reset(pending);
+            pending = pending->Next;
+        }
+        SendBatch(std::span(batch.data(), size));
+    }
+}
+
+void Trunk::SendControl(std::span<const std::byte> header) {
+    // Queued media goes first, so e.g. a Leave doesn't overtake the
+    // publisher's last packets.
+    if (FlushInterval_.count() > 0) {
+        Flush();
+    }
+    Send(header);
+}
+
+void Trunk::SendSubscribe(RoomId roomId) {
+    std::array<std::byte, HeaderSize> header;
+    WriteHeader(header.data(), RelayMessageType::Subscribe, roomId, 0);
+    SendControl(header);
+}
+
+void Trunk::SendAnnounce(RoomId roomId, ClientId publisherId, const RelaySourceInfo& source) {
+    std::array<std::byte, HeaderSize> header;
+    auto out = WriteHeader(header.data(), RelayMessageType::Announce, roomId, publisherId);
+    Write(out, source.AudioLevelExtensionId);
+    Write(out, source.LayerCount);
+    Write(out, static_cast<uint8_t>(source.VideoActive));
+    SendControl(header);
+}
+
+void Trunk::SendLeave(RoomId roomId, ClientId publisherId) {
+    std::array<std::byte, HeaderSize> header;
+    WriteHeader(header.data(), RelayMessageType::Leave, roomId, publisherId);
+    SendControl(header);
+}
+
+void Trunk::SendKeyframeRequest(RoomId roomId, ClientId publisherId, KeyframeArbiter::LayerMask layers) {
+    std::array<std::byte, HeaderSize> header;
+    auto out = WriteHeader(header.data(), RelayMessageType::Keyframe, roomId, publisherId);
+    Write(out, layers);
+    SendControl(header);
+}
+
+void Trunk::Send(std::span<const std::byte> header, std::span<const std::byte> body) {
+    // Header and packet are gathered by the kernel, the packet isn't copied.
+    std::array<iovec, 2> parts = {{
+        {const_cast<std::byte*>(header.data()), header.size()},
+        {const_cast<std::byte*>(body.data()), body.size()},
+    }};
+
+    msghdr message{};
+    message.msg_name = const_cast<sockaddr_in*>(&Address_);
+    message.msg_namelen = sizeof(Address_);
+    message.msg_iov = parts.data();
+    message.msg_iovlen = body.empty() ? 1 : 2;
+
+    // Like any UDP media, a datagram the kernel can't take is simply lost.
+    sendmsg(Socket_, &message, MSG_DONTWAIT);
+}
+
+void Trunk::SendBatch(std::span<const std::unique_ptr<PendingMedia>> batch) {
+    std::array<std::array<iovec, 2>, SendBatchSize> parts;
+    std::array<mmsghdr, SendBatchSize> messages;
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+        auto body = batch[i]->Packet.Data();
+        parts[i] = {{
+            {const_cast<std::byte*>(batch[i]->Header.data()), batch[i]->Header.size()},
+            {const_cast<std::byte*>(body.data()), body.size()},
+        }};
+        messages[i] = {};
+        messages[i].msg_hdr.msg_name = const_cast<sockaddr_in*>(&Address_);
+        messages[i].msg_hdr.msg_namelen = sizeof(Address_);
+        messages[i].msg_hdr.msg_iov = parts[i].data();
+        messages[i].msg_hdr.msg_iovlen = parts[i].size();
+    }
+
+    // sendmmsg stops at the first datagram that fails. A full socket buffer
+    // won't drain while we retry, so the rest of the batch is lost with it;
+    // any other error only loses that one datagram.
+    size_t sent = 0;
+    while (sent < batch.size()) {
+        auto result = sendmmsg(Socket_, messages.data() + sent, batch.size() - sent, MSG_DONTWAIT);
+        if (result >= 0) {
+            sent += result;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            ++sent;
+        }
+    }
+}
+
+Relay::Relay(uint16_t port, const std::vector<std::string>& peers, std::chrono::microseconds flushInterval)
+    : Sources_(std::make_shared<const SourceMap>())
+{
+    if (flushInterval.count() < 0 || (flushInterval.count() > 0 && flushInterval < FlushTimer::MinInterval)) {
+        throw std::runtime_error("Relay flush interval must be 0 or at least " + std::to_string(FlushTimer::MinInterval.count()) + " us");
+    }
+
+    Socket_ = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (Socket_ < 0) {
+        throw std::runtime_error("Can't create relay socket");
+    }
+
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_ANY);
+    address.sin_port = htons(port);
+    if (bind(Socket_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        close(Socket_);
+        throw std::runtime_error("Can't bind relay socket to port " + std::to_string(port));
+    }
+
+    if (flushInterval.count() > 0) {
+        FlushTimer_ = std::make_shared<FlushTimer>();
+    }
+    for (const auto& peer : peers) {
+        Trunks_.push_back(std::make_shared<Trunk>(Socket_, ResolvePeer(peer), flushInterval, FlushTimer_));
+    }
+}
+
+Relay::~Relay() {
+    // Stops the flushes before the socket they send on is closed.
+    FlushTimer_.reset();
+    shutdown(Socket_, SHUT_RDWR);
+    if (Thread_.joinable()) {
+        Thread_.join();
+    }
+    close(Socket_);
+}
+
+void Relay::Start(MessageCallback onMessage) {
+    OnMessage_ = std::move(onMessage);
+    Thread_ = std::thread(&Relay::Receive, this);
+}
+
+void Relay::AddSource(RoomId roomId, ClientId publisherId, std::shared_ptr<Participant> source) {
+    std::lock_guard<std::mutex> lock(SourcesMutex_);
+    auto sources = std::make_shared<SourceMap>(*Sources_.load());
+    (*sources)[{roomId, publisherId}] = std::move(source);
+    Sources_.store(std::move(sources), std::memory_order_release);
+}
+
+void Relay::RemoveSource(RoomId roomId, ClientId publisherId) {
+    std::lock_guard<std::mutex> lock(SourcesMutex_);
+    auto sources = std::make_shared<SourceMap>(*Sources_.load());
+    sources->erase({roomId, publisherId});
+    Sources_.store(std::move(sources), std::memory_order_release);
+}
+
+std::shared_ptr<Trunk> Relay::FindTrunk(const sockaddr_in& address) const {
+    for (const auto& trunk : Trunks_) {
+        if (SameAddress(trunk->GetAddress(), address)) {
+            return trunk;
+        }
+    }
+    return nullptr;
+}
+
+void Relay::Receive() {
+    // Each datagram lands in its own buffer so forwarding can take the RTP
+    // packet over; only the buffers handed off are replaced between batches.
+    std::array<std::array<std::byte, HeaderSize>, ReceiveBatchSize> headers;
+    std::array<rtc::binary, ReceiveBatchSize> bodies;
+    std::array<std::array<iovec, 2>, ReceiveBatchSize> parts;
+    std::array<sockaddr_in, ReceiveBatchSize> senders;
+    std::array<mmsghdr, ReceiveBatchSize> messages;
+
+    while (true) {
+        for (size_t i = 0; i < ReceiveBatchSize; ++i) {
+            bodies[i].resize(MaxDatagramSize);
+            parts[i] = {{
+                {headers[i].data(), headers[i].size()},
+                {bodies[i].data(), bodies[i].size()},
+            }};
+            messages[i] = {};
+            messages[i].msg_hdr.msg_name = &senders[i];
+            messages[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+            messages[i].msg_hdr.msg_iov = parts[i].data();
+            messages[i].msg_hdr.msg_iovlen = parts[i].size();
+        }
+
+        // Blocks for the first datagram, then takes whatever else is queued.
+        auto count = recvmmsg(Socket_, messages.data(), ReceiveBatchSize, MSG_WAITFORONE, nullptr);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        for (int i = 0; i < count; ++i) {
+            const auto& message = messages[i];
+            if (message.msg_len == 0 && message.msg_hdr.msg_namelen == 0) {
+                // Woken up by shutdown().
+                return;
+            }
+            Dispatch(senders[i], headers[i].data(), bodies[i], message.msg_len);
+        }
+    }
+}
+
+void Relay::Dispatch(const sockaddr_in& from, const std::byte* header, rtc::binary& body, size_t received) {
+    if (received < HeaderSize) {
+        return;
+    }
+
+    auto trunk = FindTrunk(from);
+    if (!trunk) {
+        LOG_WARNING() << "Relay datagram from unknown peer " << inet_ntoa(from.sin_addr);
+        return;
+    }
+
+    const std::byte* in = header;
+    RelayMessage relayMessage;
+    relayMessage.Type = static_cast<RelayMessageType>(Read<uint8_t>(in));
+    relayMessage.Room = Read<RoomId>(in);
+    relayMessage.Publisher = Read<ClientId>(in);
+
+    switch (relayMessage.Type) {
+        case RelayMessageType::Media: {
+            auto kind = Read<uint8_t>(in);
+            auto layer = Read<uint8_t>(in);
+            body.resize(received - HeaderSize);
+
+            auto sources = Sources_.load(std::memory_order_acquire);
+            if (auto it = sources->find({relayMessage.Room, relayMessage.Publisher}); it != sources->end()) {
+                it->second->Inject(kind, layer, RtpPacket(std::move(body)));
+            }
+            break;
+        }
+        case RelayMessageType::Announce:
+            relayMessage.Source.AudioLevelExtensionId = Read<uint8_t>(in);
+            relayMessage.Source.LayerCount = Read<uint8_t>(in);
+            relayMessage.Source.VideoActive = Read<uint8_t>(in) != 0;
+            OnMessage_(trunk, relayMessage);
+            break;
+        case RelayMessageType::Keyframe:
+            relayMessage.Layers = Read<KeyframeArbiter::LayerMask>(in);
+            OnMessage_(trunk, relayMessage);
+            break;
+        case RelayMessageType::Subscribe:
+        case RelayMessageType::Leave:
+            OnMessage_(trunk, relayMessage);
+            break;
+        default:
+            break;
+    }
+}
+
+} // namespace sfu
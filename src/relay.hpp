@@ -0,0 +1,193 @@
+#pragma once
+
+#include "fanout.hpp"
+#include "keyframe.hpp"
+
+#include <netinet/in.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace sfu {
+
+class Participant;
+
+using ClientId = uint64_t;
+using RoomId = uint64_t;
+
+// Relay between sfu_server nodes sharing rooms. Every pair of nodes talks
+// over one UDP trunk, and each published packet crosses it once however
+// many subscribers the room has on the far side.
+//
+// A datagram is a 21-byte header: type, room id, publisher id and four
+// bytes of fields depending on the type, followed for media by the RTP packet.
+//   Media      kind (0 audio, 1 video) and simulcast layer
+//   Subscribe  none: the sender has clients in the room
+//   Announce   audio level extension id, layer count and video state of a
+//              local publisher of a room the receiver subscribed to
+//   Leave      none: the publisher is gone
+//   Keyframe   layer mask: the sender's subscribers need a key frame
+// Subscribe and Announce are soft state, repeated every RefreshInterval and
+// forgotten after ExpiryInterval, so a lost datagram only delays things.
+enum class RelayMessageType : uint8_t {
+    Media = 1,
+    Subscribe = 2,
+    Announce = 3,
+    Leave = 4,
+    Keyframe = 5,
+};
+
+// What a remote node needs to know to forward a publisher's media.
+struct RelaySourceInfo {
+    uint8_t AudioLevelExtensionId = 0;
+    uint8_t LayerCount = 1;
+    bool VideoActive = false;
+};
+
+struct RelayMessage {
+    RelayMessageType Type;
+    RoomId Room;
+    ClientId Publisher;
+    RelaySourceInfo Source;
+    KeyframeArbiter::LayerMask Layers = 0;
+};
+
+// Type, room id, publisher id and four bytes of fields depending on the type.
+constexpr size_t RelayHeaderSize = 1 + 8 + 8 + 4;
+
+class Trunk;
+
+// Flushes a trunk once the first packet of its batch has waited the flush
+// interval. The thread sleeps while no batch is open and runs with the
+// smallest timer slack, so deadlines of a few hundred microseconds hold.
+class FlushTimer {
+public:
+    // Shorter intervals are below what a thread wake-up reliably honours.
+    static constexpr auto MinInterval = std::chrono::microseconds(50);
+
+    FlushTimer();
+    ~FlushTimer();
+
+    void Arm(std::weak_ptr<Trunk> trunk, std::chrono::microseconds delay);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void Run();
+
+    std::mutex Mutex_;
+    std::condition_variable Wake_;
+    // Every trunk waits the same interval, so deadlines are armed in order.
+    std::deque<std::pair<Clock::time_point, std::weak_ptr<Trunk>>> Due_;
+    bool Stopped_ = false;
+    std::thread Thread_;
+};
+
+// Sending side of the trunk to one peer node. Safe to use from any thread.
+// When batched, media is queued and leaves in one sendmmsg call once
+// SendBatchSize packets are waiting, or when the flush timer the first
+// packet of a batch arms fires. Other messages send the queue first so they
+// never overtake media.
+class Trunk : public std::enable_shared_from_this<Trunk> {
+public:
+    static constexpr size_t SendBatchSize = 64;
+
+    // Zero flushInterval sends every packet on its own.
+    Trunk(int socket, const sockaddr_in& address, std::chrono::microseconds flushInterval, std::weak_ptr<FlushTimer> flushTimer);
+    ~Trunk();
+
+    void SendMedia(RoomId roomId, ClientId publisherId, size_t kind, int layer, const RtpPacket& packet);
+    void SendSubscribe(RoomId roomId);
+    void SendAnnounce(RoomId roomId, ClientId publisherId, const RelaySourceInfo& source);
+    void SendLeave(RoomId roomId, ClientId publisherId);
+    void SendKeyframeRequest(RoomId roomId, ClientId publisherId, KeyframeArbiter::LayerMask layers);
+
+    const sockaddr_in& GetAddress() const {
+        return Address_;
+    }
+
+    // Sends the queued media.
+    void Flush();
+
+private:
+    // Node of the lock-free queue, pushed by the media threads.
+    struct PendingMedia {
+        std::array<std::byte, RelayHeaderSize> Header;
+        RtpPacket Packet;
+        PendingMedia* Next = nullptr;
+    };
+
+    void Send(std::span<const std::byte> header, std::span<const std::byte> body = {});
+    void SendControl(std::span<const std::byte> header);
+    void SendBatch(std::span<const std::unique_ptr<PendingMedia>> batch);
+
+    const int Socket_;
+    const sockaddr_in Address_;
+    const std::chrono::microseconds FlushInterval_;
+    const std::weak_ptr<FlushTimer> FlushTimer_;
+
+    // Newest packet first, like the loop's task stack.
+    std::atomic<PendingMedia*> Pending_ = nullptr;
+    std::atomic<int64_t> PendingCount_ = 0;
+};
+
+// The node's trunk socket and its peers. Media from peers is forwarded
+// straight from the receiving thread to the registered remote sources;
+// everything else is handed to the message callback.
+class Relay {
+public:
+    static constexpr auto RefreshInterval = std::chrono::seconds(1);
+    static constexpr auto ExpiryInterval = std::chrono::seconds(3);
+
+    using MessageCallback = std::function<void(const std::shared_ptr<Trunk>& trunk, const RelayMessage& message)>;
+
+    // Peers are "host:port" of the other nodes' relay sockets. Media waits
+    // at most flushInterval to be sent in a batch; zero sends every packet
+    // on its own, and a shorter one than FlushTimer::MinInterval is refused.
+    Relay(uint16_t port, const std::vector<std::string>& peers, std::chrono::microseconds flushInterval);
+    ~Relay();
+
+    void Start(MessageCallback onMessage);
+
+    const std::vector<std::shared_ptr<Trunk>>& GetTrunks() const {
+        return Trunks_;
+    }
+
+    // Publishers on other nodes, fed with the media their trunk delivers.
+    void AddSource(RoomId roomId, ClientId publisherId, std::shared_ptr<Participant> source);
+    void RemoveSource(RoomId roomId, ClientId publisherId);
+
+private:
+    using SourceMap = std::map<std::pair<RoomId, ClientId>, std::shared_ptr<Participant>>;
+
+    void Receive();
+    // Handles one received datagram; the body may be taken over.
+    void Dispatch(const sockaddr_in& from, const std::byte* header, rtc::binary& body, size_t received);
+    std::shared_ptr<Trunk> FindTrunk(const sockaddr_in& address) const;
+
+    int Socket_ = -1;
+    std::shared_ptr<FlushTimer> FlushTimer_;
+    std::vector<std::shared_ptr<Trunk>> Trunks_;
+    MessageCallback OnMessage_;
+    std::thread Thread_;
+
+    // Written from the shard loops under the mutex, read by the receiving
+    // thread as a snapshot.
+    std::mutex SourcesMutex_;
+    std::atomic<std::shared_ptr<const SourceMap>> Sources_;
+};
+
+} // namespace sfu
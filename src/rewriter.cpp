@@ -0,0 +1,42 @@
+#include "rewriter.hpp"
+
+#include <algorithm>
+
+namespace sfu {
+
+std::pair<uint16_t, uint32_t> RtpRewriter::Rewrite(const rtc::RtpHeader* header, Clock::time_point now) {
+    auto ssrc = header->ssrc();
+    auto seq = header->seqNumber();
+    auto timestamp = header->timestamp();
+
+    if (!Started_) {
+        Started_ = true;
+        Source_ = ssrc;
+        LastSeq_ = seq - 1;
+        LastTimestamp_ = timestamp;
+        LastTime_ = now;
+    } else if (ssrc != Source_ || SourceChanged_) {
+        // Continue right after the last packet sent, advancing the timestamp
+        // by the wall-clock time since then.
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(now - LastTime_).count();
+        auto ticks = std::max<int64_t>(1, elapsed * ClockRate_ / 1000000);
+
+        Source_ = ssrc;
+        SourceChanged_ = false;
+        SeqOffset_ = static_cast<uint16_t>(LastSeq_ + 1 - seq);
+        TimestampOffset_ = static_cast<uint32_t>(LastTimestamp_ + ticks - timestamp);
+    }
+
+    uint16_t outSeq = seq + SeqOffset_;
+    uint32_t outTimestamp = timestamp + TimestampOffset_;
+
+    if (static_cast<int16_t>(outSeq - LastSeq_) > 0) {
+        LastSeq_ = outSeq;
+        LastTimestamp_ = outTimestamp;
+        LastTime_ = now;
+    }
+
+    return {outSeq, outTimestamp};
+}
+
+} // namespace sfu
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <rtc/rtc.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+namespace sfu {
+
+constexpr uint32_t AudioClockRate = 48000;
+constexpr uint32_t VideoClockRate = 90000;
+
+// Keeps sequence numbers and timestamps of one outgoing stream continuous
+// while the packets feeding it switch between source streams (simulcast
+// layers, or publishers bound to a shared slot). Not thread-safe: used from
+// the media thread of the stream's current source.
+class RtpRewriter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit RtpRewriter(uint32_t clockRate)
+        : ClockRate_(clockRate)
+    { }
+
+    // Returns the sequence number and timestamp to send the packet with.
+    std::pair<uint16_t, uint32_t> Rewrite(const rtc::RtpHeader* header, Clock::time_point now);
+
+    // The next packet continues the stream even if it has the same SSRC as
+    // the previous source.
+    void Reset() {
+        SourceChanged_ = true;
+    }
+
+    uint32_t ClockRate() const {
+        return ClockRate_;
+    }
+
+    bool IsStarted() const {
+        return Started_;
+    }
+
+    uint16_t LastSeqNumber() const {
+        return LastSeq_;
+    }
+
+    // Maps an outgoing sequence number back to the current source's.
+    uint16_t ToSourceSeqNumber(uint16_t seqNumber) const {
+        return static_cast<uint16_t>(seqNumber - SeqOffset_);
+    }
+
+private:
+    const uint32_t ClockRate_;
+
+    bool Started_ = false;
+    bool SourceChanged_ = false;
+    rtc::SSRC Source_ = 0;
+
+    uint16_t SeqOffset_ = 0;
+    uint32_t TimestampOffset_ = 0;
+
+    uint16_t LastSeq_ = 0;
+    uint32_t LastTimestamp_ = 0;
+    Clock::time_point LastTime_;
+};
+
+} // namespace sfu
@@ -1,11 +1,14 @@
 #include "room.hpp"
 
+#include "log.hpp"
 #include "loop.hpp"
 #include "participant.hpp"
 #include "rtc/peerconnection.hpp"
 
 #include <rtc/description.hpp>
 #include <rtc/rtc.hpp>
+
+#include <algorithm>
 #include <stdexcept>
 #include <thread>
 
@@ -13,60 +16,238 @@ namespace sfu {
 
 void Room::AddParticipant(ClientId newClientId, const std::shared_ptr<Participant>& participant) {
     Participants_[newClientId] = participant;
+    const auto& negotiator = participant->GetNegotiator();
+
+    for (auto [id, other] : Publishers_) {
+        LOG_DEBUG(.Client = newClientId) << "Subscribing to participant " << id;
+        other->AddRemoteTracks(newClientId, negotiator->Acquire(), participant->GetBandwidth());
+    }
+
+    // Spare tracks go out with the first offer so later joins need none.
+    negotiator->Reserve();
+
+    if (!RelayTargets_.empty()) {
+        participant->SetRelayTargets(RelayRoom_, RelayTargets_);
+    }
+}
+
+void Room::AddRemoteParticipant(ClientId clientId, const std::shared_ptr<Participant>& participant) {
+    Participants_[clientId] = participant;
+    Publishers_[clientId] = participant;
 
     for (auto [id, other] : Participants_) {
-        if (id == newClientId) {
+        if (id == clientId || other->IsRemote()) {
             continue;
         }
 
-        std::cout << "Adding existing track from participant " << id << " to participant " << newClientId << std::endl;
+        LOG_DEBUG(.Client = id) << "Subscribing to remote participant " << clientId;
+        participant->AddRemoteTracks(id, other->GetNegotiator()->Acquire(), other->GetBandwidth());
+    }
+}
+
+bool Room::HasLocalParticipants() const {
+    return std::any_of(Participants_.begin(), Participants_.end(), [](const auto& entry) {
+        return !entry.second->IsRemote();
+    });
+}
 
-        rtc::Description::Audio audioDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
-        audioDescr.addSSRC(GetUniqueId(), "audio", std::to_string(GetUniqueId()) + "audio");
-        audioDescr.addOpusCodec(109);
-        auto remoteAudioTrack = participant->GetConnection()->addTrack(audioDescr);
-    
-        rtc::Description::Video videoDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
-        videoDescr.addSSRC(GetUniqueId(), "video", std::to_string(GetUniqueId()) + "video");
-        videoDescr.addVP8Codec(120);
-        videoDescr.setBitrate(3000);
-        auto remoteVideoTrack = participant->GetConnection()->addTrack(videoDescr);
+std::array<TrafficTotals, 2> Room::GetTraffic() const {
+    auto totals = DepartedTraffic_;
+    for (const auto& [id, participant] : Participants_) {
+        for (size_t kind = 0; kind < totals.size(); ++kind) {
+            totals[kind].Add(participant->GetTraffic(kind));
+        }
+    }
+    return totals;
+}
 
-        other->AddRemoteTracks(newClientId, {remoteAudioTrack, remoteVideoTrack});
+void Room::SetRelayTargets(RoomId roomId, std::vector<std::shared_ptr<Trunk>> trunks) {
+    if (RelayRoom_ == roomId && RelayTargets_ == trunks) {
+        return;
     }
 
-    participant->GetConnection()->setLocalDescription(rtc::Description::Type::Offer);
+    RelayRoom_ = roomId;
+    RelayTargets_ = std::move(trunks);
+    for (auto& [id, participant] : Participants_) {
+        if (!participant->IsRemote()) {
+            participant->SetRelayTargets(RelayRoom_, RelayTargets_);
+        }
+    }
 }
 
 void Room::HandleTracksForParticipant(ClientId clientId, const std::array<std::shared_ptr<rtc::Track>, 2> tracks) {
     auto& participant = Participants_.at(clientId);
+    if (!Publishers_.emplace(clientId, participant).second) {
+        return;
+    }
 
     participant->SetTracks(tracks);
     for (auto [id, other] : Participants_) {
-        if (id == clientId) {
+        if (id == clientId || other->IsRemote()) {
             continue;
         }
 
-        std::cout << "Adding tracks from participant " << clientId << " to participant " << id << std::endl;
+        LOG_DEBUG(.Client = id) << "Subscribing to participant " << clientId;
+        participant->AddRemoteTracks(id, other->GetNegotiator()->Acquire(), other->GetBandwidth());
+    }
+}
+
+void Room::StopPublishing(ClientId clientId) {
+    auto it = Publishers_.find(clientId);
+    if (it == Publishers_.end()) {
+        return;
+    }
+
+    auto participant = std::move(it->second);
+    Publishers_.erase(it);
+
+    for (auto& [id, tracks] : participant->StopPublishing()) {
+        if (auto subscriber = Participants_.find(id); subscriber != Participants_.end()) {
+            subscriber->second->GetNegotiator()->Release(std::move(tracks));
+        }
+    }
+
+    for (auto& [id, other] : Participants_) {
+        for (auto& slot : other->GetAudioSlots()) {
+            if (slot.Publisher == clientId) {
+                slot.Publisher.reset();
+            }
+        }
+        for (auto& slot : other->GetVideoSlots()) {
+            if (slot.Publisher == clientId) {
+                slot.Publisher.reset();
+            }
+        }
+    }
+}
+
+bool Room::SetVideoSlot(ClientId subscriberId, size_t index, std::optional<ClientId> publisherId) {
+    auto subscriber = Participants_.find(subscriberId);
+    if (subscriber == Participants_.end()) {
+        return false;
+    }
+
+    auto& slots = subscriber->second->GetVideoSlots();
+    if (index >= slots.size()) {
+        return false;
+    }
+    if (publisherId && (*publisherId == subscriberId || !Publishers_.contains(*publisherId))) {
+        return false;
+    }
+
+    auto& slot = slots[index];
+    if (slot.Publisher == publisherId) {
+        return true;
+    }
+
+    // A publisher feeds one slot per subscriber; picking it again moves it.
+    if (publisherId) {
+        for (auto& other : slots) {
+            if (other.Publisher == publisherId) {
+                other.Publisher.reset();
+            }
+        }
+    }
+
+    if (slot.Publisher) {
+        if (auto it = Publishers_.find(*slot.Publisher); it != Publishers_.end()) {
+            it->second->SetVideoSlot(subscriberId, nullptr);
+        }
+    }
+
+    slot.Publisher = publisherId;
+    if (publisherId) {
+        LOG_DEBUG(.Client = subscriberId) << "Receiving participant " << *publisherId << " on video slot " << index;
+        Publishers_.at(*publisherId)->SetVideoSlot(subscriberId, slot.Target);
+    }
+    return true;
+}
+
+bool Room::SetVideoLayer(ClientId subscriberId, rtc::SSRC ssrc, int layer) {
+    for (auto& [id, publisher] : Publishers_) {
+        if (auto target = publisher->GetVideoTarget(subscriberId); target && target->Ssrc == ssrc) {
+            if (layer < LayerSelector::Highest || layer >= static_cast<int>(publisher->GetVideoLayerCount())) {
+                LOG_WARNING(.Client = subscriberId) << "Participant " << id << " has no video layer " << layer;
+                return true;
+            }
+
+            LOG_DEBUG(.Client = subscriberId) << "Selecting layer " << layer << " of participant " << id;
+            return publisher->SetVideoLayer(subscriberId, layer);
+        }
+    }
+
+    return false;
+}
+
+bool Room::SetVideoRendered(ClientId subscriberId, rtc::SSRC ssrc, bool rendered) {
+    for (auto& [id, publisher] : Publishers_) {
+        if (auto target = publisher->GetVideoTarget(subscriberId); target && target->Ssrc == ssrc) {
+            LOG_DEBUG(.Client = subscriberId) << (rendered ? "Rendering" : "Hiding") << " video of participant " << id;
+            return publisher->SetVideoRendered(subscriberId, rendered);
+        }
+    }
+
+    return false;
+}
+
+bool Room::UpdateSpeakers() {
+    auto now = AudioLevelMeter::Clock::now();
+
+    std::vector<std::pair<ClientId, uint32_t>> loudness;
+    loudness.reserve(Publishers_.size());
+    for (const auto& [id, participant] : Publishers_) {
+        loudness.emplace_back(id, participant->GetLoudness(now));
+    }
+    bool changed = Speakers_.Update(std::move(loudness));
+
+    for (const auto& [id, participant] : Participants_) {
+        AssignAudioSlots(id, *participant);
+    }
+    return changed;
+}
 
-        rtc::Description::Audio audioDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
-        audioDescr.addSSRC(GetUniqueId(), "audio", std::to_string(GetUniqueId()) + "audio");
-        audioDescr.addOpusCodec(109);
-        auto remoteAudioTrack = other->GetConnection()->addTrack(audioDescr);
-    
-        rtc::Description::Video videoDescr(std::to_string(GetUniqueId()), rtc::Description::Direction::SendOnly);
-        videoDescr.addSSRC(GetUniqueId(), "video", std::to_string(GetUniqueId()) + "video");
-        videoDescr.addVP8Codec(120);
-        videoDescr.setBitrate(3000);
-        auto remoteVideoTrack = other->GetConnection()->addTrack(videoDescr);
+void Room::AssignAudioSlots(ClientId subscriberId, Participant& subscriber) {
+    auto& slots = subscriber.GetAudioSlots();
+    if (slots.empty()) {
+        return;
+    }
 
-        other->GetConnection()->setLocalDescription(rtc::Description::Type::Offer);
+    // The loudest speakers other than the subscriber itself.
+    std::vector<ClientId> top;
+    for (auto id : Speakers_.GetSpeakers()) {
+        if (id != subscriberId && top.size() < slots.size()) {
+            top.push_back(id);
+        }
+    }
 
-        participant->AddRemoteTracks(id, {remoteAudioTrack, remoteVideoTrack});
+    auto missing = top;
+    for (const auto& slot : slots) {
+        if (slot.Publisher) {
+            std::erase(missing, *slot.Publisher);
+        }
     }
 
-    for (auto [id, participant] : Participants_) {
-        participant->GetTracks()[1]->requestKeyframe();
+    // Slots are sticky: a speaker that went quiet keeps its slot until
+    // someone else needs it, and empty slots are used first.
+    for (int pass = 0; pass < 2 && !missing.empty(); ++pass) {
+        for (auto& slot : slots) {
+            if (missing.empty()) {
+                break;
+            }
+            if (pass == 0 ? slot.Publisher.has_value() : std::find(top.begin(), top.end(), *slot.Publisher) != top.end()) {
+                continue;
+            }
+
+            if (slot.Publisher) {
+                if (auto it = Participants_.find(*slot.Publisher); it != Participants_.end()) {
+                    it->second->SetAudioSlot(subscriberId, nullptr);
+                }
+            }
+
+            slot.Publisher = missing.front();
+            missing.erase(missing.begin());
+            Participants_.at(*slot.Publisher)->SetAudioSlot(subscriberId, slot.Target);
+        }
     }
 }
 
@@ -75,22 +256,33 @@ void Room::RemoveParticipant(ClientId clientId) {
         return;
     }
 
-    std::cout << "Removing participant " << clientId << " from the room" << std::endl;
-    Participants_[clientId]->CloseRemoteTracks();
+    LOG_INFO(.Client = clientId) << "Leaving room";
+    auto participant = Participants_.at(clientId);
 
-    for (auto& [id, other] : Participants_) {
-        if (id == clientId) {
-            continue;
+    for (auto& track : participant->GetTracks()) {
+        if (track) {
+            track->close();
         }
+    }
+    // The subscribers keep its negotiated tracks for the next publisher.
+    StopPublishing(clientId);
 
-        std::cout << "Removing track from " << id << " to " << clientId << std::endl;
+    for (auto& [id, publisher] : Publishers_) {
+        LOG_DEBUG(.Client = clientId) << "Unsubscribing from participant " << id;
 
-        other->RemoveRemoteTracks(clientId);
-        other->GetConnection()->setLocalDescription(rtc::Description::Type::Offer);
+        if (auto closed = publisher->RemoveRemoteTracks(clientId)) {
+            for (auto& track : *closed) {
+                if (track) {
+                    track->close();
+                }
+            }
+        }
+        publisher->SetAudioSlot(clientId, nullptr);
+        publisher->SetVideoSlot(clientId, nullptr);
     }
 
-    for (auto& track : Participants_.at(clientId)->GetTracks()) {
-        track->close();
+    for (size_t kind = 0; kind < DepartedTraffic_.size(); ++kind) {
+        DepartedTraffic_[kind].Add(participant->GetTraffic(kind));
     }
     Participants_.erase(clientId);
 }
@@ -2,24 +2,35 @@
 
 #include "fwd.hpp"
 #include "participant.hpp"
+#include "speaker.hpp"
 
 #include <rtc/description.hpp>
 
+#include <array>
 #include <memory>
+#include <optional>
 #include <unordered_map>
 #include <span>
+#include <vector>
 
 namespace sfu {
 
 class Loop;
 
 using ClientId = uint64_t;
+using RoomId = uint64_t;
 
+// Every participant subscribes to the room's publishers, but only speakers
+// publish: joins and leaves of the audience only touch the publishers.
 class Room {
 public:
     Room() = default;
 
+    // Subscribes the participant to the publishers. It publishes nothing
+    // until HandleTracksForParticipant.
     void AddParticipant(ClientId clientId, const std::shared_ptr<Participant>& participant);
+    // Adds a publisher of another node, which only sends to local subscribers.
+    void AddRemoteParticipant(ClientId clientId, const std::shared_ptr<Participant>& participant);
     void RemoveParticipant(ClientId clientId);
 
     bool HasParticipant(ClientId clientId) {
@@ -28,17 +39,63 @@ public:
 
     const auto& GetParticipants() {
         return Participants_;
-    } 
+    }
+
+    // Local speakers and publishers of other nodes.
+    const auto& GetPublishers() {
+        return Publishers_;
+    }
+
+    bool IsPublishing(ClientId clientId) const {
+        return Publishers_.contains(clientId);
+    }
 
+    bool HasLocalParticipants() const;
+
+    // Traffic of the room's publishers per track kind, including those that
+    // already left, so the totals never go down.
+    std::array<TrafficTotals, 2> GetTraffic() const;
+
+    // Other nodes with clients in this room; local publishers relay to them.
+    void SetRelayTargets(RoomId roomId, std::vector<std::shared_ptr<Trunk>> trunks);
+
+    // Makes the participant a publisher and subscribes everyone else to it.
     void HandleTracksForParticipant(ClientId clientId, const std::array<std::shared_ptr<rtc::Track>, 2> tracks);
 
-private:
-    uint64_t GetUniqueId() {
-        return UniqueIdGenerator_++;
+    // Demotes a publisher to the audience. Its subscribers keep their
+    // tracks for the next publisher and nobody renegotiates.
+    void StopPublishing(ClientId clientId);
+
+    // Selects the simulcast layer of the video the subscriber receives as the given SSRC.
+    // False if there is no such video; a layer that isn't published keeps
+    // the current selection.
+    bool SetVideoLayer(ClientId subscriberId, rtc::SSRC ssrc, int layer);
+
+    // Starts or stops forwarding the video the subscriber receives as the given SSRC.
+    bool SetVideoRendered(ClientId subscriberId, rtc::SSRC ssrc, bool rendered);
+
+    // Feeds the subscriber's video slot from a publisher, or leaves it
+    // empty. The subscriber's PeerConnection is not renegotiated.
+    bool SetVideoSlot(ClientId subscriberId, size_t index, std::optional<ClientId> publisherId);
+
+    // Re-ranks the active speakers and moves every subscriber's audio slots
+    // to the loudest ones. True if the ranking changed.
+    bool UpdateSpeakers();
+
+    const std::vector<ClientId>& GetSpeakers() const {
+        return Speakers_.GetSpeakers();
     }
 
-    std::atomic<uint64_t> UniqueIdGenerator_ = 150;
+private:
+    void AssignAudioSlots(ClientId subscriberId, Participant& subscriber);
+
     std::unordered_map<ClientId, std::shared_ptr<Participant>> Participants_;
+    std::unordered_map<ClientId, std::shared_ptr<Participant>> Publishers_;
+    SpeakerRanking Speakers_;
+    std::array<TrafficTotals, 2> DepartedTraffic_;
+
+    RoomId RelayRoom_ = 0;
+    std::vector<std::shared_ptr<Trunk>> RelayTargets_;
 };
 
 } // namespace sfu
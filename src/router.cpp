@@ -1,9 +1,12 @@
 #include "router.hpp"
 
+#include "auth.hpp"
+#include "client.hpp"
+#include "log.hpp"
 #include "loop.hpp"
 #include "participant.hpp"
+#include "signaling.hpp"
 #include "rtc/rtpdepacketizer.hpp"
-#include "utils.hpp"
 
 #include <rtc/description.hpp>
 #include <rtc/rtc.hpp>
@@ -12,6 +15,7 @@
 
 #include <nlohmann/json.hpp>
 
+#include <future>
 #include <memory>
 #include <stdexcept>
 #include <thread>
@@ -19,17 +23,6 @@
 
 namespace sfu {
 
-struct Client {
-    std::optional<ClientId> clientId;
-    std::optional<RoomId> roomId;
-    std::shared_ptr<rtc::WebSocket> ws;
-    std::shared_ptr<rtc::PeerConnection> pc;
-    std::string ErrorMessage;
-    bool IsVideoActive = false;
-
-    std::array<std::shared_ptr<rtc::Track>, 2> Tracks;
-};
-
 namespace {
 
 constexpr std::string_view AUDIO = "0";
@@ -37,141 +30,617 @@ constexpr std::string_view VIDEO = "1";
 
 using json = nlohmann::json;
 
-std::optional<std::tuple<uint64_t, uint64_t>> ValidateOffer(const json& offer, std::shared_ptr<Client> client, const std::string& publicKey) {
-    if (!offer.contains("token")) {
-        client->ErrorMessage = "Offer doesn't contain token";
-        return {};
+constexpr auto KeyReloadInterval = std::chrono::seconds(10);
+constexpr auto SpeakerUpdateInterval = std::chrono::milliseconds(300);
+constexpr auto MetricsCollectTimeout = std::chrono::seconds(1);
+
+std::string PeerConnectionStateName(rtc::PeerConnection::State state) {
+    switch (state) {
+        case rtc::PeerConnection::State::New: return "new";
+        case rtc::PeerConnection::State::Connecting: return "connecting";
+        case rtc::PeerConnection::State::Connected: return "connected";
+        case rtc::PeerConnection::State::Disconnected: return "disconnected";
+        case rtc::PeerConnection::State::Failed: return "failed";
+        case rtc::PeerConnection::State::Closed: return "closed";
     }
+    return "unknown";
+}
 
-    try {
-        auto decoded = jwt::decode(offer.at("token"));
+std::string RoleName(ParticipantRole role) {
+    return role == ParticipantRole::Speaker ? "speaker" : "audience";
+}
+
+constexpr std::string_view ResumeFailedMessage = R"({"type":"resumeFailed"})";
 
-        auto verifier = jwt::verify()
-            .allow_algorithm(jwt::algorithm::rs256(publicKey, "", "", ""));
+} // namespace
 
-        verifier.verify(decoded);
+Router::Router(const Config& config)
+    : Config_(config)
+    , TokenVerifier_(config.PublicKeyPath, config.TokenCacheSize)
+{
+    if (!TokenVerifier_.Reload()) {
+        LOG_ERROR() << "Public key is empty";
+        exit(1);
+    }
 
-        if (!decoded.has_payload_claim("room")) {
-            client->ErrorMessage = "Offer doesn't contain room";
-            return {};
+    if (Config_.RelayPort) {
+        try {
+            Relay_ = std::make_unique<Relay>(Config_.RelayPort, Config_.RelayPeers, std::chrono::microseconds(Config_.RelayFlushMicros));
+        } catch (const std::exception& ex) {
+            LOG_ERROR() << ex.what();
+            exit(1);
         }
-        
-        if (!decoded.has_payload_claim("user_id")) {
-            client->ErrorMessage = "Offer doesn't contain user_id";
-            return {};
+    }
+
+    if (Config_.MetricsPort) {
+        try {
+            MetricsServer_ = std::make_unique<MetricsServer>(Config_.MetricsPort, [this] {
+                return RenderMetrics();
+            });
+        } catch (const std::exception& ex) {
+            LOG_ERROR() << ex.what();
+            exit(1);
         }
+    }
+
+    for (size_t i = 0; i < Config_.LoopCount; ++i) {
+        auto shard = std::make_unique<Shard>();
+        shard->Index = i;
+        shard->Loop = std::make_shared<Loop>();
+        Shards_.push_back(std::move(shard));
+    }
+}
 
-        auto roomId = decoded.get_payload_claim("room").as_integer();
-        auto clientId = decoded.get_payload_claim("user_id").as_integer();
-        if (roomId <= 0 || clientId <= 0) {
-            client->ErrorMessage = "Invalid room or user id";
-            return {};
+void Router::SendVideoMode(Shard& shard, RoomId roomId, ClientId publisherId, bool isActive) {
+    const auto& participants = shard.Rooms[roomId].GetParticipants();
+    auto participant = participants.find(publisherId);
+    if (participant == participants.end()) {
+        return;
+    }
+
+    for (auto& [otherId, other] : shard.Clients.GetRoomClients(roomId)) {
+        if (otherId == publisherId) {
+            continue;
         }
 
-        return std::make_tuple(clientId, roomId);
-    } catch (const jwt::error::token_verification_exception& ex) {
-        client->ErrorMessage = (std::string("Verification failed: ") + ex.what());
-    } catch (const std::exception& ex) {
-        client->ErrorMessage = ex.what();
+        if (auto target = participant->second->GetVideoTarget(otherId)) {
+            other->ws->send(MakeModeMessage(target->Ssrc, isActive));
+        }
     }
-   
-    return {};
 }
 
-} // namespace
+void Router::SendVideoModes(Shard& shard, const std::shared_ptr<Client>& client, bool all) {
+    auto& room = shard.Rooms[*client->roomId];
 
-Router::Router()
-    : Loop_(std::make_shared<Loop>())
-{
-    PublicKey_ = ReadPemFile("data/public.pem");
-    if (PublicKey_.empty()) {
-        std::cerr << "Public key is empty!" << "\n";
-        exit(1);
+    // Pooled tracks don't renegotiate, so clients don't re-announce their
+    // mode to a newcomer by themselves.
+    for (const auto& [id, publisher] : room.GetPublishers()) {
+        if (id == *client->clientId || (!all && !publisher->IsVideoActive())) {
+            continue;
+        }
+
+        if (auto target = publisher->GetVideoTarget(*client->clientId)) {
+            client->ws->send(MakeModeMessage(target->Ssrc, publisher->IsVideoActive()));
+        }
+    }
+
+    if (!all) {
+        return;
+    }
+
+    // Tracks showing no one, which may have been showing someone before.
+    const auto& participants = room.GetParticipants();
+    auto it = participants.find(*client->clientId);
+    if (it == participants.end()) {
+        return;
+    }
+    for (const auto& slot : it->second->GetVideoSlots()) {
+        if (!slot.Publisher) {
+            client->ws->send(MakeModeMessage(slot.Target->Ssrc, false));
+        }
+    }
+    for (auto ssrc : it->second->GetNegotiator()->GetSpareVideoSsrcs()) {
+        client->ws->send(MakeModeMessage(ssrc, false));
     }
 }
 
-void Router::WsOpenCallback(std::shared_ptr<rtc::WebSocket> ws) {
-    Loop_->EnqueueTask([this, ws = std::move(ws)]
-    {
-        auto client = std::make_shared<Client>();
-        Clients_.emplace(client);
-        client->ws = ws;
-    });
+void Router::SendSpeakers(Room& room, const std::shared_ptr<Client>& client) {
+    // Speakers are named by id and by the SSRC the client receives their
+    // video on, which is what the client's tiles are keyed by.
+    const auto& participants = room.GetParticipants();
+    auto speakers = json::array();
+    for (auto speakerId : room.GetSpeakers()) {
+        json speaker = {{"id", speakerId}};
+        if (auto it = participants.find(speakerId); it != participants.end()) {
+            if (auto target = it->second->GetVideoTarget(*client->clientId)) {
+                speaker["ssrc"] = target->Ssrc;
+            }
+        }
+        speakers.push_back(std::move(speaker));
+    }
+
+    client->ws->send(json{{"type", "speakers"}, {"speakers", std::move(speakers)}}.dump());
 }
 
-void Router::WsClosedCallback(std::shared_ptr<rtc::WebSocket> ws) {
-    Loop_->EnqueueTask([this, ws = std::move(ws)]
-    {
-        std::shared_ptr<Client> clientToClose;
-        {
-            for (auto it = Clients_.begin(); it != Clients_.end(); ++it) {
-                if ((*it)->ws == ws) {
-                    clientToClose = *it;
-                    break;
+void Router::LeaveRoom(Shard& shard, const std::shared_ptr<Client>& client) {
+    auto roomId = *client->roomId;
+    auto clientId = *client->clientId;
+
+    auto& room = shard.Rooms[roomId];
+    bool publishing = room.IsPublishing(clientId);
+    if (publishing) {
+        SendVideoMode(shard, roomId, clientId, false);
+    }
+    room.RemoveParticipant(clientId);
+
+    if (publishing) {
+        RelayLeave(shard, roomId, clientId);
+    }
+}
+
+void Router::RelayLeave(Shard& shard, RoomId roomId, ClientId publisherId) {
+    if (auto it = shard.RelaySubscribers.find(roomId); it != shard.RelaySubscribers.end()) {
+        for (const auto& [trunk, lastSeen] : it->second) {
+            trunk->SendLeave(roomId, publisherId);
+        }
+    }
+}
+
+void Router::SetRole(Shard& shard, const std::shared_ptr<Client>& client, ParticipantRole role) {
+    if (client->Role == role) {
+        return;
+    }
+
+    auto roomId = *client->roomId;
+    auto clientId = *client->clientId;
+    client->Role = role;
+    LOG_INFO(.Client = clientId, .Room = roomId) << "Role changed to " << RoleName(role);
+
+    // Before the participant exists the role is applied once it connects.
+    auto& room = shard.Rooms[roomId];
+    const auto& participants = room.GetParticipants();
+    if (auto it = participants.find(clientId); it != participants.end() && !it->second->IsRemote()) {
+        if (role == ParticipantRole::Speaker) {
+            if (!client->Tracks[0] || !client->Tracks[1]) {
+                LOG_WARNING(.Client = clientId, .Room = roomId) << "Promoted client offered no tracks to publish";
+                return;
+            }
+            // The client's tracks were negotiated at join and only ignored so far.
+            room.HandleTracksForParticipant(clientId, client->Tracks);
+            if (it->second->IsVideoActive()) {
+                SendVideoMode(shard, roomId, clientId, true);
+            }
+            AnnouncePublisher(shard, roomId, clientId);
+        } else if (room.IsPublishing(clientId)) {
+            SendVideoMode(shard, roomId, clientId, false);
+            room.StopPublishing(clientId);
+            RelayLeave(shard, roomId, clientId);
+        }
+    }
+
+    client->ws->send(json{{"type", "role"}, {"role", RoleName(role)}}.dump());
+}
+
+void Router::HandleRelayMessage(Shard& shard, const std::shared_ptr<Trunk>& trunk, const RelayMessage& message) {
+    auto now = std::chrono::steady_clock::now();
+    auto roomId = message.Room;
+
+    switch (message.Type) {
+        case RelayMessageType::Subscribe: {
+            auto& subscribers = shard.RelaySubscribers[roomId];
+            bool added = !subscribers.contains(trunk);
+            subscribers[trunk] = now;
+            if (added) {
+                UpdateRelayTargets(shard, roomId);
+                AnnouncePublishers(shard, roomId, *trunk);
+            }
+            break;
+        }
+        case RelayMessageType::Announce: {
+            auto& room = shard.Rooms[roomId];
+            auto publisherId = message.Publisher;
+
+            const auto& participants = room.GetParticipants();
+            auto it = participants.find(publisherId);
+            if (it == participants.end()) {
+                LOG_INFO(.Client = publisherId, .Room = roomId) << "Relaying remote participant";
+                auto source = std::make_shared<Participant>(publisherId, Config_, message.Source, [trunk, roomId, publisherId](KeyframeArbiter::LayerMask layers) {
+                    trunk->SendKeyframeRequest(roomId, publisherId, layers);
+                });
+                room.AddRemoteParticipant(publisherId, source);
+                Relay_->AddSource(roomId, publisherId, source);
+                if (message.Source.VideoActive) {
+                    SendVideoMode(shard, roomId, publisherId, true);
                 }
+            } else if (!it->second->IsRemote()) {
+                // The same user is connected here as well; the local one wins.
+                break;
+            } else if (it->second->IsVideoActive() != message.Source.VideoActive) {
+                it->second->SetVideoActive(message.Source.VideoActive);
+                SendVideoMode(shard, roomId, publisherId, message.Source.VideoActive);
             }
+
+            shard.RemotePublishers[{roomId, publisherId}] = now;
+            break;
+        }
+        case RelayMessageType::Leave:
+            RemoveRemotePublisher(shard, roomId, message.Publisher);
+            break;
+        case RelayMessageType::Keyframe: {
+            const auto& participants = shard.Rooms[roomId].GetParticipants();
+            if (auto it = participants.find(message.Publisher); it != participants.end() && !it->second->IsRemote()) {
+                for (size_t layer = 0; layer < MaxSimulcastLayers; ++layer) {
+                    if (message.Layers & (KeyframeArbiter::LayerMask(1) << layer)) {
+                        it->second->RequestKeyframe(layer);
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void Router::RefreshRelay(Shard& shard) {
+    auto now = std::chrono::steady_clock::now();
+
+    for (auto& [roomId, room] : shard.Rooms) {
+        if (room.HasLocalParticipants()) {
+            for (const auto& trunk : Relay_->GetTrunks()) {
+                trunk->SendSubscribe(roomId);
+            }
+        }
+    }
+
+    for (auto it = shard.RelaySubscribers.begin(); it != shard.RelaySubscribers.end();) {
+        auto roomId = it->first;
+        std::erase_if(it->second, [now](const auto& entry) {
+            return now - entry.second > Relay::ExpiryInterval;
+        });
+
+        UpdateRelayTargets(shard, roomId);
+        for (const auto& [trunk, lastSeen] : it->second) {
+            AnnouncePublishers(shard, roomId, *trunk);
+        }
+
+        it = it->second.empty() ? shard.RelaySubscribers.erase(it) : std::next(it);
+    }
+
+    std::vector<std::pair<RoomId, ClientId>> expired;
+    for (const auto& [key, lastSeen] : shard.RemotePublishers) {
+        if (now - lastSeen > Relay::ExpiryInterval) {
+            expired.push_back(key);
+        }
+    }
+    for (auto [roomId, publisherId] : expired) {
+        RemoveRemotePublisher(shard, roomId, publisherId);
+    }
+}
+
+void Router::UpdateRelayTargets(Shard& shard, RoomId roomId) {
+    auto room = shard.Rooms.find(roomId);
+    if (room == shard.Rooms.end()) {
+        return;
+    }
+
+    std::vector<std::shared_ptr<Trunk>> trunks;
+    if (auto it = shard.RelaySubscribers.find(roomId); it != shard.RelaySubscribers.end()) {
+        for (const auto& [trunk, lastSeen] : it->second) {
+            trunks.push_back(trunk);
+        }
+    }
+    room->second.SetRelayTargets(roomId, std::move(trunks));
+}
+
+void Router::AnnouncePublishers(Shard& shard, RoomId roomId, Trunk& trunk) {
+    auto room = shard.Rooms.find(roomId);
+    if (room == shard.Rooms.end()) {
+        return;
+    }
+
+    for (const auto& [id, participant] : room->second.GetPublishers()) {
+        if (auto source = participant->GetRelaySource()) {
+            trunk.SendAnnounce(roomId, id, *source);
+        }
+    }
+}
+
+void Router::AnnouncePublisher(Shard& shard, RoomId roomId, ClientId publisherId) {
+    auto subscribers = shard.RelaySubscribers.find(roomId);
+    if (subscribers == shard.RelaySubscribers.end()) {
+        return;
+    }
+
+    const auto& participants = shard.Rooms[roomId].GetParticipants();
+    auto it = participants.find(publisherId);
+    if (it == participants.end()) {
+        return;
+    }
+
+    if (auto source = it->second->GetRelaySource()) {
+        for (const auto& [trunk, lastSeen] : subscribers->second) {
+            trunk->SendAnnounce(roomId, publisherId, *source);
+        }
+    }
+}
+
+void Router::RemoveRemotePublisher(Shard& shard, RoomId roomId, ClientId publisherId) {
+    if (!shard.RemotePublishers.erase({roomId, publisherId})) {
+        return;
+    }
+
+    LOG_INFO(.Client = publisherId, .Room = roomId) << "Remote participant left";
+    Relay_->RemoveSource(roomId, publisherId);
+    SendVideoMode(shard, roomId, publisherId, false);
+    shard.Rooms[roomId].RemoveParticipant(publisherId);
+}
+
+void Router::UpdateSpeakers(Shard& shard) {
+    for (auto& [roomId, room] : shard.Rooms) {
+        if (!room.UpdateSpeakers()) {
+            continue;
         }
 
-        if (clientToClose) {
-            if (clientToClose->roomId) {
-                std::cout << "[Client " << *clientToClose->clientId << "] WebSocket disconnected" << std::endl;
-                Rooms_.at(*clientToClose->roomId).RemoveParticipant(*clientToClose->clientId);
+        for (auto& [clientId, client] : shard.Clients.GetRoomClients(roomId)) {
+            SendSpeakers(room, client);
+        }
+    }
+}
+
+size_t Router::ShardForRoom(RoomId roomId) const {
+    return std::hash<RoomId>{}(roomId) % Shards_.size();
+}
+
+void Router::Dispatch(const std::shared_ptr<Client>& client, ShardTask&& task) {
+    bool idle = false;
+    {
+        std::lock_guard<std::mutex> lock(client->TasksMutex);
+        idle = client->Tasks.empty();
+        client->Tasks.emplace_back([this, owner = client.get(), task = std::move(task)]() mutable {
+            task(*Shards_[owner->Shard.load()]);
+        });
+    }
+    if (idle) {
+        RunClientTasks(client);
+    }
+}
+
+void Router::RunClientTasks(const std::shared_ptr<Client>& client) {
+    auto index = client->Shard.load();
+    Shards_[index]->Loop->EnqueueTask([this, client, index] {
+        while (true) {
+            // Moved by the previous task; the rest follow it, behind its hand-off.
+            if (client->Shard.load() != index) {
+                RunClientTasks(client);
+                return;
             }
 
-            if (clientToClose->pc) {
-                clientToClose->pc->close();
+            Task task;
+            {
+                std::lock_guard<std::mutex> lock(client->TasksMutex);
+                task = std::move(client->Tasks.front());
             }
-            Clients_.erase(clientToClose);
+            task();
+
+            std::lock_guard<std::mutex> lock(client->TasksMutex);
+            client->Tasks.pop_front();
+            if (client->Tasks.empty()) {
+                return;
+            }
+        }
+    });
+}
+
+void Router::SendSignaling(const std::shared_ptr<Client>& client, std::string message) {
+    Dispatch(client, [client, message = std::move(message)](Shard&) mutable {
+        // Dropped while suspended; a pending offer is sent again on resume.
+        if (client->ws->isOpen()) {
+            client->ws->send(std::move(message));
         }
     });
 }
 
-void Router::WsOnMessageCallback(std::shared_ptr<rtc::WebSocket> ws, rtc::message_variant&& message) {
-    Loop_->EnqueueTask([this, ws = std::move(ws), message = std::move(message)]
+void Router::Suspend(Shard& shard, const std::shared_ptr<Client>& client) {
+    LOG_INFO(.Client = client->clientId, .Room = client->roomId) << "WebSocket disconnected, keeping the session for " << Config_.ResumeGraceMillis << " ms";
+
+    auto token = client->ResumeToken;
+    auto expiry = shard.Loop->RunAfter(std::chrono::milliseconds(Config_.ResumeGraceMillis), [this, shard = &shard, token] {
+        EndSuspended(*shard, token);
+    });
+    shard.Suspended[token] = {client, expiry};
+    shard.Clients.Remove(client);
+}
+
+void Router::EndSuspended(Shard& shard, const std::string& token) {
+    auto it = shard.Suspended.find(token);
+    if (it == shard.Suspended.end()) {
+        return;
+    }
+
+    auto client = std::move(it->second.Session);
+    shard.Loop->CancelTimer(it->second.Expiry);
+    shard.Suspended.erase(it);
+
+    LOG_INFO(.Client = client->clientId, .Room = client->roomId) << "Session not resumed";
+    LeaveRoom(shard, client);
+    client->pc->close();
+}
+
+std::shared_ptr<Client> Router::FindSession(Shard& shard, RoomId roomId, const std::string& token) {
+    if (auto it = shard.Suspended.find(token); it != shard.Suspended.end()) {
+        auto session = std::move(it->second.Session);
+        shard.Loop->CancelTimer(it->second.Expiry);
+        shard.Suspended.erase(it);
+        return session;
+    }
+
+    // A WebSocket that died without a close, e.g. on a network switch, is
+    // still open here until TCP gives up on it, long after the client
+    // reconnected.
+    for (const auto& [clientId, session] : shard.Clients.GetRoomClients(roomId)) {
+        if (session->ResumeToken == token) {
+            LOG_INFO(.Client = session->clientId, .Room = session->roomId) << "Dropping the WebSocket of a resumed session";
+            auto ws = session->ws;
+            shard.Clients.Remove(session);
+            ws->onClosed(nullptr);
+            ws->onMessage(nullptr);
+            ws->close();
+            return session;
+        }
+    }
+    return nullptr;
+}
+
+void Router::Resume(Shard& shard, const std::shared_ptr<Client>& client, RoomId roomId, const std::string& token) {
+    auto session = FindSession(shard, roomId, token);
+    if (!session) {
+        LOG_INFO() << "Unknown or expired resume token";
+        client->ws->send(std::string(ResumeFailedMessage));
+        return;
+    }
+
+    // The session's Client takes over the new WebSocket, so everything bound
+    // to it, the PeerConnection callbacks included, carries on unchanged.
+    shard.Clients.Remove(client);
+    session->ws = client->ws;
+    session->ws->onClosed([this, session] {
+        WsClosedCallback(session);
+    });
+    session->ws->onMessage([this, session](rtc::message_variant message) {
+        WsOnMessageCallback(session, std::move(message));
+    });
+    shard.Clients.Add(session);
+    LOG_INFO(.Client = session->clientId, .Room = session->roomId) << "Session resumed";
+
+    // A fresh token; the old one may have been seen by whoever took the
+    // WebSocket down.
+    session->ResumeToken = MakeResumeToken(*session->roomId);
+    session->ws->send(json{{"type", "resumed"}, {"token", session->ResumeToken}}.dump());
+
+    // An offer renegotiating subscriptions may have been lost meanwhile.
+    if (session->pc->signalingState() == rtc::PeerConnection::SignalingState::HaveLocalOffer) {
+        if (auto offer = session->pc->localDescription()) {
+            session->ws->send(json{{"type", "offer"}, {"sdp", std::string(*offer)}}.dump());
+        }
+    }
+    // Mode and speaker updates sent while the session was away were lost.
+    SendVideoModes(shard, session, true);
+    SendSpeakers(shard.Rooms[roomId], session);
+
+    // Closed before its callbacks were moved over.
+    if (!session->ws->isOpen()) {
+        WsClosedCallback(session);
+    }
+}
+
+void Router::WsOpenCallback(std::shared_ptr<Client> client) {
+    Dispatch(client, [client](Shard& shard)
+    {
+        shard.Clients.Add(client);
+    });
+}
+
+void Router::WsClosedCallback(std::shared_ptr<Client> client) {
+    Dispatch(client, [this, client](Shard& shard)
+    {
+        if (!shard.Clients.Contains(client)) {
+            return;
+        }
+
+        // A client replaced by a newer login of the same user no longer owns the participant.
+        if (client->roomId && shard.Clients.Find(*client->roomId, *client->clientId) == client) {
+            if (!client->ResumeToken.empty()) {
+                Suspend(shard, client);
+                return;
+            }
+
+            LOG_INFO(.Client = client->clientId, .Room = client->roomId) << "WebSocket disconnected";
+            LeaveRoom(shard, client);
+        }
+
+        if (client->pc) {
+            client->pc->close();
+        }
+        shard.Clients.Remove(client);
+    });
+}
+
+void Router::WsOnMessageCallback(std::shared_ptr<Client> client, rtc::message_variant&& message) {
+    Dispatch(client, [this, client, message = std::move(message)](Shard& shard)
     {
         auto pstr = std::get_if<std::string>(&message);
         if (!pstr) return;
 
-        json j;
-        try {
-            j = json::parse(*pstr);
-        } catch (...) {
-            std::cerr << "Invalid JSON signaling message" << std::endl;
+        auto& ws = client->ws;
+
+        // Most messages are pings, candidates and small notices, read in
+        // place; only messages carrying a token are parsed into a DOM.
+        SignalingMessage fields(*pstr);
+        if (!fields.IsValid()) {
+            LOG_WARNING(.Client = client->clientId) << "Invalid JSON signaling message";
+            ws->close();
             return;
         }
 
-        std::shared_ptr<Client> client;
-        {
-            for (auto& c : Clients_) {
-                if (c->ws == ws) {
-                    client = c;
-                    break;
-                }
+        if (!shard.Clients.Contains(client)) {
+            // Queued before a resumed session took this WebSocket over.
+            if (auto owner = shard.Clients.Find(ws.get())) {
+                WsOnMessageCallback(owner, rtc::message_variant(*pstr));
+                return;
             }
-        }
-        if (!client) {
-            std::cerr << "Client not found for signaling message" << std::endl;
+
+            LOG_WARNING(.Client = client->clientId) << "Client not found for signaling message";
             ws->close();
             return;
         }
 
-        auto typeIt = j.find("type");
-        if (typeIt == j.end() || !typeIt->is_string()) {
-            std::cerr << "Signaling message missing type" << std::endl;
+        auto typeField = fields.GetRawString("type");
+        if (!typeField) {
+            LOG_WARNING(.Client = client->clientId) << "Signaling message missing type";
             ws->close();
             return;
         }
 
-        const auto& type = *typeIt;
+        auto type = *typeField;
 
-        if (type != "offer" && (!client->clientId || !client->roomId)) {
-            std::cerr << "Invalid message type" << std::endl;
+        if (type != "offer" && type != "resume" && (!client->clientId || !client->roomId)) {
+            LOG_WARNING() << "Signaling message before offer";
             ws->close();
             return;
         }
 
-        if (type == "offer") {
-            auto validationResult = ValidateOffer(j, client, PublicKey_);
+        if (type == "ping") {
+            ws->send(std::string(PongMessage));
+        }
+        else if (type == "candidate") {
+            auto candidate = fields.GetString("candidate");
+            if (!candidate) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Candidate message missing candidate field";
+                return;
+            }
+
+            // Skip empty candidates
+            if (candidate->empty()) {
+                LOG_DEBUG(.Client = client->clientId, .Room = client->roomId) << "Skipping empty candidate";
+                return;
+            }
+
+            std::string sdpMid = fields.GetString("sdpMid").value_or("");
+            
+            LOG_DEBUG(.Client = client->clientId, .Room = client->roomId) << "Adding remote candidate: " << *candidate;
+
+            if (client->pc) {
+                try {
+                    client->pc->addRemoteCandidate(rtc::Candidate(std::move(*candidate), std::move(sdpMid)));
+                } catch (const std::exception& e) {
+                    LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Failed to add candidate: " << e.what();
+                }
+            }
+        }
+        else if (type == "offer") {
+            auto j = json::parse(*pstr, nullptr, false);
+            auto validationResult = ValidateOffer(j, client, TokenVerifier_);
 
             if (!validationResult) {
                 ws->send(client->ErrorMessage);
@@ -179,210 +648,541 @@ void Router::WsOnMessageCallback(std::shared_ptr<rtc::WebSocket> ws, rtc::messag
                 return;
             }
 
-            auto [clientId, roomId] = *validationResult;
+            auto [clientId, roomId, role] = *validationResult;
 
-            if (Rooms_.contains(roomId) && Rooms_[roomId].HasParticipant(clientId)) {
-                Rooms_[roomId].RemoveParticipant(clientId);
-                for (auto it = Clients_.begin(); it != Clients_.end(); ++it) {
-                    if ((*it)->clientId == clientId) {
-                        client->ws->close();
-                        break;
-                    }
+            // Already parsed for the token, so the SDP is taken from the DOM.
+            auto sdpField = j.find("sdp");
+            if (sdpField == j.end() || !sdpField->is_string()) {
+                LOG_WARNING(.Client = clientId, .Room = roomId) << "Offer missing sdp";
+                ws->close();
+                return;
+            }
+            auto sdp = std::move(sdpField->get_ref<std::string&>());
+
+            // The token is verified on whichever shard accepted the connection;
+            // everything touching the room runs on the room's own shard.
+            auto target = ShardForRoom(roomId);
+            if (target == shard.Index) {
+                HandleOffer(shard, client, *validationResult, std::move(sdp));
+                return;
+            }
+
+            shard.Clients.Remove(client);
+            Shards_[target]->Loop->EnqueueTask([this, client, target, claims = *validationResult, sdp = std::move(sdp)]() mutable {
+                auto& targetShard = *Shards_[target];
+                targetShard.Clients.Add(client);
+                HandleOffer(targetShard, client, claims, std::move(sdp));
+            });
+            // Published after the hand-off is queued. The client's tasks run
+            // in order on one shard at a time, so the rest follow it there.
+            client->Shard = target;
+        }
+        else if (type == "answer") {
+            auto sdp = fields.GetString("sdp");
+            if (!sdp) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Answer missing sdp";
+                return;
+            }
+            client->pc->setRemoteDescription(rtc::Description(std::move(*sdp), "answer"));
+
+            const auto& participants = shard.Rooms[*client->roomId].GetParticipants();
+            if (auto it = participants.find(*client->clientId); it != participants.end()) {
+                if (auto duration = it->second->GetNegotiator()->OnAnswer()) {
+                    shard.RenegotiationDuration.Observe(*duration);
                 }
             }
+        }
+        else if (type == "mode") {
+            auto isActive = fields.GetBool("active");
+            if (!isActive) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Mode message missing active";
+                return;
+            }
 
-            client->clientId = clientId;
-            client->roomId = roomId; 
+            client->IsVideoActive = *isActive;
+            const auto& participants = shard.Rooms[*client->roomId].GetParticipants();
+            if (auto it = participants.find(*client->clientId); it != participants.end()) {
+                it->second->SetVideoActive(*isActive);
+            }
+            SendVideoMode(shard, *client->roomId, *client->clientId, *isActive);
+            AnnouncePublisher(shard, *client->roomId, *client->clientId);
+        }
+        else if (type == "layer") {
+            auto ssrc = fields.GetUnsigned("ssrc");
+            if (!ssrc) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Layer message missing ssrc";
+                return;
+            }
 
-            if (!j.contains("sdp")) {
-                std::cerr << "Offer missing sdp" << std::endl;
-                ws->close();
+            auto layer = fields.Contains("layer") ? fields.GetInteger("layer") : LayerSelector::Highest;
+            if (!layer || *layer < LayerSelector::Highest || *layer >= static_cast<int64_t>(MaxSimulcastLayers)) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Invalid video layer " << fields.GetRaw("layer");
                 return;
             }
-            std::string sdp = j.at("sdp");
 
-            if (!client->pc) {
-                rtc::Configuration config;
-                config.disableAutoNegotiation = true;
-                config.forceMediaTransport = true;
-                config.portRangeBegin = 50001;
-                config.portRangeEnd = 50005;
+            if (!shard.Rooms[*client->roomId].SetVideoLayer(*client->clientId, static_cast<rtc::SSRC>(*ssrc), static_cast<int>(*layer))) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Unknown video ssrc " << *ssrc;
+            }
+        }
+        else if (type == "render") {
+            auto ssrc = fields.GetUnsigned("ssrc");
+            if (!ssrc) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Render message missing ssrc";
+                return;
+            }
 
-                config.iceServers.emplace_back("stun:stun.l.google.com:19302");
-                
-                std::cout << "[Client " << clientId << "] Creating PeerConnection" << std::endl;
-                client->pc = std::make_shared<rtc::PeerConnection>(config);
+            auto rendered = fields.GetBool("active").value_or(true);
+            if (!shard.Rooms[*client->roomId].SetVideoRendered(*client->clientId, static_cast<rtc::SSRC>(*ssrc), rendered)) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Unknown video ssrc " << *ssrc;
+            }
+        }
+        else if (type == "subscribe") {
+            auto slot = fields.GetUnsigned("slot");
+            auto participant = fields.GetUnsigned("participant");
+            if (!slot || !(participant || fields.IsNull("participant"))) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Subscribe message missing slot or participant";
+                return;
+            }
 
-                client->pc->onLocalDescription([ws, client, clientId](const rtc::Description& desc) {
-                    std::cout << "[Client " << clientId << "] Local description type: " << desc.typeString() << std::endl;
+            std::optional<ClientId> publisherId;
+            if (participant) {
+                publisherId = *participant;
+            }
+            auto& room = shard.Rooms[*client->roomId];
+            if (!room.SetVideoSlot(*client->clientId, *slot, publisherId)) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Cannot subscribe video slot " << *slot << " to " << fields.GetRaw("participant");
+                return;
+            }
 
-                    json answer = {
-                        {"type", desc.typeString()},
-                        {"sdp", std::string(desc)}
-                    };
+            // The slot now shows whatever state the new publisher's video is in.
+            const auto& slots = room.GetParticipants().at(*client->clientId)->GetVideoSlots();
+            bool active = publisherId && room.GetPublishers().at(*publisherId)->IsVideoActive();
+            ws->send(MakeModeMessage(slots[*slot].Target->Ssrc, active));
+        }
+        else if (type == "role") {
+            // A fresh token from the application names the new role.
+            auto claims = ValidateOffer(json::parse(*pstr, nullptr, false), client, TokenVerifier_);
+            if (!claims) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Rejected role change: " << client->ErrorMessage;
+                return;
+            }
+            if (claims->clientId != *client->clientId || claims->roomId != *client->roomId) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Role token is for another user or room";
+                return;
+            }
 
-                    std::cout << "[Client " << clientId << "] Sending answer" << std::endl;
-                    ws->send(answer.dump());
-                });
+            SetRole(shard, client, claims->Role);
+        }
+        else if (type == "resume") {
+            auto token = fields.GetString("token");
+            auto roomId = token ? ParseResumeRoom(*token) : std::nullopt;
+            if (!roomId || client->pc) {
+                LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Invalid resume message";
+                ws->send(std::string(ResumeFailedMessage));
+                return;
+            }
 
-                if (!client->ErrorMessage.empty()) {
-                    client->pc->setRemoteDescription(rtc::Description(sdp, "offer"));
-                    client->pc->setLocalDescription();
+            // Like an offer, the session is resumed on the room's shard.
+            auto target = ShardForRoom(*roomId);
+            if (target == shard.Index) {
+                Resume(shard, client, *roomId, *token);
+                return;
+            }
+
+            shard.Clients.Remove(client);
+            Shards_[target]->Loop->EnqueueTask([this, client, target, roomId = *roomId, token = std::move(*token)] {
+                auto& targetShard = *Shards_[target];
+                targetShard.Clients.Add(client);
+                Resume(targetShard, client, roomId, token);
+            });
+            client->Shard = target;
+        }
+        else if (type == "leave") {
+            // Leaving on purpose: the room is left as soon as the WebSocket closes.
+            client->ResumeToken.clear();
+            ws->close();
+        }
+        else if (type == "endOfCandidates") {
+            LOG_DEBUG(.Client = client->clientId, .Room = client->roomId) << "Client finished sending candidates";
+        }
+        else {
+            LOG_WARNING(.Client = client->clientId, .Room = client->roomId) << "Unknown message type: " << type;
+        }
+    });
+}
+
+void Router::HandleOffer(Shard& shard, std::shared_ptr<Client> client, const TokenClaims& claims, std::string sdp) {
+    auto clientId = claims.clientId;
+    auto roomId = claims.roomId;
+
+    // A second login of the same user replaces the previous connection,
+    // or a session of it waiting to be resumed.
+    for (auto it = shard.Suspended.begin(); it != shard.Suspended.end(); ++it) {
+        const auto& session = it->second.Session;
+        if (session->roomId == roomId && session->clientId == clientId) {
+            LOG_INFO(.Client = clientId, .Room = roomId) << "Replacing suspended session";
+            EndSuspended(shard, it->first);
+            break;
+        }
+    }
+    if (auto previous = shard.Clients.Find(roomId, clientId); previous && previous != client) {
+        LOG_INFO(.Client = clientId, .Room = roomId) << "Replacing previous connection";
+        LeaveRoom(shard, previous);
+        shard.Clients.Remove(previous);
+        if (previous->pc) {
+            previous->pc->close();
+        }
+        previous->ws->close();
+    }
+
+    shard.Clients.Assign(client, clientId, roomId);
+
+    bool renegotiating = client->pc != nullptr;
+    if (renegotiating) {
+        // A renegotiating client may bring a token for another role.
+        SetRole(shard, client, claims.Role);
+    } else {
+        client->Role = claims.Role;
+
+        rtc::Configuration config;
+        config.disableAutoNegotiation = true;
+        config.forceMediaTransport = true;
+        config.enableIceUdpMux = Config_.IceUdpMux;
+        config.portRangeBegin = Config_.IcePortBegin;
+        config.portRangeEnd = Config_.IceUdpMux ? Config_.IcePortBegin : Config_.IcePortEnd;
+
+        config.iceServers.emplace_back("stun:stun.l.google.com:19302");
+        
+        LOG_DEBUG(.Client = clientId, .Room = roomId) << "Creating PeerConnection";
+        client->JoinStartedAt = std::chrono::steady_clock::now();
+        client->pc = std::make_shared<rtc::PeerConnection>(config);
+
+        client->pc->onLocalDescription([this, client, clientId, roomId, nack = Config_.NackHistory > 0](const rtc::Description& desc) {
+            LOG_DEBUG(.Client = clientId, .Room = roomId) << "Sending " << desc.typeString();
+
+            std::string sdp(desc);
+            if (desc.type() == rtc::Description::Type::Answer) {
+                if (auto remote = client->pc->remoteDescription()) {
+                    sdp = AcceptSimulcast(std::string(*remote), sdp);
+                }
+                if (nack) {
+                    sdp = RemoveRtx(sdp);
                 }
+            }
 
-                client->pc->onLocalCandidate([ws, clientId](const rtc::Candidate& cand) {
-                    auto candidate = cand.candidate();
-                    bool isIPv6 = candidate.find('.') == std::string::npos;
-                    if (cand.candidate().empty() || isIPv6) {
-                        std::cerr << "Skipping invalid candidate " << cand << std::endl;
-                        return;
-                    }
+            json answer = {
+                {"type", desc.typeString()},
+                {"sdp", sdp}
+            };
 
-                    std::string candStr = cand.candidate();
+            SendSignaling(client, answer.dump());
+        });
 
-                    std::cout << "[Client " << clientId << "] Local candidate: " << candStr << std::endl;
+        client->pc->onLocalCandidate([this, client, clientId, roomId](const rtc::Candidate& cand) {
+            auto candidate = cand.candidate();
+            bool isIPv6 = candidate.find('.') == std::string::npos;
+            if (cand.candidate().empty() || isIPv6) {
+                LOG_DEBUG(.Client = clientId, .Room = roomId) << "Skipping invalid candidate " << cand;
+                return;
+            }
 
-                    json jcand = {
-                        {"type", "candidate"},
-                        {"candidate", candStr}
-                    };
-                    
-                    if (auto mid = cand.mid(); !mid.empty()) {
-                        jcand["sdpMid"] = mid;
-                    }
+            std::string candStr = cand.candidate();
 
-                    ws->send(jcand.dump());
-                });
+            LOG_DEBUG(.Client = clientId, .Room = roomId) << "Local candidate: " << candStr;
 
-                client->pc->onTrack([&, client, clientId](std::shared_ptr<rtc::Track> track) {
-                    Loop_->EnqueueTask([this, client, clientId, track] {
-                        auto session = std::make_shared<rtc::RtcpReceivingSession>();
-                        track->setMediaHandler(session);
+            SendSignaling(client, MakeCandidateMessage(candStr, cand.mid()));
+        });
 
-                        std::cout << track->mid() << "\n";
-                        if (track->mid() == AUDIO) {
-                            client->Tracks[0] = track;
-                            return;
-                        }
+        client->pc->onTrack([this, client, clientId](std::shared_ptr<rtc::Track> track) {
+            Dispatch(client, [this, client, clientId, track](Shard&) {
+                LOG_DEBUG(.Client = clientId, .Room = client->roomId) << "Received track " << track->mid();
+                if (track->mid() == AUDIO) {
+                    track->setMediaHandler(std::make_shared<rtc::RtcpReceivingSession>());
+                    client->Tracks[0] = track;
+                    return;
+                }
 
-                        client->Tracks[1] = track;
-                    });
-                });
+                track->setMediaHandler(std::make_shared<VideoReceivingSession>(Config_.NackHistory > 0));
+                client->Tracks[1] = track;
+            });
+        });
 
-                client->pc->onStateChange([this, client](rtc::PeerConnection::State state) {
-                    Loop_->EnqueueTask([this, client, state] {
-                        if (state == rtc::PeerConnection::State::Connected) {
-                            std::cout << "[Client " << *client->clientId << "Connected to room: " << *client->roomId << "\n";
+        client->pc->onStateChange([this, client](rtc::PeerConnection::State state) {
+            Dispatch(client, [this, client, state](Shard& shard) {
+                if (state == rtc::PeerConnection::State::Connected) {
+                    LOG_INFO(.Client = client->clientId, .Room = client->roomId) << "Connected";
+                    shard.JoinDuration.Observe(std::chrono::steady_clock::now() - client->JoinStartedAt);
 
-                            auto newParticipant = std::make_shared<Participant>(client->pc, *client->clientId);
-                            Rooms_[*client->roomId].AddParticipant(*client->clientId, newParticipant);
-                            std::cout << "Handle tracks for client: " << *client->clientId << "\n";
-                            Rooms_[*client->roomId].HandleTracksForParticipant(*client->clientId, client->Tracks);
-                        }
+                    auto newParticipant = std::make_shared<Participant>(client->pc, *client->clientId, shard.Loop, Config_);
+                    // A lost answer counts as taking the whole timeout.
+                    newParticipant->GetNegotiator()->OnAnswerTimeout([&shard](auto duration) {
+                        shard.RenegotiationDuration.Observe(duration);
                     });
-                });
-            }
+                    newParticipant->SetVideoActive(client->IsVideoActive);
+                    auto& room = shard.Rooms[*client->roomId];
+                    room.AddParticipant(*client->clientId, newParticipant);
+                    // Slots are picked with "subscribe" messages by SSRC order.
+                    if (auto& slots = newParticipant->GetVideoSlots(); !slots.empty()) {
+                        auto ssrcs = json::array();
+                        for (const auto& slot : slots) {
+                            ssrcs.push_back(slot.Target->Ssrc);
+                        }
+                        client->ws->send(json{{"type", "slots"}, {"video", std::move(ssrcs)}}.dump());
+                    }
+                    // The audience's own tracks stay negotiated for a later promotion.
+                    if (client->Role == ParticipantRole::Speaker) {
+                        room.HandleTracksForParticipant(*client->clientId, client->Tracks);
+                    }
+                    SendVideoModes(shard, client);
+                    AnnouncePublisher(shard, *client->roomId, *client->clientId);
 
-            std::cout << "[Client " << clientId << "] Processing offer..." << std::endl;
-            
-            client->pc->setRemoteDescription(rtc::Description(sdp, "offer"));
-            std::cout << "[Client " << clientId << "] Remote description set" << std::endl;
-            
-            client->pc->setLocalDescription();
-            std::cout << "[Client " << clientId << "] Local description set (answer will be generated)" << std::endl;
-        }
-        else if (type == "answer") {
-            auto sdpIt = j.find("sdp");
-            if (sdpIt == j.end() || !sdpIt->is_string()) {
-                std::cerr << "[Client " << *client->clientId << "] Offer missing sdp" << std::endl;
-                return;
+                    if (Config_.ResumeGraceMillis > 0) {
+                        client->ResumeToken = MakeResumeToken(*client->roomId);
+                        client->ws->send(json{{"type", "session"}, {"token", client->ResumeToken}, {"grace", Config_.ResumeGraceMillis}}.dump());
+                    }
+                }
+            });
+        });
+    }
+
+    LOG_DEBUG(.Client = clientId, .Room = roomId) << "Processing offer";
+    if (renegotiating) {
+        if (auto room = shard.Rooms.find(roomId); room != shard.Rooms.end()) {
+            const auto& participants = room->second.GetParticipants();
+            if (auto it = participants.find(clientId); it != participants.end()) {
+                it->second->GetNegotiator()->OnRemoteOffer();
             }
-            client->pc->setRemoteDescription(rtc::Description(std::string(*sdpIt), "answer"));
         }
-        else if (type == "candidate") {
-            auto candIt = j.find("candidate");
-            if (candIt == j.end() || !candIt->is_string()) {
-                std::cerr << "[Client " << *client->clientId << "] Candidate message missing candidate field" << std::endl;
-                return;
-            }
+    }
+    client->pc->setRemoteDescription(rtc::Description(sdp, "offer"));
+    client->pc->setLocalDescription();
+}
 
-            std::string candidate = *candIt;
-            
-            // Skip empty candidates
-            if (candidate.empty()) {
-                std::cout << "[Client " << *client->clientId << "] Skipping empty candidate" << std::endl;
-                return;
+std::string Router::RenderMetrics() {
+    struct ParticipantEntry {
+        RoomId Room;
+        ClientId Id;
+        std::shared_ptr<Participant> Publisher;
+    };
+
+    struct ShardEntries {
+        std::vector<ParticipantEntry> Participants;
+        std::vector<std::pair<RoomId, std::array<TrafficTotals, 2>>> Rooms;
+        std::map<std::string, uint64_t> PeerConnections;
+    };
+
+    // Participants are kept alive by the snapshot; their counters are
+    // atomics and are read here, off the loops.
+    std::vector<std::future<ShardEntries>> pending;
+    for (auto& shard : Shards_) {
+        auto promise = std::make_shared<std::promise<ShardEntries>>();
+        pending.push_back(promise->get_future());
+        shard->Loop->EnqueueTask([shard = shard.get(), promise] {
+            ShardEntries entries;
+            for (auto& [roomId, room] : shard->Rooms) {
+                for (const auto& [id, participant] : room.GetParticipants()) {
+                    entries.Participants.push_back({roomId, id, participant});
+                }
+                entries.Rooms.emplace_back(roomId, room.GetTraffic());
+            }
+            for (const auto& [ws, client] : shard->Clients.GetClients()) {
+                if (client->pc) {
+                    ++entries.PeerConnections[PeerConnectionStateName(client->pc->state())];
+                }
             }
+            promise->set_value(std::move(entries));
+        });
+    }
 
-            std::string sdpMid = j.value("sdpMid", "");
-            
-            std::cout << "[Client " << *client->clientId << "] Adding remote candidate: " << candidate << std::endl;
+    auto deadline = std::chrono::steady_clock::now() + MetricsCollectTimeout;
+    std::vector<ShardEntries> shards;
+    for (auto& future : pending) {
+        if (future.wait_until(deadline) == std::future_status::ready) {
+            shards.push_back(future.get());
+        }
+    }
 
-            if (client->pc) {
-                try {
-                    client->pc->addRemoteCandidate(rtc::Candidate(candidate, sdpMid));
-                    std::cout << "[Client " << *client->clientId << "] ✓ Candidate added successfully" << std::endl;
-                } catch (const std::exception& e) {
-                    std::cerr << "[Client " << *client->clientId << "] Failed to add candidate: " << e.what() << std::endl;
+    MetricsWriter writer;
+    const std::array<std::string, 2> kinds = {"audio", "video"};
+
+    struct TrafficField {
+        const char* Name;
+        const char* Help;
+        std::atomic<uint64_t> TrafficCounters::* Field;
+        uint64_t TrafficTotals::* Total;
+    };
+    const std::array<TrafficField, 5> fields = {{
+        {"packets_received_total", "RTP packets received from publishers.", &TrafficCounters::PacketsReceived, &TrafficTotals::PacketsReceived},
+        {"bytes_received_total", "RTP bytes received from publishers.", &TrafficCounters::BytesReceived, &TrafficTotals::BytesReceived},
+        {"packets_forwarded_total", "RTP packets sent to subscribers.", &TrafficCounters::PacketsForwarded, &TrafficTotals::PacketsForwarded},
+        {"bytes_forwarded_total", "RTP bytes sent to subscribers.", &TrafficCounters::BytesForwarded, &TrafficTotals::BytesForwarded},
+        {"packets_dropped_closed_total", "RTP packets not sent because the subscriber track was closed.", &TrafficCounters::DroppedClosed, &TrafficTotals::DroppedClosed},
+    }};
+
+    for (const auto& field : fields) {
+        writer.AddFamily(std::string("sfu_participant_") + field.Name, "counter", field.Help);
+        for (const auto& shard : shards) {
+            for (const auto& entry : shard.Participants) {
+                for (size_t kind = 0; kind < kinds.size(); ++kind) {
+                    auto value = (entry.Publisher->GetTraffic(kind).*field.Field).load(std::memory_order_relaxed);
+                    writer.AddSample(std::string("sfu_participant_") + field.Name, {
+                        {"room", std::to_string(entry.Room)},
+                        {"participant", std::to_string(entry.Id)},
+                        {"kind", kinds[kind]},
+                    }, value);
                 }
             }
         }
-        else if (type == "mode") {
-            auto& room = Rooms_[*client->roomId];
-            bool isActive = j["active"].get<bool>();
-
-            client->IsVideoActive = isActive;
 
-            const auto& participants = room.GetParticipants();
-            const auto& outgoingTracks = participants.at(*client->clientId)->GetOutgoingTracks();
-            for (auto& other : Clients_) {
-                if (other == client) {
-                    continue;
+        writer.AddFamily(std::string("sfu_room_") + field.Name, "counter", field.Help);
+        // Kept by the room, so participants leaving don't take their share along.
+        for (const auto& shard : shards) {
+            for (const auto& [roomId, traffic] : shard.Rooms) {
+                for (size_t kind = 0; kind < kinds.size(); ++kind) {
+                    writer.AddSample(std::string("sfu_room_") + field.Name, {
+                        {"room", std::to_string(roomId)},
+                        {"kind", kinds[kind]},
+                    }, traffic[kind].*field.Total);
                 }
+            }
+        }
+    }
 
-                if (auto it = outgoingTracks.find(*other->clientId); it != outgoingTracks.cend()) {
-                    other->ws->send(
-                        json{
-                            {"type", "mode"},
-                            {"ssrc", outgoingTracks.at(*other->clientId)[1]->description().getSSRCs()[0] },
-                            {"active", isActive}
-                        }.dump());
-                }
+    writer.AddFamily("sfu_keyframe_requests_total", "counter", "Key frame requests for a publisher by origin, and those sent upstream after coalescing.");
+    for (const auto& shard : shards) {
+        for (const auto& entry : shard.Participants) {
+            auto stats = entry.Publisher->GetKeyframeStats();
+            const std::array<std::pair<const char*, uint64_t>, 4> sources = {{
+                {"requested", stats.Requested},
+                {"pli", stats.Pli},
+                {"fir", stats.Fir},
+                {"forwarded", stats.Forwarded},
+            }};
+            for (const auto& [source, value] : sources) {
+                writer.AddSample("sfu_keyframe_requests_total", {
+                    {"room", std::to_string(entry.Room)},
+                    {"participant", std::to_string(entry.Id)},
+                    {"source", source},
+                }, value);
             }
         }
-        else if (type == "endOfCandidates") {
-            std::cout << "[Client " << *client->clientId << "] Client finished sending candidates" << std::endl;
+    }
+
+    writer.AddFamily("sfu_participants", "gauge", "Participants per room, including publishers relayed from other nodes.");
+    for (const auto& shard : shards) {
+        std::map<RoomId, uint64_t> rooms;
+        for (const auto& entry : shard.Participants) {
+            ++rooms[entry.Room];
         }
-        else if (type == "ping") {
-            ws->send(json({{"type","pong"}}).dump());
+        for (const auto& [roomId, count] : rooms) {
+            writer.AddSample("sfu_participants", {{"room", std::to_string(roomId)}}, count);
         }
-        else {
-            std::cout << "[Client " << *client->clientId << "] Unknown message type: " << type << std::endl;
+    }
+
+    std::map<std::string, uint64_t> peerConnections;
+    for (const auto& shard : shards) {
+        for (const auto& [state, count] : shard.PeerConnections) {
+            peerConnections[state] += count;
         }
-    });
+    }
+    writer.AddFamily("sfu_peer_connections", "gauge", "Live PeerConnections by state.");
+    for (const auto& [state, count] : peerConnections) {
+        writer.AddSample("sfu_peer_connections", {{"state", state}}, count);
+    }
+
+    writer.AddFamily("sfu_loop_queue_depth", "gauge", "Tasks posted to a shard loop and not run yet.");
+    for (const auto& shard : Shards_) {
+        writer.AddSample("sfu_loop_queue_depth", {{"shard", std::to_string(shard->Index)}}, shard->Loop->GetQueueDepth());
+    }
+
+    writer.AddFamily("sfu_loop_task_wait_seconds", "histogram", "Time tasks spend queued on a shard loop.");
+    for (const auto& shard : Shards_) {
+        writer.AddHistogram("sfu_loop_task_wait_seconds", {{"shard", std::to_string(shard->Index)}}, shard->Loop->GetTaskWait().GetSnapshot());
+    }
+
+    writer.AddFamily("sfu_loop_task_run_seconds", "histogram", "Time tasks take to run on a shard loop.");
+    for (const auto& shard : Shards_) {
+        writer.AddHistogram("sfu_loop_task_run_seconds", {{"shard", std::to_string(shard->Index)}}, shard->Loop->GetTaskRun().GetSnapshot());
+    }
+
+    writer.AddFamily("sfu_log_dropped_total", "counter", "Log lines dropped because the log buffer was full.");
+    writer.AddSample("sfu_log_dropped_total", {}, Logger::Get().GetDropped());
+
+    Histogram::Snapshot joins;
+    Histogram::Snapshot renegotiations;
+    for (const auto& shard : Shards_) {
+        joins += shard->JoinDuration.GetSnapshot();
+        renegotiations += shard->RenegotiationDuration.GetSnapshot();
+    }
+    writer.AddFamily("sfu_join_duration_seconds", "histogram", "Time from a client's first offer until its PeerConnection is connected.");
+    writer.AddHistogram("sfu_join_duration_seconds", {}, joins);
+    writer.AddFamily("sfu_renegotiation_duration_seconds", "histogram", "Time from a server offer until the client's answer.");
+    writer.AddHistogram("sfu_renegotiation_duration_seconds", {}, renegotiations);
+
+    return writer.GetText();
 }
 
 void Router::Run() {
     rtc::WebSocketServer::Configuration wsCfg;
-    wsCfg.port = 8000;
+    wsCfg.port = Config_.Port;
+
+    std::vector<std::thread> threads;
+    for (auto& shard : Shards_) {
+        threads.emplace_back(std::bind(&Loop::Run, shard->Loop));
+    }
+
+    Shards_.front()->Loop->RunEvery(KeyReloadInterval, [this] {
+        TokenVerifier_.ReloadIfChanged();
+    });
+
+    if (Relay_) {
+        Relay_->Start([this](const std::shared_ptr<Trunk>& trunk, const RelayMessage& message) {
+            auto& shard = *Shards_[ShardForRoom(message.Room)];
+            shard.Loop->EnqueueTask([this, &shard, trunk, message] {
+                HandleRelayMessage(shard, trunk, message);
+            });
+        });
+
+        for (auto& shard : Shards_) {
+            shard->Loop->RunEvery(Relay::RefreshInterval, [this, shard = shard.get()] {
+                RefreshRelay(*shard);
+            });
+        }
+    }
+
+    for (auto& shard : Shards_) {
+        shard->Loop->RunEvery(SpeakerUpdateInterval, [shard = shard.get()] {
+            UpdateSpeakers(*shard);
+        });
+    }
 
-    std::thread t{std::bind(&Loop::Run, Loop_)};
+    if (MetricsServer_) {
+        MetricsServer_->Start();
+    }
 
     auto wsServer = std::make_shared<rtc::WebSocketServer>(wsCfg);
     wsServer->onClient([&](std::shared_ptr<rtc::WebSocket> ws) {
-        ws->onOpen([&, ws]() mutable {
-            WsOpenCallback(ws);
+        // Connections are spread over the shards until their offer names a room.
+        auto client = std::make_shared<Client>();
+        client->ws = ws;
+        client->Shard = IdGenerator_++ % Shards_.size();
+
+        ws->onOpen([&, client]() mutable {
+            WsOpenCallback(client);
         });
 
-        ws->onClosed([&, ws]() mutable {
-            WsClosedCallback(ws);
+        ws->onClosed([&, client]() mutable {
+            WsClosedCallback(client);
         });
 
-        ws->onMessage([&, ws](rtc::message_variant message) mutable {
-            WsOnMessageCallback(ws, std::move(message));
+        ws->onMessage([&, client](rtc::message_variant message) mutable {
+            WsOnMessageCallback(client, std::move(message));
         });
     });
-    t.join();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
 }
 
 } // namespace sfu
\ No newline at end of file
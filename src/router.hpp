@@ -1,35 +1,128 @@
 #pragma once
 
+#include "auth.hpp"
+#include "client.hpp"
+#include "config.hpp"
 #include "fwd.hpp"
+#include "loop.hpp"
+#include "metrics.hpp"
+#include "relay.hpp"
 #include "room.hpp"
 
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace sfu {
 
-using RoomId = uint64_t;
-
 class Loop;
-class Client;
 
 class Router {
 public:
-    Router();
+    explicit Router(const Config& config);
     void Run();
 
 private:
-    void WsOpenCallback(std::shared_ptr<rtc::WebSocket> ws);
-    void WsClosedCallback(std::shared_ptr<rtc::WebSocket> ws);
-    void WsOnMessageCallback(std::shared_ptr<rtc::WebSocket> ws, rtc::message_variant&& message);
+    // Rooms and the clients connected to them are owned by exactly one shard
+    // and only touched from its loop thread.
+    struct Shard {
+        size_t Index;
+        std::shared_ptr<sfu::Loop> Loop;
+        std::map<RoomId, Room> Rooms;
+        ClientRegistry Clients;
+
+        // Other nodes with clients in our rooms, and the publishers they
+        // announced to us, with the time they were last heard of.
+        std::map<RoomId, std::map<std::shared_ptr<Trunk>, std::chrono::steady_clock::time_point>> RelaySubscribers;
+        std::map<std::pair<RoomId, ClientId>, std::chrono::steady_clock::time_point> RemotePublishers;
+
+        // Sessions whose WebSocket dropped, by resume token, with the timer
+        // ending them. They are out of Clients but still in their room.
+        struct SuspendedSession {
+            std::shared_ptr<Client> Session;
+            TimerId Expiry;
+        };
+        std::unordered_map<std::string, SuspendedSession> Suspended;
+
+        // From the first offer to ICE connected, and from our offer to the answer.
+        Histogram JoinDuration{SignalingLatencyBuckets};
+        Histogram RenegotiationDuration{SignalingLatencyBuckets};
+    };
+
+    using ShardTask = std::function<void(Shard&)>;
+
+    // Tells the publisher's subscribers whether its video is shown.
+    static void SendVideoMode(Shard& shard, RoomId roomId, ClientId publisherId, bool isActive);
+    // Tells a client that just joined which videos are shown, or with all
+    // set, the mode of every video track it receives.
+    static void SendVideoModes(Shard& shard, const std::shared_ptr<Client>& client, bool all = false);
+    // Tells the client who the room's current speakers are.
+    static void SendSpeakers(Room& room, const std::shared_ptr<Client>& client);
+    // Removes the client's participant. Subscribers keep its tracks
+    // negotiated for reuse, so its video is hidden explicitly.
+    void LeaveRoom(Shard& shard, const std::shared_ptr<Client>& client);
+    // Re-ranks the speakers of the shard's rooms and tells their clients.
+    static void UpdateSpeakers(Shard& shard);
+    // Promotes a client to speaker or demotes it to the audience on its
+    // existing connection.
+    void SetRole(Shard& shard, const std::shared_ptr<Client>& client, ParticipantRole role);
+
+    // Keeps the session of a client whose WebSocket dropped for the grace
+    // period; its media keeps flowing meanwhile.
+    void Suspend(Shard& shard, const std::shared_ptr<Client>& client);
+    // Takes the session with the token away from its WebSocket, whether that
+    // dropped already or not; null if there is none.
+    std::shared_ptr<Client> FindSession(Shard& shard, RoomId roomId, const std::string& token);
+    // Hands a session over to the client's new WebSocket.
+    void Resume(Shard& shard, const std::shared_ptr<Client>& client, RoomId roomId, const std::string& token);
+    // Leaves the room for a suspended session that wasn't resumed in time.
+    void EndSuspended(Shard& shard, const std::string& token);
+    // Sends from libdatachannel's threads, on the WebSocket the client has
+    // when the shard gets to it.
+    void SendSignaling(const std::shared_ptr<Client>& client, std::string message);
+
+    void WsOpenCallback(std::shared_ptr<Client> client);
+    void WsClosedCallback(std::shared_ptr<Client> client);
+    void WsOnMessageCallback(std::shared_ptr<Client> client, rtc::message_variant&& message);
+
+    void HandleOffer(Shard& shard, std::shared_ptr<Client> client, const TokenClaims& claims, std::string sdp);
+
+    void HandleRelayMessage(Shard& shard, const std::shared_ptr<Trunk>& trunk, const RelayMessage& message);
+    // Repeats subscriptions and announcements and expires stale ones.
+    void RefreshRelay(Shard& shard);
+    void UpdateRelayTargets(Shard& shard, RoomId roomId);
+    void AnnouncePublishers(Shard& shard, RoomId roomId, Trunk& trunk);
+    void AnnouncePublisher(Shard& shard, RoomId roomId, ClientId publisherId);
+    void RemoveRemotePublisher(Shard& shard, RoomId roomId, ClientId publisherId);
+    // Tells the other nodes a local publisher stopped publishing.
+    static void RelayLeave(Shard& shard, RoomId roomId, ClientId publisherId);
+
+    // Runs the task on the shard currently owning the client, after every
+    // task dispatched for the client before it, even across a move to
+    // another shard.
+    void Dispatch(const std::shared_ptr<Client>& client, ShardTask&& task);
+    // Runs the client's queued tasks on its shard until none are left.
+    void RunClientTasks(const std::shared_ptr<Client>& client);
+    size_t ShardForRoom(RoomId roomId) const;
+
+    // Prometheus page. Room membership is read on the shard loops; a loop
+    // that doesn't answer in time is left out of the scrape.
+    std::string RenderMetrics();
 
 private:
-    std::string PublicKey_;
+    Config Config_;
+    TokenVerifier TokenVerifier_;
     std::atomic_uint64_t IdGenerator_{1};
-    std::set<std::shared_ptr<Client>> Clients_;
 
-    std::map<RoomId, Room> Rooms_;
-    std::shared_ptr<Loop> Loop_;
+    std::vector<std::unique_ptr<Shard>> Shards_;
+
+    // Only set when other nodes are configured.
+    std::unique_ptr<Relay> Relay_;
+    std::unique_ptr<MetricsServer> MetricsServer_;
 };
 
 } // namespace sfu
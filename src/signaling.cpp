@@ -0,0 +1,404 @@
+#include "signaling.hpp"
+
+#include <charconv>
+#include <cmath>
+#include <limits>
+
+namespace sfu {
+
+namespace {
+
+constexpr size_t MaxDepth = 32;
+
+bool IsSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void SkipSpace(std::string_view text, size_t& pos) {
+    while (pos < text.size() && IsSpace(text[pos])) {
+        ++pos;
+    }
+}
+
+// Moves past a string starting at its opening quote. Escapes are checked
+// when the string is read.
+bool SkipString(std::string_view text, size_t& pos) {
+    for (++pos; pos < text.size(); ++pos) {
+        if (text[pos] == '\\') {
+            ++pos;
+        } else if (text[pos] == '"') {
+            ++pos;
+            return true;
+        } else if (static_cast<unsigned char>(text[pos]) < 0x20) {
+            return false;
+        }
+    }
+    return false;
+}
+
+bool IsDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Moves past one or more digits.
+bool SkipDigits(std::string_view text, size_t& pos) {
+    auto start = pos;
+    while (pos < text.size() && IsDigit(text[pos])) {
+        ++pos;
+    }
+    return pos > start;
+}
+
+// -? (0 | [1-9][0-9]*) (. [0-9]+)? ([eE] [+-]? [0-9]+)?
+bool SkipNumber(std::string_view text, size_t& pos) {
+    if (pos < text.size() && text[pos] == '-') {
+        ++pos;
+    }
+    if (pos < text.size() && text[pos] == '0') {
+        ++pos;
+    } else if (!SkipDigits(text, pos)) {
+        return false;
+    }
+
+    if (pos < text.size() && text[pos] == '.') {
+        ++pos;
+        if (!SkipDigits(text, pos)) {
+            return false;
+        }
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+        ++pos;
+        if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+            ++pos;
+        }
+        if (!SkipDigits(text, pos)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool SkipLiteral(std::string_view text, size_t& pos, std::string_view literal) {
+    if (text.substr(pos, literal.size()) != literal) {
+        return false;
+    }
+    pos += literal.size();
+    return true;
+}
+
+bool SkipValue(std::string_view text, size_t& pos, size_t depth = 0);
+
+// Moves past the members of an object or the elements of an array, from
+// the opening bracket on.
+bool SkipContainer(std::string_view text, size_t& pos, size_t depth) {
+    if (depth >= MaxDepth) {
+        return false;
+    }
+
+    bool object = text[pos] == '{';
+    char close = object ? '}' : ']';
+    ++pos;
+    SkipSpace(text, pos);
+    if (pos < text.size() && text[pos] == close) {
+        ++pos;
+        return true;
+    }
+
+    while (true) {
+        if (object) {
+            if (pos >= text.size() || text[pos] != '"' || !SkipString(text, pos)) {
+                return false;
+            }
+            SkipSpace(text, pos);
+            if (pos >= text.size() || text[pos] != ':') {
+                return false;
+            }
+            ++pos;
+            SkipSpace(text, pos);
+        }
+        if (!SkipValue(text, pos, depth + 1)) {
+            return false;
+        }
+
+        SkipSpace(text, pos);
+        if (pos < text.size() && text[pos] == ',') {
+            ++pos;
+            SkipSpace(text, pos);
+            continue;
+        }
+        if (pos < text.size() && text[pos] == close) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+}
+
+// Moves past any value, checking it against the JSON grammar.
+bool SkipValue(std::string_view text, size_t& pos, size_t depth) {
+    if (pos >= text.size()) {
+        return false;
+    }
+
+    switch (text[pos]) {
+        case '"':
+            return SkipString(text, pos);
+        case '{':
+        case '[':
+            return SkipContainer(text, pos, depth);
+        case 't':
+            return SkipLiteral(text, pos, "true");
+        case 'f':
+            return SkipLiteral(text, pos, "false");
+        case 'n':
+            return SkipLiteral(text, pos, "null");
+        default:
+            return SkipNumber(text, pos);
+    }
+}
+
+void AppendUtf8(std::string& out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+        out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+std::optional<uint32_t> ParseHex4(std::string_view text, size_t pos) {
+    uint32_t value = 0;
+    if (pos + 4 > text.size() || std::from_chars(text.data() + pos, text.data() + pos + 4, value, 16).ptr != text.data() + pos + 4) {
+        return {};
+    }
+    return value;
+}
+
+std::optional<std::string> Unescape(std::string_view raw) {
+    std::string out;
+    out.reserve(raw.size());
+    for (size_t i = 0; i < raw.size(); ++i) {
+        if (raw[i] != '\\') {
+            out += raw[i];
+            continue;
+        }
+        if (++i >= raw.size()) {
+            return {};
+        }
+
+        switch (raw[i]) {
+            case '"': out += '"'; break;
+            case '\\': out += '\\'; break;
+            case '/': out += '/'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'n': out += '\n'; break;
+            case 'r': out += '\r'; break;
+            case 't': out += '\t'; break;
+            case 'u': {
+                auto codePoint = ParseHex4(raw, i + 1);
+                if (!codePoint) {
+                    return {};
+                }
+                i += 4;
+                // A surrogate pair is written as two escapes.
+                if (*codePoint >= 0xD800 && *codePoint < 0xDC00 && i + 2 < raw.size() && raw[i + 1] == '\\' && raw[i + 2] == 'u') {
+                    if (auto low = ParseHex4(raw, i + 3); low && *low >= 0xDC00 && *low < 0xE000) {
+                        codePoint = 0x10000 + ((*codePoint - 0xD800) << 10) + (*low - 0xDC00);
+                        i += 6;
+                    }
+                }
+                AppendUtf8(out, *codePoint);
+                break;
+            }
+            default:
+                return {};
+        }
+    }
+    return out;
+}
+
+template <typename T>
+std::optional<T> ParseIntegral(std::string_view value) {
+    auto end = value.data() + value.size();
+    T result = 0;
+    if (auto [ptr, ec] = std::from_chars(value.data(), end, result); ec == std::errc() && ptr == end) {
+        return result;
+    }
+
+    // The maxima round up to powers of two, themselves out of range.
+    double number = 0;
+    if (auto [ptr, ec] = std::from_chars(value.data(), end, number); ec != std::errc() || ptr != end) {
+        return {};
+    }
+    if (number != std::trunc(number) || number < static_cast<double>(std::numeric_limits<T>::min()) || number >= static_cast<double>(std::numeric_limits<T>::max())) {
+        return {};
+    }
+    return static_cast<T>(number);
+}
+
+} // namespace
+
+SignalingMessage::SignalingMessage(std::string_view text) {
+    size_t pos = 0;
+    SkipSpace(text, pos);
+    if (pos >= text.size() || text[pos] != '{') {
+        return;
+    }
+    ++pos;
+    SkipSpace(text, pos);
+
+    if (pos < text.size() && text[pos] == '}') {
+        ++pos;
+    } else {
+        while (true) {
+            if (pos >= text.size() || text[pos] != '"') {
+                return;
+            }
+            auto keyStart = pos + 1;
+            if (!SkipString(text, pos)) {
+                return;
+            }
+            auto key = text.substr(keyStart, pos - 1 - keyStart);
+
+            SkipSpace(text, pos);
+            if (pos >= text.size() || text[pos] != ':') {
+                return;
+            }
+            ++pos;
+            SkipSpace(text, pos);
+
+            auto valueStart = pos;
+            if (!SkipValue(text, pos)) {
+                return;
+            }
+            if (FieldCount_ < MaxFields) {
+                Fields_[FieldCount_++] = {key, text.substr(valueStart, pos - valueStart)};
+            }
+
+            SkipSpace(text, pos);
+            if (pos < text.size() && text[pos] == ',') {
+                ++pos;
+                SkipSpace(text, pos);
+                continue;
+            }
+            if (pos < text.size() && text[pos] == '}') {
+                ++pos;
+                break;
+            }
+            return;
+        }
+    }
+
+    SkipSpace(text, pos);
+    Valid_ = pos == text.size();
+}
+
+std::optional<std::string_view> SignalingMessage::Find(std::string_view key) const {
+    // Like nlohmann::json, a repeated key takes the last value.
+    for (size_t i = FieldCount_; i-- > 0;) {
+        if (Fields_[i].Key == key) {
+            return Fields_[i].Value;
+        }
+    }
+    return {};
+}
+
+bool SignalingMessage::IsNull(std::string_view key) const {
+    return Find(key) == "null";
+}
+
+std::optional<std::string_view> SignalingMessage::GetRawString(std::string_view key) const {
+    auto value = Find(key);
+    if (!value || value->size() < 2 || value->front() != '"') {
+        return {};
+    }
+    return value->substr(1, value->size() - 2);
+}
+
+std::optional<std::string> SignalingMessage::GetString(std::string_view key) const {
+    auto raw = GetRawString(key);
+    if (!raw) {
+        return {};
+    }
+    return Unescape(*raw);
+}
+
+std::optional<uint64_t> SignalingMessage::GetUnsigned(std::string_view key) const {
+    auto value = Find(key);
+    return value ? ParseIntegral<uint64_t>(*value) : std::nullopt;
+}
+
+std::optional<int64_t> SignalingMessage::GetInteger(std::string_view key) const {
+    auto value = Find(key);
+    return value ? ParseIntegral<int64_t>(*value) : std::nullopt;
+}
+
+std::optional<bool> SignalingMessage::GetBool(std::string_view key) const {
+    auto value = Find(key);
+    if (value == "true") {
+        return true;
+    } else if (value == "false") {
+        return false;
+    }
+    return {};
+}
+
+std::string_view SignalingMessage::GetRaw(std::string_view key) const {
+    return Find(key).value_or(std::string_view());
+}
+
+void AppendJsonString(std::string& out, std::string_view value) {
+    static constexpr char Hex[] = "0123456789abcdef";
+
+    out += '"';
+    for (char c : value) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    out += "\\u00";
+                    out += Hex[c >> 4];
+                    out += Hex[c & 0xF];
+                } else {
+                    out += c;
+                }
+        }
+    }
+    out += '"';
+}
+
+std::string MakeModeMessage(rtc::SSRC ssrc, bool active) {
+    std::string out = R"({"type":"mode","ssrc":)";
+    out += std::to_string(ssrc);
+    out += active ? R"(,"active":true})" : R"(,"active":false})";
+    return out;
+}
+
+std::string MakeCandidateMessage(std::string_view candidate, std::string_view mid) {
+    std::string out;
+    out.reserve(candidate.size() + mid.size() + 48);
+    out += R"({"type":"candidate","candidate":)";
+    AppendJsonString(out, candidate);
+    if (!mid.empty()) {
+        out += R"(,"sdpMid":)";
+        AppendJsonString(out, mid);
+    }
+    out += '}';
+    return out;
+}
+
+} // namespace sfu
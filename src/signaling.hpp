@@ -0,0 +1,74 @@
+#pragma once
+
+#include <rtc/rtc.hpp>
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace sfu {
+
+// Fields of a flat JSON object, read in place without building a DOM. The
+// whole text is checked against the JSON grammar, but only the first
+// MaxFields fields of the top level are indexed; nested values are skipped
+// over and can only be told apart from null. Meant for the frequent
+// signaling messages, answers included; only offers, which carry a token,
+// go through nlohmann::json.
+class SignalingMessage {
+public:
+    static constexpr size_t MaxFields = 16;
+
+    explicit SignalingMessage(std::string_view text);
+
+    // False if the text isn't a JSON object. Escapes in strings are only
+    // checked when the string is read.
+    bool IsValid() const {
+        return Valid_;
+    }
+
+    bool Contains(std::string_view key) const {
+        return Find(key).has_value();
+    }
+
+    bool IsNull(std::string_view key) const;
+
+    // Contents of a string field as they appear in the text, escapes
+    // included. Enough to compare against names that need no escaping.
+    std::optional<std::string_view> GetRawString(std::string_view key) const;
+    std::optional<std::string> GetString(std::string_view key) const;
+    // Integral numbers written as floats, like 1.0 or 1e0, are accepted
+    // too, as nlohmann::json does.
+    std::optional<uint64_t> GetUnsigned(std::string_view key) const;
+    std::optional<int64_t> GetInteger(std::string_view key) const;
+    std::optional<bool> GetBool(std::string_view key) const;
+
+    // The raw value, for logging.
+    std::string_view GetRaw(std::string_view key) const;
+
+private:
+    struct Field {
+        std::string_view Key;
+        std::string_view Value;
+    };
+
+    std::optional<std::string_view> Find(std::string_view key) const;
+
+    std::array<Field, MaxFields> Fields_;
+    size_t FieldCount_ = 0;
+    bool Valid_ = false;
+};
+
+// Appends the value as a quoted JSON string.
+void AppendJsonString(std::string& out, std::string_view value);
+
+// Constant replies, serialized once.
+constexpr std::string_view PongMessage = R"({"type":"pong"})";
+
+// {"type":"mode","ssrc":...,"active":...}
+std::string MakeModeMessage(rtc::SSRC ssrc, bool active);
+// {"type":"candidate","candidate":...,"sdpMid":...}; without a mid if empty.
+std::string MakeCandidateMessage(std::string_view candidate, std::string_view mid);
+
+} // namespace sfu
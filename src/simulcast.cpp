@@ -0,0 +1,305 @@
+#include "simulcast.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <string_view>
+#include <utility>
+
+namespace sfu {
+
+namespace {
+
+constexpr std::string_view RidExtensionUri = "urn:ietf:params:rtp-hdrext:sdes:rtp-stream-id";
+constexpr std::string_view SimulcastSendPrefix = "simulcast:send ";
+
+std::vector<std::string> Split(std::string_view value, char separator) {
+    std::vector<std::string> result;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        auto end = value.find(separator, begin);
+        if (end == std::string_view::npos) {
+            end = value.size();
+        }
+        if (end > begin) {
+            result.emplace_back(value.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    return result;
+}
+
+rtc::binary BuildPli(rtc::SSRC mediaSsrc) {
+    rtc::binary pli(12);
+    auto header = reinterpret_cast<rtc::RtcpFbHeader*>(pli.data());
+    header->header.prepareHeader(206, 1, 2);
+    header->setPacketSenderSSRC(1);
+    header->setMediaSourceSSRC(mediaSsrc);
+    return pli;
+}
+
+using SdpSection = std::vector<std::string>;
+
+// Splits an SDP into the session part and one part per m-line.
+std::vector<SdpSection> SplitSections(const std::string& sdp) {
+    std::vector<SdpSection> sections(1);
+    std::istringstream stream(sdp);
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+        if (line.starts_with("m=")) {
+            sections.emplace_back();
+        }
+        sections.back().push_back(std::move(line));
+    }
+    return sections;
+}
+
+} // namespace
+
+SimulcastDescription ParseSimulcast(const rtc::Description::Media& media) {
+    SimulcastDescription description;
+
+    auto mutableMedia = media;
+    for (auto id : mutableMedia.extIds()) {
+        if (auto map = mutableMedia.extMap(id); map && map->uri == RidExtensionUri) {
+            description.RidExtensionId = id;
+        }
+    }
+
+    std::vector<std::string> sendRids;
+    for (const auto& attribute : media.attributes()) {
+        std::string_view view = attribute;
+        if (view.starts_with(SimulcastSendPrefix)) {
+            // "q;h;f", each entry possibly a comma separated list of
+            // alternatives with '~' marking paused streams.
+            for (const auto& stream : Split(view.substr(SimulcastSendPrefix.size()), ';')) {
+                auto alternatives = Split(stream, ',');
+                if (alternatives.empty()) {
+                    continue;
+                }
+                auto rid = alternatives.front();
+                if (rid.starts_with('~')) {
+                    rid.erase(0, 1);
+                }
+                description.Rids.push_back(rid);
+            }
+        } else if (view.starts_with("rid:")) {
+            auto fields = Split(view.substr(4), ' ');
+            if (fields.size() >= 2 && fields[1] == "send") {
+                sendRids.push_back(fields[0]);
+            }
+        }
+    }
+
+    if (description.Rids.empty()) {
+        description.Rids = std::move(sendRids);
+    }
+    if (description.Rids.size() > MaxSimulcastLayers) {
+        description.Rids.resize(MaxSimulcastLayers);
+    }
+    if (description.Rids.size() < 2 || description.RidExtensionId == 0) {
+        description.Rids.clear();
+    }
+
+    return description;
+}
+
+SimulcastReceiver::SimulcastReceiver(SimulcastDescription description)
+    : Description_(std::move(description))
+{ }
+
+int SimulcastReceiver::Classify(const RtpPacket& packet) {
+    auto ssrc = packet.Header()->ssrc();
+
+    if (Description_.Rids.empty()) {
+        LayerSsrcs_[0].store(ssrc, std::memory_order_relaxed);
+        return 0;
+    }
+
+    // Browsers only attach the RID until the SSRC is known to be mapped, so
+    // remember the mapping from the packets that carry it.
+    auto value = packet.FindExtension(Description_.RidExtensionId);
+    if (!value.empty()) {
+        std::string_view rid(reinterpret_cast<const char*>(value.data()), value.size());
+        auto it = std::find(Description_.Rids.begin(), Description_.Rids.end(), rid);
+        if (it != Description_.Rids.end()) {
+            int layer = it - Description_.Rids.begin();
+            if (Layers_.emplace(ssrc, layer).second) {
+                LayerSsrcs_[layer].store(ssrc, std::memory_order_relaxed);
+            }
+            return layer;
+        }
+    }
+
+    auto it = Layers_.find(ssrc);
+    return it != Layers_.end() ? it->second : -1;
+}
+
+void SimulcastReceiver::Measure(int layer, size_t bytes, std::chrono::steady_clock::time_point now) {
+    constexpr auto Window = std::chrono::seconds(1);
+
+    if (now - WindowStart_ >= Window) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - WindowStart_).count();
+        for (size_t i = 0; i < MaxSimulcastLayers; ++i) {
+            auto bitrate = elapsed < 2 * 1000 ? WindowBytes_[i] * 8 * 1000 / elapsed : 0;
+            LayerBitrates_[i].store(static_cast<uint32_t>(bitrate), std::memory_order_relaxed);
+            WindowBytes_[i] = 0;
+        }
+        WindowStart_ = now;
+    }
+
+    WindowBytes_[layer] += bytes;
+}
+
+size_t SimulcastReceiver::GetLayerFor(uint32_t bitrate) const {
+    auto highest = GetLayerCount() - 1;
+    if (bitrate == 0) {
+        return highest;
+    }
+
+    for (size_t layer = highest; layer > 0; --layer) {
+        if (GetLayerBitrate(layer) <= bitrate) {
+            return layer;
+        }
+    }
+    return 0;
+}
+
+int LayerSelector::GetEffectiveTarget(size_t layerCount, size_t maxLayer) const {
+    int target = GetTarget();
+    if (target == Highest || target >= static_cast<int>(layerCount)) {
+        target = layerCount - 1;
+    }
+    return std::min(target, static_cast<int>(maxLayer));
+}
+
+bool LayerSelector::Accept(int layer, bool keyframe, size_t layerCount, size_t maxLayer) {
+    if (layer < 0) {
+        return false;
+    }
+
+    int target = GetEffectiveTarget(layerCount, maxLayer);
+    int current = GetCurrent();
+
+    if (layer == target && layer != current && keyframe) {
+        current = layer;
+        SetCurrent(current);
+    }
+
+    if (target != current && target != Requested_) {
+        Requested_ = target;
+        Pending_ = target;
+    } else if (target == current) {
+        Requested_ = -1;
+    }
+
+    return layer == current;
+}
+
+std::optional<size_t> LayerSelector::TakeKeyframeRequest() {
+    if (Pending_ < 0) {
+        return {};
+    }
+    return std::exchange(Pending_, -1);
+}
+
+void VideoReceivingSession::AddKeyframeRequest(const std::vector<rtc::SSRC>& ssrcs) {
+    std::lock_guard<std::mutex> lock(Mutex_);
+    for (auto ssrc : ssrcs) {
+        if (ssrc && std::find(PendingSsrcs_.begin(), PendingSsrcs_.end(), ssrc) == PendingSsrcs_.end()) {
+            PendingSsrcs_.push_back(ssrc);
+        }
+    }
+}
+
+bool VideoReceivingSession::requestKeyframe(const rtc::message_callback& send) {
+    std::vector<rtc::SSRC> ssrcs;
+    {
+        std::lock_guard<std::mutex> lock(Mutex_);
+        ssrcs.swap(PendingSsrcs_);
+    }
+
+    if (ssrcs.empty()) {
+        return rtc::RtcpReceivingSession::requestKeyframe(send);
+    }
+
+    for (auto ssrc : ssrcs) {
+        send(rtc::make_message(BuildPli(ssrc), rtc::Message::Control));
+    }
+    return true;
+}
+
+void VideoReceivingSession::incoming(rtc::message_vector& messages, const rtc::message_callback& send) {
+    rtc::RtcpReceivingSession::incoming(messages, send);
+    if (!SendNacks_) {
+        return;
+    }
+
+    auto now = LossDetector::Clock::now();
+    std::vector<uint16_t> nacks;
+
+    std::lock_guard<std::mutex> lock(LossMutex_);
+    for (const auto& message : messages) {
+        if (!message || message->type != rtc::Message::Binary || message->size() < RtpFixedHeaderSize) {
+            continue;
+        }
+
+        auto header = reinterpret_cast<const rtc::RtpHeader*>(message->data());
+        nacks.clear();
+        Loss_[header->ssrc()].OnPacket(header->seqNumber(), now, nacks);
+        if (!nacks.empty()) {
+            send(rtc::make_message(BuildNack(header->ssrc(), nacks), rtc::Message::Control));
+        }
+    }
+}
+
+std::string AcceptSimulcast(const std::string& offer, const std::string& answer) {
+    auto offerSections = SplitSections(offer);
+    auto answerSections = SplitSections(answer);
+
+    bool changed = false;
+    for (size_t i = 1; i < answerSections.size() && i < offerSections.size(); ++i) {
+        SdpSection accepted;
+        for (const auto& line : offerSections[i]) {
+            if (line.starts_with("a=simulcast:send ")) {
+                accepted.push_back("a=simulcast:recv " + line.substr(17));
+            } else if (line.starts_with("a=rid:")) {
+                auto fields = Split(std::string_view(line).substr(6), ' ');
+                if (fields.size() >= 2 && fields[1] == "send") {
+                    accepted.push_back("a=rid:" + fields[0] + " recv");
+                }
+            }
+        }
+
+        if (accepted.empty()) {
+            continue;
+        }
+
+        auto& section = answerSections[i];
+        std::erase_if(section, [](const std::string& line) {
+            return line.starts_with("a=simulcast:") || line.starts_with("a=rid:");
+        });
+        section.insert(section.end(), accepted.begin(), accepted.end());
+        changed = true;
+    }
+
+    if (!changed) {
+        return answer;
+    }
+
+    std::string result;
+    for (const auto& section : answerSections) {
+        for (const auto& line : section) {
+            result += line;
+            result += "\r\n";
+        }
+    }
+    return result;
+}
+
+} // namespace sfu
@@ -0,0 +1,146 @@
+#pragma once
+
+#include "fanout.hpp"
+#include "nack.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace sfu {
+
+constexpr size_t MaxSimulcastLayers = 4;
+
+// Simulcast parameters of a published video m-line.
+struct SimulcastDescription {
+    int RidExtensionId = 0;
+
+    // RIDs in the order listed by a=simulcast, lowest quality first.
+    std::vector<std::string> Rids;
+};
+
+SimulcastDescription ParseSimulcast(const rtc::Description::Media& media);
+
+// Tells which simulcast layer an incoming video packet belongs to. Without
+// simulcast every packet is layer 0. Classify() is only called from the
+// publisher's media thread.
+class SimulcastReceiver {
+public:
+    explicit SimulcastReceiver(SimulcastDescription description);
+
+    size_t GetLayerCount() const {
+        return std::max<size_t>(1, Description_.Rids.size());
+    }
+
+    // Layer of the packet, or -1 if it can't be attributed to one.
+    int Classify(const RtpPacket& packet);
+
+    // Accounts a packet of the layer towards its measured bitrate.
+    void Measure(int layer, size_t bytes, std::chrono::steady_clock::time_point now);
+
+    // Bits per second over the last measurement window, 0 if unknown.
+    uint32_t GetLayerBitrate(size_t layer) const {
+        return layer < LayerBitrates_.size() ? LayerBitrates_[layer].load(std::memory_order_relaxed) : 0;
+    }
+
+    // Highest layer whose bitrate fits into the given share; every layer
+    // fits an unlimited (0) share.
+    size_t GetLayerFor(uint32_t bitrate) const;
+
+    // Last SSRC seen for the layer, 0 if none yet.
+    rtc::SSRC GetLayerSsrc(size_t layer) const {
+        return layer < LayerSsrcs_.size() ? LayerSsrcs_[layer].load(std::memory_order_relaxed) : 0;
+    }
+
+private:
+    const SimulcastDescription Description_;
+
+    std::unordered_map<rtc::SSRC, int> Layers_;
+    std::array<std::atomic<rtc::SSRC>, MaxSimulcastLayers> LayerSsrcs_{};
+
+    std::chrono::steady_clock::time_point WindowStart_;
+    std::array<uint64_t, MaxSimulcastLayers> WindowBytes_{};
+    std::array<std::atomic<uint32_t>, MaxSimulcastLayers> LayerBitrates_{};
+};
+
+// Layer a subscriber receives from one publisher. The target is set from
+// signaling; the media thread switches to it at the target's next key frame
+// so the decoder never sees a partial GOP.
+class LayerSelector {
+public:
+    static constexpr int Highest = -1;
+
+    void SetTarget(int layer) {
+        Target_.store(layer, std::memory_order_relaxed);
+    }
+
+    int GetTarget() const {
+        return Target_.load(std::memory_order_relaxed);
+    }
+
+    // Layer to switch to, with the target capped at maxLayer, e.g. by bandwidth.
+    int GetEffectiveTarget(size_t layerCount, size_t maxLayer) const;
+
+    // Whether a packet of the given layer goes to this subscriber.
+    bool Accept(int layer, bool keyframe, size_t layerCount, size_t maxLayer);
+
+    // Starts forwarding a layer without waiting for a key frame, e.g. after
+    // its current GOP was replayed from the cache.
+    void SetCurrent(int layer) {
+        Current_.store(layer, std::memory_order_relaxed);
+    }
+
+    // Layer currently forwarded, -1 before the first one. Readable from any thread.
+    int GetCurrent() const {
+        return Current_.load(std::memory_order_relaxed);
+    }
+
+    // Layer waiting for a key frame, reported once per switch.
+    std::optional<size_t> TakeKeyframeRequest();
+
+private:
+    std::atomic<int> Target_ = Highest;
+    std::atomic<int> Current_ = -1;
+    int Requested_ = -1;
+    int Pending_ = -1;
+};
+
+// Receiving session for published video that can ask for key frames on
+// specific simulcast layers rather than only the last SSRC it saw. With
+// sendNacks it also NACKs packets lost on the way from the publisher, per
+// SSRC, so they are recovered before subscribers notice.
+class VideoReceivingSession : public rtc::RtcpReceivingSession {
+public:
+    explicit VideoReceivingSession(bool sendNacks = false)
+        : SendNacks_(sendNacks)
+    { }
+
+    // The SSRCs are asked for a key frame on the next requestKeyframe().
+    void AddKeyframeRequest(const std::vector<rtc::SSRC>& ssrcs);
+
+    bool requestKeyframe(const rtc::message_callback& send) override;
+
+    void incoming(rtc::message_vector& messages, const rtc::message_callback& send) override;
+
+private:
+    std::mutex Mutex_;
+    std::vector<rtc::SSRC> PendingSsrcs_;
+
+    const bool SendNacks_;
+    std::mutex LossMutex_;
+    std::unordered_map<rtc::SSRC, LossDetector> Loss_;
+};
+
+// Turns the publisher's a=rid/a=simulcast send attributes into their receive
+// counterparts in our answer, so browsers keep sending every layer.
+std::string AcceptSimulcast(const std::string& offer, const std::string& answer);
+
+} // namespace sfu
@@ -0,0 +1,79 @@
+#include "speaker.hpp"
+
+#include <algorithm>
+
+namespace sfu {
+
+namespace {
+
+int64_t ToMilliseconds(AudioLevelMeter::Clock::time_point time) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+}
+
+} // namespace
+
+int FindExtensionId(const rtc::Description::Media& media, std::string_view uri) {
+    auto mutableMedia = media;
+    for (auto id : mutableMedia.extIds()) {
+        if (auto map = mutableMedia.extMap(id); map && map->uri == uri) {
+            return id;
+        }
+    }
+    return 0;
+}
+
+void AudioLevelMeter::Update(uint8_t level, Clock::time_point now) {
+    // Moving average over roughly 8 packets, i.e. 160 ms of Opus.
+    uint32_t sample = (127 - std::min<uint32_t>(level, 127)) << 8;
+    auto loudness = Loudness_.load(std::memory_order_relaxed);
+    if (ToMilliseconds(now) - LastUpdate_.load(std::memory_order_relaxed) > std::chrono::milliseconds(Timeout).count()) {
+        loudness = 0;
+    }
+    loudness = loudness + (static_cast<int32_t>(sample - loudness) >> 3);
+
+    Loudness_.store(loudness, std::memory_order_relaxed);
+    LastUpdate_.store(ToMilliseconds(now), std::memory_order_relaxed);
+}
+
+uint32_t AudioLevelMeter::GetLoudness(Clock::time_point now) const {
+    if (ToMilliseconds(now) - LastUpdate_.load(std::memory_order_relaxed) > std::chrono::milliseconds(Timeout).count()) {
+        return 0;
+    }
+    return Loudness_.load(std::memory_order_relaxed) >> 8;
+}
+
+bool SpeakerRanking::Update(std::vector<std::pair<ClientId, uint32_t>> loudness) {
+    std::erase_if(loudness, [](const auto& entry) {
+        return entry.second < ActiveLoudness;
+    });
+
+    for (auto& [id, value] : loudness) {
+        if (std::find(Speakers_.begin(), Speakers_.end(), id) != Speakers_.end()) {
+            value += Hysteresis;
+        }
+    }
+
+    // Ties keep the previous order.
+    std::stable_sort(loudness.begin(), loudness.end(), [this](const auto& lhs, const auto& rhs) {
+        if (lhs.second != rhs.second) {
+            return lhs.second > rhs.second;
+        }
+        auto lhsRank = std::find(Speakers_.begin(), Speakers_.end(), lhs.first);
+        auto rhsRank = std::find(Speakers_.begin(), Speakers_.end(), rhs.first);
+        return lhsRank < rhsRank;
+    });
+
+    std::vector<ClientId> speakers;
+    speakers.reserve(loudness.size());
+    for (const auto& [id, value] : loudness) {
+        speakers.push_back(id);
+    }
+
+    if (speakers == Speakers_) {
+        return false;
+    }
+    Speakers_ = std::move(speakers);
+    return true;
+}
+
+} // namespace sfu
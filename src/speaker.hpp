@@ -0,0 +1,63 @@
+#pragma once
+
+#include <rtc/rtc.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace sfu {
+
+using ClientId = uint64_t;
+
+constexpr std::string_view AudioLevelUri = "urn:ietf:params:rtp-hdrext:ssrc-audio-level";
+
+// Id the m-line maps the header extension URI to, 0 if it isn't negotiated.
+int FindExtensionId(const rtc::Description::Media& media, std::string_view uri);
+
+// Smoothed loudness of one published audio stream, from the RFC 6464 level
+// every packet carries. Updated on the publisher's media thread and read
+// by the room.
+class AudioLevelMeter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Streams that stopped sending, e.g. Opus DTX, count as silent after this.
+    static constexpr auto Timeout = std::chrono::milliseconds(500);
+
+    // Level in -dBov: 0 is the loudest, 127 silence.
+    void Update(uint8_t level, Clock::time_point now);
+
+    // 0 for silence up to 127 for the loudest.
+    uint32_t GetLoudness(Clock::time_point now) const;
+
+private:
+    // Fixed point, 8 fractional bits.
+    std::atomic<uint32_t> Loudness_ = 0;
+    std::atomic<int64_t> LastUpdate_ = 0;
+};
+
+// Active speakers of a room, loudest first. A current speaker keeps its
+// place unless someone else is louder by Hysteresis, so the order doesn't
+// flap between people talking at the same volume.
+class SpeakerRanking {
+public:
+    // Quieter than -60 dBov is not speech.
+    static constexpr uint32_t ActiveLoudness = 127 - 60;
+    static constexpr uint32_t Hysteresis = 6;
+
+    // Takes the loudness of every participant; true if the ranking changed.
+    bool Update(std::vector<std::pair<ClientId, uint32_t>> loudness);
+
+    const std::vector<ClientId>& GetSpeakers() const {
+        return Speakers_;
+    }
+
+private:
+    std::vector<ClientId> Speakers_;
+};
+
+} // namespace sfu
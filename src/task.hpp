@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sfu {
+
+// Move-only type-erased callable. Callables that fit into InlineSize bytes
+// are stored in place, larger ones are moved to the heap.
+class Task {
+public:
+    static constexpr size_t InlineSize = 64;
+
+    Task() = default;
+
+    template <typename F>
+        requires (!std::is_same_v<std::decay_t<F>, Task> && std::is_invocable_r_v<void, std::decay_t<F>&>)
+    Task(F&& f) {
+        using Callable = std::decay_t<F>;
+        if constexpr (IsInline<Callable>) {
+            new (Storage_) Callable(std::forward<F>(f));
+            VTable_ = &InlineVTable<Callable>;
+        } else {
+            *reinterpret_cast<Callable**>(Storage_) = new Callable(std::forward<F>(f));
+            VTable_ = &HeapVTable<Callable>;
+        }
+    }
+
+    Task(Task&& other) noexcept {
+        MoveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task() {
+        Reset();
+    }
+
+    explicit operator bool() const {
+        return VTable_ != nullptr;
+    }
+
+    void operator()() {
+        VTable_->Invoke(Storage_);
+    }
+
+private:
+    struct VTable {
+        void (*Invoke)(void* storage);
+        void (*Move)(void* to, void* from);
+        void (*Destroy)(void* storage);
+    };
+
+    template <typename Callable>
+    static constexpr bool IsInline = sizeof(Callable) <= InlineSize
+        && alignof(Callable) <= alignof(std::max_align_t)
+        && std::is_nothrow_move_constructible_v<Callable>;
+
+    template <typename Callable>
+    static constexpr VTable InlineVTable = {
+        [](void* storage) { (*std::launder(reinterpret_cast<Callable*>(storage)))(); },
+        [](void* to, void* from) {
+            auto source = std::launder(reinterpret_cast<Callable*>(from));
+            new (to) Callable(std::move(*source));
+            source->~Callable();
+        },
+        [](void* storage) { std::launder(reinterpret_cast<Callable*>(storage))->~Callable(); },
+    };
+
+    template <typename Callable>
+    static constexpr VTable HeapVTable = {
+        [](void* storage) { (**reinterpret_cast<Callable**>(storage))(); },
+        [](void* to, void* from) { *reinterpret_cast<Callable**>(to) = *reinterpret_cast<Callable**>(from); },
+        [](void* storage) { delete *reinterpret_cast<Callable**>(storage); },
+    };
+
+    void MoveFrom(Task& other) {
+        if (other.VTable_) {
+            other.VTable_->Move(Storage_, other.Storage_);
+            VTable_ = std::exchange(other.VTable_, nullptr);
+        }
+    }
+
+    void Reset() {
+        if (VTable_) {
+            VTable_->Destroy(Storage_);
+            VTable_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) std::byte Storage_[InlineSize];
+    const VTable* VTable_ = nullptr;
+};
+
+} // namespace sfu
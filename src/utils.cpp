@@ -1,13 +1,14 @@
 #include "utils.hpp"
 
+#include "log.hpp"
+
 #include <fstream>
-#include <iostream>
 #include <sstream>
 
 std::string ReadPemFile(const std::string& filePath) {
     std::ifstream keyFile(filePath);
     if (!keyFile.is_open()) {
-        std::cerr << "Error: Could not open file " << filePath << std::endl;
+        LOG_ERROR() << "Could not open file " << filePath;
         return {};
     }
     std::stringstream buffer;
@@ -0,0 +1,95 @@
+#include "check.hpp"
+
+#include "bandwidth.hpp"
+
+#include <chrono>
+
+namespace {
+
+using sfu::BandwidthEstimator;
+using namespace std::chrono_literals;
+
+const auto Start = BandwidthEstimator::Clock::time_point(1000s);
+
+void TestUnlimitedWithoutFeedback() {
+    BandwidthEstimator bandwidth;
+    bandwidth.AddStream();
+
+    CHECK(bandwidth.GetEstimate() == 0);
+    CHECK(bandwidth.GetStreamShare() == 0);
+    CHECK(bandwidth.TryConsume(1'000'000, Start));
+
+    // Loss alone has nothing to back off from.
+    bandwidth.OnReceiverReport(255);
+    CHECK(bandwidth.GetEstimate() == 0);
+}
+
+void TestLossBacksOffBelowRemb() {
+    BandwidthEstimator bandwidth;
+    bandwidth.OnRemb(1'000'000);
+    CHECK(bandwidth.GetEstimate() == 1'000'000);
+
+    // Half the loss fraction comes off.
+    bandwidth.OnReceiverReport(128);
+    CHECK(bandwidth.GetEstimate() == 750'000);
+
+    // Moderate loss holds the estimate.
+    bandwidth.OnReceiverReport(10);
+    CHECK(bandwidth.GetEstimate() == 750'000);
+
+    // A clean link probes back up, but never past REMB.
+    bandwidth.OnReceiverReport(0);
+    CHECK(bandwidth.GetEstimate() == 787'500);
+    for (int i = 0; i < 20; ++i) {
+        bandwidth.OnReceiverReport(0);
+    }
+    CHECK(bandwidth.GetEstimate() == 1'000'000);
+
+    bandwidth.OnRemb(500'000);
+    CHECK(bandwidth.GetEstimate() == 500'000);
+}
+
+void TestStreamShare() {
+    BandwidthEstimator bandwidth;
+    bandwidth.OnRemb(900'000);
+    CHECK(bandwidth.GetStreamShare() == 900'000);
+
+    bandwidth.AddStream();
+    bandwidth.AddStream();
+    bandwidth.AddStream();
+    CHECK(bandwidth.GetStreamShare() == 300'000);
+
+    bandwidth.RemoveStream();
+    CHECK(bandwidth.GetStreamShare() == 450'000);
+}
+
+void TestTokenBucket() {
+    BandwidthEstimator bandwidth;
+    // 1 MB/s, so the 100 ms burst is 100 kB and 1 ms refills 1 kB.
+    bandwidth.OnRemb(8'000'000);
+
+    CHECK(bandwidth.TryConsume(100'000, Start));
+    CHECK(!bandwidth.TryConsume(1, Start));
+
+    CHECK(bandwidth.TryConsume(1'000, Start + 1ms));
+    CHECK(!bandwidth.TryConsume(1, Start + 1ms));
+
+    // Audio is charged regardless and puts the bucket into debt.
+    bandwidth.Consume(2'000, Start + 1ms);
+    CHECK(!bandwidth.TryConsume(1, Start + 2ms));
+    CHECK(bandwidth.TryConsume(1'000, Start + 4ms));
+
+    // An idle subscriber saves up no more than the burst.
+    CHECK(bandwidth.TryConsume(100'000, Start + 10s));
+    CHECK(!bandwidth.TryConsume(1, Start + 10s));
+}
+
+} // namespace
+
+int main() {
+    TestUnlimitedWithoutFeedback();
+    TestLossBacksOffBelowRemb();
+    TestStreamShare();
+    TestTokenBucket();
+    return 0;
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+
+// Like assert, but kept in release builds and naming the failed condition.
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+            std::exit(1); \
+        } \
+    } while (false)
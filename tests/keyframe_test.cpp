@@ -0,0 +1,73 @@
+#include "check.hpp"
+
+#include "keyframe.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace {
+
+using sfu::KeyframeArbiter;
+using namespace std::chrono_literals;
+
+const auto Start = KeyframeArbiter::Clock::time_point(1000s);
+
+struct Recorder {
+    KeyframeArbiter Arbiter{[this](KeyframeArbiter::LayerMask layers) {
+        Forwarded.push_back(layers);
+    }};
+    std::vector<KeyframeArbiter::LayerMask> Forwarded;
+};
+
+void TestFirstRequestGoesOut() {
+    Recorder recorder;
+    recorder.Arbiter.Request(1, KeyframeArbiter::Source::Internal, Start);
+    CHECK(recorder.Forwarded == std::vector<KeyframeArbiter::LayerMask>{0b10});
+}
+
+void TestCoalescesWithinInterval() {
+    Recorder recorder;
+    recorder.Arbiter.Request(0, KeyframeArbiter::Source::Internal, Start);
+    recorder.Arbiter.Request(2, KeyframeArbiter::Source::Pli, Start + 100ms);
+    recorder.Arbiter.Request(1, KeyframeArbiter::Source::Fir, Start + 200ms);
+    recorder.Arbiter.Poll(Start + 499ms);
+    CHECK(recorder.Forwarded.size() == 1);
+
+    // Both held back requests leave together once the window ends.
+    recorder.Arbiter.Poll(Start + 500ms);
+    CHECK((recorder.Forwarded == std::vector<KeyframeArbiter::LayerMask>{0b001, 0b110}));
+
+    // Nothing left to send.
+    recorder.Arbiter.Poll(Start + 2s);
+    CHECK(recorder.Forwarded.size() == 2);
+}
+
+void TestAllLayers() {
+    Recorder recorder;
+    recorder.Arbiter.Request(std::nullopt, KeyframeArbiter::Source::Pli, Start);
+    CHECK(recorder.Forwarded == std::vector<KeyframeArbiter::LayerMask>{KeyframeArbiter::AllLayers});
+}
+
+void TestStats() {
+    Recorder recorder;
+    recorder.Arbiter.Request(0, KeyframeArbiter::Source::Pli, Start);
+    recorder.Arbiter.Request(0, KeyframeArbiter::Source::Pli, Start + 10ms);
+    recorder.Arbiter.Request(0, KeyframeArbiter::Source::Fir, Start + 20ms);
+    recorder.Arbiter.Request(0, KeyframeArbiter::Source::Internal, Start + 30ms);
+
+    auto stats = recorder.Arbiter.GetStats();
+    CHECK(stats.Requested == 4);
+    CHECK(stats.Forwarded == 1);
+    CHECK(stats.Pli == 2);
+    CHECK(stats.Fir == 1);
+}
+
+} // namespace
+
+int main() {
+    TestFirstRequestGoesOut();
+    TestCoalescesWithinInterval();
+    TestAllLayers();
+    TestStats();
+    return 0;
+}
@@ -0,0 +1,128 @@
+#include "check.hpp"
+
+#include "nack.hpp"
+
+#include <chrono>
+#include <vector>
+
+namespace {
+
+using namespace std::chrono_literals;
+using Seqs = std::vector<uint16_t>;
+
+const auto Start = sfu::LossDetector::Clock::time_point(1000s);
+
+sfu::RtpPacket MakePacket(uint8_t marker) {
+    rtc::binary data(sfu::RtpFixedHeaderSize + 1);
+    data.back() = std::byte{marker};
+    return sfu::RtpPacket(std::move(data));
+}
+
+void TestHistory() {
+    sfu::RetransmissionHistory history(4);
+    history.Add(10, 900, MakePacket(1));
+    history.Add(11, 900, MakePacket(2));
+
+    auto entry = history.Find(10);
+    CHECK(entry && entry->SeqNumber == 10 && entry->Timestamp == 900);
+    CHECK(entry->Packet.Data().back() == std::byte{1});
+    CHECK(!history.Find(12));
+
+    // 14 takes the slot of 10.
+    history.Add(14, 1800, MakePacket(3));
+    CHECK(!history.Find(10));
+    CHECK(history.Find(14));
+    CHECK(history.Find(11));
+}
+
+void TestLossDetectorRetries() {
+    sfu::LossDetector detector;
+    Seqs nacks;
+
+    detector.OnPacket(100, Start, nacks);
+    CHECK(nacks.empty());
+
+    detector.OnPacket(103, Start, nacks);
+    CHECK((nacks == Seqs{101, 102}));
+
+    // Asked again only once RetryInterval passed.
+    nacks.clear();
+    detector.OnPacket(104, Start + 20ms, nacks);
+    CHECK(nacks.empty());
+    detector.OnPacket(105, Start + 40ms, nacks);
+    CHECK((nacks == Seqs{101, 102}));
+
+    // 101 arrives late and is no longer asked for.
+    nacks.clear();
+    detector.OnPacket(101, Start + 50ms, nacks);
+    detector.OnPacket(106, Start + 80ms, nacks);
+    CHECK((nacks == Seqs{102}));
+
+    // After MaxRetries requests 102 is given up on.
+    nacks.clear();
+    detector.OnPacket(107, Start + 120ms, nacks);
+    detector.OnPacket(108, Start + 200ms, nacks);
+    CHECK(nacks.empty());
+}
+
+void TestLossDetectorRestartAndWrap() {
+    sfu::LossDetector detector;
+    Seqs nacks;
+
+    detector.OnPacket(65534, Start, nacks);
+    detector.OnPacket(1, Start, nacks);
+    CHECK((nacks == Seqs{65535, 0}));
+
+    // A jump past MaxMissing is a restart, not loss.
+    nacks.clear();
+    detector.OnPacket(5000, Start + 100ms, nacks);
+    CHECK(nacks.empty());
+    detector.OnPacket(5001, Start + 200ms, nacks);
+    CHECK(nacks.empty());
+}
+
+void TestBuildAndParseNack() {
+    auto nack = sfu::BuildNack(0x11223344, Seqs{10, 11, 13, 40});
+
+    // One entry with a bitmask for 11 and 13, one for 40.
+    CHECK(nack.size() == 20);
+    CHECK(nack[0] == std::byte{0x81});
+    CHECK(nack[1] == std::byte{205});
+    CHECK(nack[3] == std::byte{4});
+    CHECK(nack[8] == std::byte{0x11} && nack[11] == std::byte{0x44});
+    CHECK(nack[14] == std::byte{0} && nack[15] == std::byte{0b101});
+
+    CHECK((sfu::ParseNack(nack) == Seqs{10, 11, 13, 40}));
+    CHECK(sfu::ParseNack(std::span(nack).first(8)).empty());
+}
+
+void TestRemoveRtx() {
+    std::string answer =
+        "v=0\r\n"
+        "m=audio 9 UDP/TLS/RTP/SAVPF 111\r\n"
+        "a=rtpmap:111 opus/48000/2\r\n"
+        "m=video 9 UDP/TLS/RTP/SAVPF 96 97\r\n"
+        "a=rtpmap:96 VP8/90000\r\n"
+        "a=rtcp-fb:96 nack\r\n"
+        "a=rtpmap:97 rtx/90000\r\n"
+        "a=fmtp:97 apt=96\r\n";
+
+    CHECK(sfu::RemoveRtx(answer) ==
+        "v=0\r\n"
+        "m=audio 9 UDP/TLS/RTP/SAVPF 111\r\n"
+        "a=rtpmap:111 opus/48000/2\r\n"
+        "m=video 9 UDP/TLS/RTP/SAVPF 96\r\n"
+        "a=rtpmap:96 VP8/90000\r\n"
+        "a=rtcp-fb:96 nack\r\n");
+}
+
+} // namespace
+
+int main() {
+    TestHistory();
+    TestLossDetectorRetries();
+    TestLossDetectorRestartAndWrap();
+    TestBuildAndParseNack();
+    TestRemoveRtx();
+    return 0;
+}
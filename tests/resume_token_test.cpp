@@ -0,0 +1,43 @@
+#include "check.hpp"
+
+#include "client.hpp"
+
+#include <string>
+
+namespace {
+
+void TestRoundTrip() {
+    auto token = sfu::MakeResumeToken(1234567890123);
+    CHECK(sfu::ParseResumeRoom(token) == 1234567890123u);
+
+    // The room, a dot and 128 random bits in hex.
+    auto dot = token.find('.');
+    CHECK(token.substr(0, dot) == "1234567890123");
+    CHECK(token.size() - dot - 1 == 32);
+    CHECK(token.find_first_not_of("0123456789abcdef", dot + 1) == std::string::npos);
+
+    CHECK(sfu::ParseResumeRoom(sfu::MakeResumeToken(0)) == 0u);
+}
+
+void TestTokensDiffer() {
+    CHECK(sfu::MakeResumeToken(1) != sfu::MakeResumeToken(1));
+}
+
+void TestRejectsMalformed() {
+    CHECK(!sfu::ParseResumeRoom(""));
+    CHECK(!sfu::ParseResumeRoom("12"));
+    CHECK(!sfu::ParseResumeRoom("12x.ab"));
+    CHECK(!sfu::ParseResumeRoom(".ab"));
+    CHECK(!sfu::ParseResumeRoom("-1.ab"));
+    CHECK(!sfu::ParseResumeRoom("18446744073709551616.ab"));
+    CHECK(sfu::ParseResumeRoom("18446744073709551615.ab") == UINT64_MAX);
+}
+
+} // namespace
+
+int main() {
+    TestRoundTrip();
+    TestTokensDiffer();
+    TestRejectsMalformed();
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include "check.hpp"
+
+#include "rewriter.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include <chrono>
+
+namespace {
+
+using sfu::RtpRewriter;
+using namespace std::chrono_literals;
+
+struct Header {
+    Header(rtc::SSRC ssrc, uint16_t seqNumber, uint32_t timestamp) {
+        auto header = Get();
+        header->preparePacket();
+        header->setSsrc(ssrc);
+        header->setSeqNumber(seqNumber);
+        header->setTimestamp(timestamp);
+    }
+
+    rtc::RtpHeader* Get() {
+        return reinterpret_cast<rtc::RtpHeader*>(Data.data());
+    }
+
+    rtc::binary Data = rtc::binary(12);
+};
+
+void TestPassesFirstSourceThrough() {
+    RtpRewriter rewriter(sfu::VideoClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    CHECK(!rewriter.IsStarted());
+    CHECK((rewriter.Rewrite(Header(1, 100, 5000).Get(), now) == std::pair<uint16_t, uint32_t>(100, 5000)));
+    CHECK((rewriter.Rewrite(Header(1, 101, 8000).Get(), now + 33ms) == std::pair<uint16_t, uint32_t>(101, 8000)));
+    CHECK(rewriter.IsStarted());
+    CHECK(rewriter.LastSeqNumber() == 101);
+}
+
+void TestContinuesAcrossSources() {
+    RtpRewriter rewriter(sfu::VideoClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    rewriter.Rewrite(Header(1, 100, 5000).Get(), now);
+    // 20 ms later at 90 kHz is 1800 ticks on.
+    auto [seqNumber, timestamp] = rewriter.Rewrite(Header(2, 7000, 123456).Get(), now + 20ms);
+    CHECK(seqNumber == 101);
+    CHECK(timestamp == 6800);
+    CHECK(rewriter.ToSourceSeqNumber(101) == 7000);
+
+    // The new source keeps its own spacing.
+    auto next = rewriter.Rewrite(Header(2, 7001, 126456).Get(), now + 53ms);
+    CHECK(next.first == 102);
+    CHECK(next.second == 9800);
+}
+
+void TestResetContinuesSameSsrc() {
+    RtpRewriter rewriter(sfu::AudioClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    rewriter.Rewrite(Header(1, 10, 0).Get(), now);
+    rewriter.Reset();
+    auto [seqNumber, timestamp] = rewriter.Rewrite(Header(1, 500, 960000).Get(), now + 10ms);
+    CHECK(seqNumber == 11);
+    CHECK(timestamp == 480);
+}
+
+void TestSourceChangeAdvancesTimestamp() {
+    RtpRewriter rewriter(sfu::VideoClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    // Even without time passing the timestamp moves on, so the two frames
+    // aren't merged.
+    rewriter.Rewrite(Header(1, 1, 1000).Get(), now);
+    CHECK(rewriter.Rewrite(Header(2, 50, 0).Get(), now).second == 1001);
+}
+
+void TestReorderedPacketKeepsLast() {
+    RtpRewriter rewriter(sfu::VideoClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    rewriter.Rewrite(Header(1, 10, 0).Get(), now);
+    rewriter.Rewrite(Header(1, 12, 0).Get(), now);
+    CHECK(rewriter.Rewrite(Header(1, 11, 0).Get(), now).first == 11);
+    CHECK(rewriter.LastSeqNumber() == 12);
+}
+
+void TestWrapsAround() {
+    RtpRewriter rewriter(sfu::VideoClockRate);
+    auto now = RtpRewriter::Clock::now();
+
+    rewriter.Rewrite(Header(1, 65534, 0).Get(), now);
+    rewriter.Rewrite(Header(1, 65535, 0).Get(), now);
+    CHECK(rewriter.Rewrite(Header(1, 0, 0).Get(), now).first == 0);
+    CHECK(rewriter.LastSeqNumber() == 0);
+
+    CHECK(rewriter.Rewrite(Header(2, 30000, 0).Get(), now + 1ms).first == 1);
+}
+
+} // namespace
+
+int main() {
+    TestPassesFirstSourceThrough();
+    TestContinuesAcrossSources();
+    TestResetContinuesSameSsrc();
+    TestSourceChangeAdvancesTimestamp();
+    TestReorderedPacketKeepsLast();
+    TestWrapsAround();
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "check.hpp"
+
+#include "signaling.hpp"
+
+#include <string>
+
+namespace {
+
+using sfu::SignalingMessage;
+
+void TestReadsFlatObject() {
+    SignalingMessage message(R"( { "type" : "candidate", "candidate":"a b\"c", "ssrc": 42,
+        "active": true, "nested": {"x": [1, "}"]}, "none": null } )");
+    CHECK(message.IsValid());
+
+    CHECK(message.GetRawString("type") == "candidate");
+    CHECK(message.GetRawString("candidate") == R"(a b\"c)");
+    CHECK(message.GetString("candidate") == R"(a b"c)");
+    CHECK(message.GetUnsigned("ssrc") == 42u);
+    CHECK(message.GetBool("active") == true);
+
+    CHECK(message.Contains("nested"));
+    CHECK(!message.IsNull("nested"));
+    CHECK(message.GetRaw("nested") == R"({"x": [1, "}"]})");
+    CHECK(message.IsNull("none"));
+
+    CHECK(!message.Contains("missing"));
+    CHECK(!message.GetString("ssrc"));
+    CHECK(!message.GetUnsigned("type"));
+    CHECK(!message.GetBool("ssrc"));
+}
+
+void TestRejectsMalformed() {
+    CHECK(SignalingMessage("{}").IsValid());
+    CHECK(!SignalingMessage("").IsValid());
+    CHECK(!SignalingMessage("[1]").IsValid());
+    CHECK(!SignalingMessage(R"({"type":"ping"} x)").IsValid());
+    CHECK(!SignalingMessage(R"({"type":"ping",})").IsValid());
+    CHECK(!SignalingMessage(R"({"type":"ping)").IsValid());
+    CHECK(!SignalingMessage(R"({"type" "ping"})").IsValid());
+    CHECK(!SignalingMessage(R"({"a":{"b":1})").IsValid());
+    CHECK(!SignalingMessage(R"({"a":{"b":1]})").IsValid());
+    CHECK(!SignalingMessage(R"({"a":[1,]})").IsValid());
+
+    // Literals and numbers follow the JSON grammar, nested ones too.
+    CHECK(!SignalingMessage(R"({"type":"ping","x":garbage})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":tru})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":nulls})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":[1,falsy]})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":01})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":1.})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":.5})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":1e})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":+1})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":-})").IsValid());
+    CHECK(!SignalingMessage(R"({"x":0x10})").IsValid());
+    CHECK(!SignalingMessage("{\"x\":\"a\nb\"}").IsValid());
+    CHECK(SignalingMessage(R"({"a":-0.5e+3,"b":[true,false,null,{"c":1E-2}]})").IsValid());
+}
+
+void TestManyFields() {
+    // Fields past MaxFields are checked but not indexed.
+    std::string many = "{";
+    for (size_t i = 0; i <= SignalingMessage::MaxFields; ++i) {
+        many += (i ? ",\"f" : "\"f") + std::to_string(i) + "\":" + std::to_string(i);
+    }
+    // The message points into the text, which has to outlive it.
+    auto text = many + "}";
+    SignalingMessage message(text);
+    CHECK(message.IsValid());
+    CHECK(message.GetUnsigned("f0") == 0u);
+    CHECK(message.GetUnsigned("f" + std::to_string(SignalingMessage::MaxFields - 1)) == SignalingMessage::MaxFields - 1);
+    CHECK(!message.Contains("f" + std::to_string(SignalingMessage::MaxFields)));
+
+    CHECK(!SignalingMessage(many + ",\"bad\":x}").IsValid());
+}
+
+void TestLastKeyWins() {
+    SignalingMessage message(R"({"type":"ping","type":"leave"})");
+    CHECK(message.GetRawString("type") == "leave");
+}
+
+void TestUnescapes() {
+    SignalingMessage message(R"({"s":"\\\/\n\t\u00e9\ud83d\ude00","bad":"\x"})");
+    CHECK(message.GetString("s") == "\\/\n\t\xc3\xa9\xf0\x9f\x98\x80");
+    CHECK(!message.GetString("bad"));
+}
+
+void TestNumbers() {
+    SignalingMessage message(R"({"float":1.0,"exp":1e0,"frac":1.5,"neg":-3,"negFloat":-3.0,
+        "max":18446744073709551615,"huge":1e20,"negZero":-0,"text":"1"})");
+
+    // Integral floats are accepted, like nlohmann::json does.
+    CHECK(message.GetUnsigned("float") == 1u);
+    CHECK(message.GetUnsigned("exp") == 1u);
+    CHECK(message.GetInteger("negFloat") == -3);
+    CHECK(message.GetUnsigned("negZero") == 0u);
+
+    CHECK(!message.GetUnsigned("frac"));
+    CHECK(!message.GetInteger("frac"));
+    CHECK(!message.GetUnsigned("neg"));
+    CHECK(message.GetInteger("neg") == -3);
+
+    CHECK(message.GetUnsigned("max") == UINT64_MAX);
+    CHECK(!message.GetInteger("max"));
+    CHECK(!message.GetUnsigned("huge"));
+    CHECK(!message.GetUnsigned("text"));
+}
+
+void TestWritesMessages() {
+    std::string out;
+    sfu::AppendJsonString(out, "a\"b\\c\n\x01");
+    CHECK(out == R"("a\"b\\c\n\u0001")");
+
+    CHECK(sfu::MakeModeMessage(7, true) == R"({"type":"mode","ssrc":7,"active":true})");
+    CHECK(sfu::MakeModeMessage(7, false) == R"({"type":"mode","ssrc":7,"active":false})");
+    CHECK(sfu::MakeCandidateMessage("candidate:1", "0") == R"({"type":"candidate","candidate":"candidate:1","sdpMid":"0"})");
+    CHECK(sfu::MakeCandidateMessage("candidate:1", "") == R"({"type":"candidate","candidate":"candidate:1"})");
+
+    // What we write, we read back.
+    SignalingMessage candidate(sfu::MakeCandidateMessage("a\"b", "m"));
+    CHECK(candidate.IsValid());
+    CHECK(candidate.GetString("candidate") == "a\"b");
+    CHECK(SignalingMessage(sfu::PongMessage).GetRawString("type") == "pong");
+}
+
+} // namespace
+
+int main() {
+    TestReadsFlatObject();
+    TestRejectsMalformed();
+    TestManyFields();
+    TestLastKeyWins();
+    TestUnescapes();
+    TestNumbers();
+    TestWritesMessages();
+    return 0;
+}
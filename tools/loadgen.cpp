@@ -0,0 +1,714 @@
+// Headless load generator for sfu_server. Connects simulated participants
+// over loopback, publishes synthetic Opus and VP8 RTP at realistic rates and
+// reports how the server forwards it, as JSON on stdout:
+//
+//   openssl genrsa -out data/private.pem 2048
+//   openssl rsa -in data/private.pem -pubout -out data/public.pem
+//   sfu_server & sfu_loadgen --clients 20 --rooms 2 --server-pid $!
+//
+// Every packet carries its publisher and send time after the codec header,
+// which the server forwards untouched, so latency is measured per packet and
+// loss per publisher.
+// With --max-p99-ms or --max-loss the exit code is 2 when the run is over
+// budget, for use as a release gate.
+
+#include "utils.hpp"
+
+#include <rtc/rtc.hpp>
+
+#include "external/jwt-cpp/include/jwt-cpp/jwt.h"
+
+#include <nlohmann/json.hpp>
+
+#include <sys/sysinfo.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using json = nlohmann::json;
+using Clock = std::chrono::steady_clock;
+
+constexpr uint32_t Magic = 0x4C47454E; // "LGEN"
+constexpr size_t MarkerSize = 16;
+constexpr size_t RtpHeaderSize = 12;
+constexpr size_t MaxPayloadSize = 1200;
+
+constexpr uint8_t OpusPayloadType = 111;
+constexpr uint8_t Vp8PayloadType = 96;
+
+constexpr auto AudioInterval = std::chrono::milliseconds(20);
+constexpr auto VideoInterval = std::chrono::microseconds(33333);
+constexpr auto KeyframeInterval = std::chrono::seconds(2);
+constexpr size_t AudioPayloadSize = 80;
+
+// The marker follows the VP8 descriptor and frame header, padded to this offset.
+constexpr size_t VideoMarkerOffset = 12;
+
+struct Options {
+    std::string Url = "ws://127.0.0.1:8000";
+    std::string PrivateKeyPath = "data/private.pem";
+    size_t Clients = 10;
+    size_t Rooms = 1;
+    std::chrono::seconds Duration{20};
+    std::chrono::seconds Warmup{3};
+    std::chrono::seconds JoinTimeout{15};
+    uint32_t VideoBitrate = 1'000'000;
+    int ServerPid = 0;
+    std::optional<double> MaxP99Ms;
+    std::optional<double> MaxLoss;
+};
+
+template <typename T>
+bool ParseNumber(std::string_view value, T& result) {
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    return ec == std::errc() && ptr == value.data() + value.size();
+}
+
+std::optional<Options> ParseOptions(int argc, char** argv) {
+    Options options;
+
+    for (int i = 1; i < argc; i += 2) {
+        std::string_view name = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << name << std::endl;
+            return {};
+        }
+        std::string_view value = argv[i + 1];
+
+        bool ok = true;
+        int64_t seconds = 0;
+        double limit = 0;
+        if (name == "--url") {
+            options.Url = value;
+        } else if (name == "--private-key") {
+            options.PrivateKeyPath = value;
+        } else if (name == "--clients") {
+            ok = ParseNumber(value, options.Clients) && options.Clients > 0;
+        } else if (name == "--rooms") {
+            ok = ParseNumber(value, options.Rooms) && options.Rooms > 0;
+        } else if (name == "--duration") {
+            ok = ParseNumber(value, seconds) && seconds > 0;
+            options.Duration = std::chrono::seconds(seconds);
+        } else if (name == "--warmup") {
+            ok = ParseNumber(value, seconds) && seconds >= 0;
+            options.Warmup = std::chrono::seconds(seconds);
+        } else if (name == "--video-bitrate") {
+            ok = ParseNumber(value, options.VideoBitrate);
+        } else if (name == "--server-pid") {
+            ok = ParseNumber(value, options.ServerPid);
+        } else if (name == "--max-p99-ms") {
+            ok = ParseNumber(value, limit);
+            options.MaxP99Ms = limit;
+        } else if (name == "--max-loss") {
+            ok = ParseNumber(value, limit);
+            options.MaxLoss = limit;
+        } else {
+            std::cerr << "Unknown option " << name << std::endl;
+            return {};
+        }
+
+        if (!ok) {
+            std::cerr << "Invalid value for " << name << ": " << value << std::endl;
+            return {};
+        }
+    }
+
+    return options;
+}
+
+int64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now().time_since_epoch()).count();
+}
+
+void WriteUint16(std::byte* out, uint16_t value) {
+    out[0] = static_cast<std::byte>(value >> 8);
+    out[1] = static_cast<std::byte>(value);
+}
+
+void WriteUint32(std::byte* out, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) {
+        out[i] = static_cast<std::byte>(value >> (24 - 8 * i));
+    }
+}
+
+void WriteUint64(std::byte* out, uint64_t value) {
+    WriteUint32(out, static_cast<uint32_t>(value >> 32));
+    WriteUint32(out + 4, static_cast<uint32_t>(value));
+}
+
+uint32_t ReadUint32(const std::byte* in) {
+    uint32_t value = 0;
+    for (size_t i = 0; i < 4; ++i) {
+        value = (value << 8) | std::to_integer<uint8_t>(in[i]);
+    }
+    return value;
+}
+
+uint64_t ReadUint64(const std::byte* in) {
+    return (uint64_t(ReadUint32(in)) << 32) | ReadUint32(in + 4);
+}
+
+// Lock-free latency histogram with 20 us buckets up to 2 s.
+class Histogram {
+public:
+    static constexpr int64_t BucketNs = 20'000;
+    static constexpr size_t BucketCount = 100'000;
+
+    void Add(int64_t latencyNs) {
+        auto bucket = std::clamp<int64_t>(latencyNs / BucketNs, 0, BucketCount - 1);
+        Buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+        Count_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t GetCount() const {
+        return Count_.load(std::memory_order_relaxed);
+    }
+
+    // Upper bound of the bucket holding the given quantile, in milliseconds.
+    double GetQuantileMs(double quantile) const {
+        auto count = GetCount();
+        if (count == 0) {
+            return 0;
+        }
+
+        auto rank = static_cast<uint64_t>(quantile * (count - 1)) + 1;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < BucketCount; ++i) {
+            seen += Buckets_[i].load(std::memory_order_relaxed);
+            if (seen >= rank) {
+                return (i + 1) * BucketNs / 1e6;
+            }
+        }
+        return BucketCount * BucketNs / 1e6;
+    }
+
+    json ToJson() const {
+        return {
+            {"p50", GetQuantileMs(0.5)},
+            {"p95", GetQuantileMs(0.95)},
+            {"p99", GetQuantileMs(0.99)},
+            {"max", GetQuantileMs(1.0)},
+        };
+    }
+
+private:
+    std::vector<std::atomic<uint64_t>> Buckets_ = std::vector<std::atomic<uint64_t>>(BucketCount);
+    std::atomic<uint64_t> Count_ = 0;
+};
+
+struct KindStats {
+    std::atomic<uint64_t> Sent = 0;
+    std::atomic<uint64_t> Expected = 0;
+    std::atomic<uint64_t> Received = 0;
+    Histogram Latency;
+};
+
+// Measured packets of one publisher and kind, to find the worst served one.
+struct PublisherStats {
+    std::atomic<uint64_t> Expected = 0;
+    std::atomic<uint64_t> Received = 0;
+};
+
+// Packets stamped inside [Start, End) are measured; the rest are warm-up and drain.
+struct Window {
+    std::atomic<int64_t> Start = INT64_MAX;
+    std::atomic<int64_t> End = INT64_MAX;
+
+    bool Contains(int64_t time) const {
+        return time >= Start.load(std::memory_order_relaxed) && time < End.load(std::memory_order_relaxed);
+    }
+};
+
+struct SimulatedClient {
+    size_t Index;
+    uint64_t RoomId;
+    uint64_t UserId;
+    std::string Token;
+
+    std::shared_ptr<rtc::WebSocket> Ws;
+    std::shared_ptr<rtc::PeerConnection> Pc;
+    std::shared_ptr<rtc::Track> Audio;
+    std::shared_ptr<rtc::Track> Video;
+    std::mutex TracksMutex;
+    std::vector<std::shared_ptr<rtc::Track>> Incoming;
+
+    // Other connected members of the room, fixed once the joins settle.
+    size_t Subscribers = 0;
+    // Audio and video this client published.
+    std::array<PublisherStats, 2> Published;
+
+    Clock::time_point JoinStart;
+    std::atomic<int64_t> JoinMicros = -1;
+
+    // Touched by the sending thread only.
+    uint16_t AudioSeq = 0;
+    uint16_t VideoSeq = 0;
+    uint32_t AudioTimestamp = 0;
+    uint32_t VideoTimestamp = 0;
+};
+
+class LoadGenerator {
+public:
+    explicit LoadGenerator(Options options)
+        : Options_(std::move(options))
+    { }
+
+    int Run();
+
+private:
+    std::string MintToken(uint64_t roomId, uint64_t userId, const std::string& privateKey) const;
+    void Connect(SimulatedClient& client);
+    void HandleSignaling(SimulatedClient& client, const std::string& message);
+    void OnIncomingTrack(SimulatedClient& client, std::shared_ptr<rtc::Track> track);
+    void Receive(bool video, const rtc::binary& packet);
+
+    void SendAudio(SimulatedClient& client);
+    void SendVideoFrame(SimulatedClient& client, bool keyframe);
+    void Send(SimulatedClient& client, const std::shared_ptr<rtc::Track>& track, rtc::binary& packet, bool video);
+
+    std::optional<double> ReadServerCpuSeconds() const;
+    size_t GetRoomSize(uint64_t roomId) const;
+
+    Options Options_;
+    std::vector<std::unique_ptr<SimulatedClient>> Clients_;
+
+    Window Window_;
+    KindStats Audio_;
+    KindStats Video_;
+    std::atomic<uint64_t> SignalingErrors_ = 0;
+};
+
+std::string LoadGenerator::MintToken(uint64_t roomId, uint64_t userId, const std::string& privateKey) const {
+    auto now = std::chrono::system_clock::now();
+    return jwt::create()
+        .set_type("JWT")
+        .set_issued_at(now)
+        .set_expires_at(now + std::chrono::hours(1))
+        .set_payload_claim("room", jwt::claim(picojson::value(static_cast<int64_t>(roomId))))
+        .set_payload_claim("user_id", jwt::claim(picojson::value(static_cast<int64_t>(userId))))
+        .sign(jwt::algorithm::rs256("", privateKey, "", ""));
+}
+
+void LoadGenerator::Connect(SimulatedClient& client) {
+    client.JoinStart = Clock::now();
+
+    rtc::Configuration config;
+    config.disableAutoNegotiation = true;
+    client.Pc = std::make_shared<rtc::PeerConnection>(config);
+
+    // Same m-line layout as voice-lib.js: audio on mid 0, video on mid 1.
+    rtc::Description::Audio audio("0", rtc::Description::Direction::SendOnly);
+    audio.addOpusCodec(OpusPayloadType);
+    audio.addSSRC(static_cast<rtc::SSRC>(1000 + 2 * client.Index), "audio", "loadgen" + std::to_string(client.Index));
+    client.Audio = client.Pc->addTrack(audio);
+
+    rtc::Description::Video video("1", rtc::Description::Direction::SendOnly);
+    video.addVP8Codec(Vp8PayloadType);
+    video.addSSRC(static_cast<rtc::SSRC>(1001 + 2 * client.Index), "video", "loadgen" + std::to_string(client.Index));
+    client.Video = client.Pc->addTrack(video);
+
+    auto* self = &client;
+    client.Pc->onLocalDescription([this, self](const rtc::Description& description) {
+        json message = {
+            {"type", description.typeString()},
+            {"sdp", std::string(description)},
+        };
+        if (description.type() == rtc::Description::Type::Offer) {
+            message["token"] = self->Token;
+        }
+        self->Ws->send(message.dump());
+    });
+
+    client.Pc->onLocalCandidate([self](const rtc::Candidate& candidate) {
+        self->Ws->send(json{
+            {"type", "candidate"},
+            {"candidate", candidate.candidate()},
+            {"sdpMid", candidate.mid()},
+        }.dump());
+    });
+
+    client.Pc->onStateChange([self](rtc::PeerConnection::State state) {
+        if (state == rtc::PeerConnection::State::Connected) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - self->JoinStart);
+            self->JoinMicros = elapsed.count();
+            // The server forwards no video until the publisher says it is on.
+            self->Ws->send(json{{"type", "mode"}, {"active", true}}.dump());
+        }
+    });
+
+    client.Pc->onTrack([this, self](std::shared_ptr<rtc::Track> track) {
+        OnIncomingTrack(*self, std::move(track));
+    });
+
+    client.Ws = std::make_shared<rtc::WebSocket>();
+    client.Ws->onOpen([self] {
+        self->Pc->setLocalDescription(rtc::Description::Type::Offer);
+    });
+    client.Ws->onMessage([this, self](rtc::message_variant message) {
+        if (auto text = std::get_if<std::string>(&message)) {
+            HandleSignaling(*self, *text);
+        }
+    });
+    client.Ws->open(Options_.Url);
+}
+
+void LoadGenerator::HandleSignaling(SimulatedClient& client, const std::string& message) {
+    json j = json::parse(message, nullptr, false);
+    if (j.is_discarded() || !j.is_object()) {
+        // The server reports errors as plain text.
+        std::cerr << "[Client " << client.UserId << "] " << message << std::endl;
+        SignalingErrors_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto type = j.value("type", "");
+    if (type == "offer" || type == "answer") {
+        client.Pc->setRemoteDescription(rtc::Description(j.value("sdp", ""), type));
+        if (type == "offer") {
+            client.Pc->setLocalDescription();
+        }
+    } else if (type == "candidate") {
+        try {
+            client.Pc->addRemoteCandidate(rtc::Candidate(j.value("candidate", ""), j.value("sdpMid", "")));
+        } catch (const std::exception& ex) {
+            std::cerr << "[Client " << client.UserId << "] Bad candidate: " << ex.what() << std::endl;
+        }
+    }
+}
+
+void LoadGenerator::OnIncomingTrack(SimulatedClient& client, std::shared_ptr<rtc::Track> track) {
+    if (track->mid() == "0" || track->mid() == "1") {
+        return;
+    }
+
+    // Receiver reports keep the server's bandwidth estimate realistic.
+    track->setMediaHandler(std::make_shared<rtc::RtcpReceivingSession>());
+
+    bool video = track->description().type() == "video";
+    track->onMessage([this, video](rtc::binary packet) {
+        Receive(video, packet);
+    }, nullptr);
+
+    std::lock_guard<std::mutex> lock(client.TracksMutex);
+    client.Incoming.push_back(std::move(track));
+}
+
+void LoadGenerator::Receive(bool video, const rtc::binary& packet) {
+    auto now = Now();
+    if (packet.size() < RtpHeaderSize) {
+        return;
+    }
+
+    auto first = std::to_integer<uint8_t>(packet[0]);
+    size_t offset = RtpHeaderSize + 4 * (first & 0x0F);
+    if ((first & 0x10) && packet.size() >= offset + 4) {
+        offset += 4 + 4 * ((std::to_integer<size_t>(packet[offset + 2]) << 8) | std::to_integer<size_t>(packet[offset + 3]));
+    }
+    offset += video ? VideoMarkerOffset : 0;
+
+    if (packet.size() < offset + MarkerSize || ReadUint32(packet.data() + offset) != Magic) {
+        return;
+    }
+
+    auto publisher = ReadUint32(packet.data() + offset + 4);
+    auto sentAt = static_cast<int64_t>(ReadUint64(packet.data() + offset + 8));
+    if (!Window_.Contains(sentAt)) {
+        return;
+    }
+
+    auto& stats = video ? Video_ : Audio_;
+    stats.Received.fetch_add(1, std::memory_order_relaxed);
+    stats.Latency.Add(now - sentAt);
+    if (publisher < Clients_.size()) {
+        Clients_[publisher]->Published[video].Received.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+void LoadGenerator::Send(SimulatedClient& client, const std::shared_ptr<rtc::Track>& track, rtc::binary& packet, bool video) {
+    if (!track->isOpen()) {
+        return;
+    }
+
+    // The marker is written last so the send time is as late as possible.
+    size_t offset = RtpHeaderSize + (video ? VideoMarkerOffset : 0);
+    auto sentAt = Now();
+    WriteUint64(packet.data() + offset + 8, static_cast<uint64_t>(sentAt));
+
+    bool measured = Window_.Contains(sentAt);
+    try {
+        track->send(std::move(packet));
+    } catch (const std::exception&) {
+        return;
+    }
+
+    if (measured) {
+        auto& stats = video ? Video_ : Audio_;
+        stats.Sent.fetch_add(1, std::memory_order_relaxed);
+        stats.Expected.fetch_add(client.Subscribers, std::memory_order_relaxed);
+        client.Published[video].Expected.fetch_add(client.Subscribers, std::memory_order_relaxed);
+    }
+}
+
+void LoadGenerator::SendAudio(SimulatedClient& client) {
+    rtc::binary packet(RtpHeaderSize + AudioPayloadSize);
+    packet[0] = std::byte{0x80};
+    packet[1] = std::byte{OpusPayloadType};
+    WriteUint16(&packet[2], client.AudioSeq++);
+    WriteUint32(&packet[4], client.AudioTimestamp);
+    WriteUint32(&packet[8], static_cast<uint32_t>(1000 + 2 * client.Index));
+    client.AudioTimestamp += 960;
+
+    WriteUint32(&packet[RtpHeaderSize], Magic);
+    WriteUint32(&packet[RtpHeaderSize + 4], static_cast<uint32_t>(client.Index));
+    Send(client, client.Audio, packet, false);
+}
+
+void LoadGenerator::SendVideoFrame(SimulatedClient& client, bool keyframe) {
+    size_t frameSize = Options_.VideoBitrate / 8 / 30 * (keyframe ? 3 : 1);
+    size_t packetCount = std::max<size_t>(1, (frameSize + MaxPayloadSize - 1) / MaxPayloadSize);
+
+    for (size_t i = 0; i < packetCount; ++i) {
+        size_t payloadSize = std::max(MaxPayloadSize, VideoMarkerOffset + MarkerSize);
+        rtc::binary packet(RtpHeaderSize + payloadSize);
+        packet[0] = std::byte{0x80};
+        packet[1] = std::byte{static_cast<uint8_t>(Vp8PayloadType | (i + 1 == packetCount ? 0x80 : 0))};
+        WriteUint16(&packet[2], client.VideoSeq++);
+        WriteUint32(&packet[4], client.VideoTimestamp);
+        WriteUint32(&packet[8], static_cast<uint32_t>(1001 + 2 * client.Index));
+
+        auto* body = &packet[RtpHeaderSize];
+        // VP8 payload descriptor with S set on the first packet, then the
+        // frame header whose low bit is the inverse key frame flag.
+        body[0] = std::byte{static_cast<uint8_t>(i == 0 ? 0x10 : 0x00)};
+        if (i == 0) {
+            body[1] = std::byte{static_cast<uint8_t>(keyframe ? 0x00 : 0x01)};
+            if (keyframe) {
+                // Start code and a 16x16 frame size.
+                body[4] = std::byte{0x9d};
+                body[5] = std::byte{0x01};
+                body[6] = std::byte{0x2a};
+                body[7] = std::byte{16};
+                body[9] = std::byte{16};
+            }
+        }
+
+        WriteUint32(body + VideoMarkerOffset, Magic);
+        WriteUint32(body + VideoMarkerOffset + 4, static_cast<uint32_t>(client.Index));
+        Send(client, client.Video, packet, true);
+    }
+
+    client.VideoTimestamp += 3000;
+}
+
+std::optional<double> LoadGenerator::ReadServerCpuSeconds() const {
+    if (Options_.ServerPid <= 0) {
+        return {};
+    }
+
+    std::ifstream file("/proc/" + std::to_string(Options_.ServerPid) + "/stat");
+    std::string stat;
+    if (!std::getline(file, stat)) {
+        return {};
+    }
+
+    // Fields after the parenthesised command name; utime and stime are 14 and 15.
+    std::istringstream fields(stat.substr(stat.rfind(')') + 2));
+    std::string field;
+    uint64_t utime = 0;
+    uint64_t stime = 0;
+    for (int i = 3; i <= 15 && fields >> field; ++i) {
+        if (i == 14) {
+            utime = std::stoull(field);
+        } else if (i == 15) {
+            stime = std::stoull(field);
+        }
+    }
+
+    return static_cast<double>(utime + stime) / sysconf(_SC_CLK_TCK);
+}
+
+size_t LoadGenerator::GetRoomSize(uint64_t roomId) const {
+    return std::count_if(Clients_.begin(), Clients_.end(), [roomId](const auto& client) {
+        return client->RoomId == roomId && client->JoinMicros.load(std::memory_order_relaxed) >= 0;
+    });
+}
+
+int LoadGenerator::Run() {
+    auto privateKey = ReadPemFile(Options_.PrivateKeyPath);
+    if (privateKey.empty()) {
+        std::cerr << "Private key " << Options_.PrivateKeyPath << " is empty" << std::endl;
+        return 1;
+    }
+
+    for (size_t i = 0; i < Options_.Clients; ++i) {
+        auto client = std::make_unique<SimulatedClient>();
+        client->Index = i;
+        client->RoomId = 1 + i % Options_.Rooms;
+        client->UserId = 1 + i;
+        client->Token = MintToken(client->RoomId, client->UserId, privateKey);
+        Clients_.push_back(std::move(client));
+    }
+
+    for (auto& client : Clients_) {
+        Connect(*client);
+    }
+
+    auto joined = [this] {
+        return static_cast<size_t>(std::count_if(Clients_.begin(), Clients_.end(), [](const auto& client) {
+            return client->JoinMicros.load(std::memory_order_relaxed) >= 0;
+        }));
+    };
+
+    auto deadline = Clock::now() + Options_.JoinTimeout;
+    while (Clock::now() < deadline && joined() < Clients_.size()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+
+    auto start = Clock::now();
+    auto measureStart = start + Options_.Warmup;
+    auto measureEnd = measureStart + Options_.Duration;
+    Window_.Start = std::chrono::duration_cast<std::chrono::nanoseconds>(measureStart.time_since_epoch()).count();
+    Window_.End = std::chrono::duration_cast<std::chrono::nanoseconds>(measureEnd.time_since_epoch()).count();
+
+    // Each packet reaches every other connected member of its room.
+    for (auto& client : Clients_) {
+        auto roomSize = GetRoomSize(client->RoomId);
+        client->Subscribers = roomSize > 0 ? roomSize - 1 : 0;
+    }
+
+    std::optional<double> cpuStart;
+    bool measuring = false;
+    auto nextAudio = start;
+    auto nextVideo = start;
+    auto nextKeyframe = start;
+
+    while (Clock::now() < measureEnd) {
+        auto now = Clock::now();
+        if (!measuring && now >= measureStart) {
+            measuring = true;
+            cpuStart = ReadServerCpuSeconds();
+        }
+
+        if (now >= nextAudio) {
+            for (auto& client : Clients_) {
+                SendAudio(*client);
+            }
+            nextAudio += AudioInterval;
+        }
+
+        if (now >= nextVideo) {
+            bool keyframe = now >= nextKeyframe;
+            for (auto& client : Clients_) {
+                SendVideoFrame(*client, keyframe);
+            }
+            if (keyframe) {
+                nextKeyframe += KeyframeInterval;
+            }
+            nextVideo += VideoInterval;
+        }
+
+        std::this_thread::sleep_until(std::min(nextAudio, nextVideo));
+    }
+
+    auto cpuEnd = ReadServerCpuSeconds();
+
+    // Let packets still in flight arrive.
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+
+    std::vector<int64_t> joins;
+    for (auto& client : Clients_) {
+        if (auto micros = client->JoinMicros.load(); micros >= 0) {
+            joins.push_back(micros);
+        }
+    }
+    std::sort(joins.begin(), joins.end());
+    auto joinQuantile = [&joins](double quantile) {
+        return joins.empty() ? 0.0 : joins[static_cast<size_t>(quantile * (joins.size() - 1))] / 1e3;
+    };
+
+    auto loss = [](uint64_t expected, uint64_t received) {
+        return expected ? 1.0 - static_cast<double>(std::min(received, expected)) / expected : 0.0;
+    };
+    auto kindJson = [this, &loss](const KindStats& stats, size_t kind) {
+        double maxPublisherLoss = 0;
+        for (const auto& client : Clients_) {
+            const auto& published = client->Published[kind];
+            maxPublisherLoss = std::max(maxPublisherLoss, loss(published.Expected.load(), published.Received.load()));
+        }
+
+        auto expected = stats.Expected.load();
+        auto received = stats.Received.load();
+        return json{
+            {"sent", stats.Sent.load()},
+            {"expected", expected},
+            {"received", received},
+            {"loss", loss(expected, received)},
+            {"max_publisher_loss", maxPublisherLoss},
+            {"latency_ms", stats.Latency.ToJson()},
+        };
+    };
+
+    json report = {
+        {"clients", Clients_.size()},
+        {"rooms", Options_.Rooms},
+        {"duration_s", Options_.Duration.count()},
+        {"connected", joins.size()},
+        {"signaling_errors", SignalingErrors_.load()},
+        {"join_ms", {{"p50", joinQuantile(0.5)}, {"p95", joinQuantile(0.95)}, {"max", joinQuantile(1.0)}}},
+        {"audio", kindJson(Audio_, 0)},
+        {"video", kindJson(Video_, 1)},
+    };
+
+    auto forwarded = Audio_.Received.load() + Video_.Received.load();
+    if (cpuStart && cpuEnd && forwarded) {
+        report["server_cpu_s"] = *cpuEnd - *cpuStart;
+        report["server_cpu_us_per_packet"] = (*cpuEnd - *cpuStart) * 1e6 / forwarded;
+    }
+
+    std::cout << report.dump(2) << std::endl;
+
+    bool failed = joins.size() < Clients_.size();
+    for (const auto* kind : {"audio", "video"}) {
+        if (Options_.MaxP99Ms && report[kind]["latency_ms"]["p99"].get<double>() > *Options_.MaxP99Ms) {
+            failed = true;
+        }
+        if (Options_.MaxLoss && report[kind]["loss"].get<double>() > *Options_.MaxLoss) {
+            failed = true;
+        }
+    }
+
+    for (auto& client : Clients_) {
+        client->Ws->close();
+        client->Pc->close();
+    }
+
+    return (Options_.MaxP99Ms || Options_.MaxLoss) && failed ? 2 : 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    auto options = ParseOptions(argc, argv);
+    if (!options) {
+        return 1;
+    }
+
+    rtc::InitLogger(rtc::LogLevel::Warning);
+    return LoadGenerator(std::move(*options)).Run();
+}
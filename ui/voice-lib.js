@@ -30,6 +30,9 @@ export class VoiceClient {
     
     // Receives { type: "mode", ssrc: 123, active: true/false }
     this.onRemoteMode = config.onRemoteMode || (() => {}); 
+
+    // Receives { type: "speakers", speakers: [{ id: 42, ssrc: 123 }, ...] }, loudest first
+    this.onSpeakers = config.onSpeakers || (() => {});
   }
 
   /**
@@ -84,6 +87,12 @@ export class VoiceClient {
             return;
         }
 
+        // --- HANDLER: Active speakers (video SSRC based) ---
+        if (data.type === "speakers") {
+            this.onSpeakers(data);
+            return;
+        }
+
         if (data.error || data.type === "error") {
           clearTimeout(timer);
           this.isConnecting = false;
@@ -158,6 +167,18 @@ export class VoiceClient {
     }
   }
 
+  // Tells the server whether the remote video with this SSRC is shown, so
+  // hidden videos aren't sent at all.
+  setRemoteVideoRendered(ssrc, rendered) {
+    if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+        this.ws.send(JSON.stringify({
+            type: "render",
+            ssrc: ssrc,
+            active: rendered
+        }));
+    }
+  }
+
   // --- CAMERA LOGIC ---
 
   async startCamera() {